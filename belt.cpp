@@ -0,0 +1,416 @@
+#include "belt.h"
+#include "corerenderer.h"
+#include "matrix.h"
+#include "jobsystem.h"
+
+#include<math.h>
+#include<stdio.h>
+#include<algorithm>
+
+static const float PI = 3.14159265358979f;
+
+// Rocks per job when the positions are split over threads
+static const int ROCK_GRAIN = 2048;
+
+// Attribute slots for the instance data. gl_Vertex and gl_Normal are drawn
+// from the fixed function arrays, and some drivers alias those to generic
+// attributes 0 and 2, so the instance data stays clear of them.
+static const GLuint INSTANCE_ATTRIBUTE = 6;
+static const GLuint COLOR_ATTRIBUTE = 7;
+
+// Lights the mesh the way the fixed function pipeline lights the planets: two
+// directional lights, diffuse only, plus the global ambient term
+static const char *vertexSource =
+	"#version 120\n"
+	"attribute vec4 instance;\n"
+	"attribute vec4 instanceColor;\n"
+	"void main() {\n"
+	"	vec4 position = vec4(gl_Vertex.xyz * instance.w + instance.xyz, 1.0);\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * position;\n"
+	"	vec3 normal = normalize(gl_NormalMatrix * gl_Normal);\n"
+	"	vec3 light = gl_LightModel.ambient.rgb;\n"
+	"	for (int i = 0; i < 2; i++)\n"
+	"		light += gl_LightSource[i].diffuse.rgb * max(dot(normal, normalize(gl_LightSource[i].position.xyz)), 0.0);\n"
+	"	gl_FrontColor = vec4(instanceColor.rgb * light, instanceColor.a);\n"
+	"}\n";
+
+static const char *fragmentSource =
+	"#version 120\n"
+	"void main() {\n"
+	"	gl_FragColor = gl_Color;\n"
+	"}\n";
+
+// The same for the core profile, where the mesh comes from generic attributes
+// and the projection and lights from the frame block. Follows frameBlockSource.
+static const char *coreVertexSource =
+	"uniform mat4 modelview;\n"
+	"uniform mat3 normalMatrix;\n"
+	"in vec3 position;\n"
+	"in vec3 normal;\n"
+	"in vec4 instance;\n"
+	"in vec4 instanceColor;\n"
+	"out vec4 shade;\n"
+	"void main() {\n"
+	"	vec4 world = vec4(position * instance.w + instance.xyz, 1.0);\n"
+	"	gl_Position = projection * (modelview * world);\n"
+	"	vec3 light = lightColor(normalize(normalMatrix * normal));\n"
+	"	shade = vec4(clamp(instanceColor.rgb * light, 0.0, 1.0), instanceColor.a);\n"
+	"}\n";
+
+static const char *coreFragmentSource =
+	"#version 330\n"
+	"in vec4 shade;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	fragColor = shade;\n"
+	"}\n";
+
+// Small deterministic generator, so the belt looks the same every run
+static float randomFloat(unsigned int &seed, float lo, float hi) {
+	seed = seed * 1664525u + 1013904223u;
+	return lo + (hi - lo) * ((seed >> 8) / 16777216.0f);
+}
+
+//////////////////////////////////////////////////////////////////
+/// Simulation side //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// The sector an angle in degrees falls in. Render angles can be a step past
+// 360, or below 0 for a rock going backwards, so it is wrapped first.
+static int sectorOfAngle(float degrees) {
+	float wrapped = fmodf(degrees, 360);
+	if (wrapped < 0)
+		wrapped += 360;
+	int s = (int)(wrapped * (BELT_SECTORS / 360.0f));
+	// wrapped can round up to 360 itself
+	return std::min(std::max(s, 0), BELT_SECTORS - 1);
+}
+
+AsteroidBelt::AsteroidBelt() : parent(0), first(0), count(0), version(0), largest(0) {
+	for (int s = 0; s <= BELT_SECTORS; s++)
+		sectorStart[s] = 0;
+}
+
+void AsteroidBelt::addRocks(BodyStore &store, int parent, int n, float innerRadius, float outerRadius, unsigned int seed) {
+	store.reserve(store.count() + n);
+	for (int i = 0; i < n; i++) {
+		float orbit = randomFloat(seed, innerRadius, outerRadius);
+		// the inner edge goes round about as fast as Mars, the outer edge as Jupiter
+		float rate = 1.7f - 0.4f * (orbit - innerRadius) / (outerRadius - innerRadius) + randomFloat(seed, -0.05f, 0.05f);
+		float size = randomFloat(seed, 0.004f, 0.015f);
+		float inclination = randomFloat(seed, -6, 6);
+		float grey = randomFloat(seed, 0.35f, 0.6f);
+		float brown = randomFloat(seed, 0, 0.15f);
+		int index = store.add(rate, size, orbit, inclination, parent, grey + brown, grey, grey - brown, 1);
+		store.angle[index] = store.previousAngle[index] = store.renderAngle[index] = randomFloat(seed, 0, 360);
+	}
+}
+
+void AsteroidBelt::attach(const BodyStore &store, int beltParent, int beltFirst, int n) {
+	parent = beltParent;
+	first = beltFirst;
+	count = n;
+	ux.resize(n); uy.resize(n); uz.resize(n);
+	wx.resize(n); wy.resize(n); wz.resize(n);
+	instances.resize(n);
+	colors.resize(4 * n);
+	sectorOf.resize(n);
+	px.resize(n); py.resize(n); pz.resize(n);
+
+	largest = 0;
+	for (int i = 0; i < n; i++) {
+		int index = first + i;
+		largest = std::max(largest, store.radius[index]);
+
+		// same transform as a planet: rotate(inclination,1,1,1) then
+		// rotate(angle,0,1,0) then translate(orbit,0,0)
+		float tilt[16];
+		mat4Rotation(store.inclination[index], 1, 1, 1, tilt);
+		ux[i] = tilt[0]; uy[i] = tilt[1]; uz[i] = tilt[2];
+		wx[i] = -tilt[8]; wy[i] = -tilt[9]; wz[i] = -tilt[10];
+
+		colors[4*i + 0] = (unsigned char)(255 * store.colorR[index]);
+		colors[4*i + 1] = (unsigned char)(255 * store.colorG[index]);
+		colors[4*i + 2] = (unsigned char)(255 * store.colorB[index]);
+		colors[4*i + 3] = 255;
+	}
+}
+
+void AsteroidBelt::update(const BodyStore &store, JobSystem *jobs) {
+	if (count == 0)
+		return;
+	const float *angle = &store.renderAngle[first];
+	const float *orbit = &store.orbitRadius[first];
+
+	parallelFor(jobs, "AsteroidBelt::update", count, ROCK_GRAIN, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			sectorOf[i] = sectorOfAngle(angle[i]);
+			float a = angle[i] * (PI / 180);
+			float c = orbit[i] * cosf(a), sn = orbit[i] * sinf(a);
+			px[i] = c * ux[i] + sn * wx[i];
+			py[i] = c * uy[i] + sn * wy[i];
+			pz[i] = c * uz[i] + sn * wz[i];
+		}
+	});
+	sortIntoSectors(store);
+}
+
+void AsteroidBelt::update(const BodyStore &store, const float *x, const float *y, const float *z, const float origin[3],
+	JobSystem *jobs) {
+	if (count == 0)
+		return;
+	parallelFor(jobs, "AsteroidBelt::update", count, ROCK_GRAIN, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			px[i] = x[i] - origin[0];
+			py[i] = y[i] - origin[1];
+			pz[i] = z[i] - origin[2];
+			// same angle as a rotation about y would have put it at
+			sectorOf[i] = sectorOfAngle(atan2f(-pz[i], px[i]) * (180 / PI));
+		}
+	});
+	sortIntoSectors(store);
+}
+
+// Counting sort of the positions in px/py/pz by sectorOf into instances, then
+// a bounding sphere for each sector
+void AsteroidBelt::sortIntoSectors(const BodyStore &store) {
+	const float *size = &store.radius[first];
+
+	// count the asteroids in each sector, then turn the counts into where
+	// each sector starts
+	int cursor[BELT_SECTORS];
+	for (int s = 0; s < BELT_SECTORS; s++)
+		cursor[s] = 0;
+	for (int i = 0; i < count; i++)
+		cursor[sectorOf[i]]++;
+	int start = 0;
+	for (int s = 0; s < BELT_SECTORS; s++) {
+		sectorStart[s] = start;
+		start += cursor[s];
+		cursor[s] = sectorStart[s];
+	}
+	sectorStart[BELT_SECTORS] = start;
+
+	float low[BELT_SECTORS][3], high[BELT_SECTORS][3];
+	for (int s = 0; s < BELT_SECTORS; s++)
+		for (int k = 0; k < 3; k++)
+			low[s][k] = 1e30f, high[s][k] = -1e30f;
+
+	for (int i = 0; i < count; i++) {
+		int s = sectorOf[i];
+		BeltInstance &out = instances[cursor[s]++];
+		out.x = px[i];
+		out.y = py[i];
+		out.z = pz[i];
+		out.scale = size[i];
+		for (int k = 0; k < 4; k++)
+			out.color[k] = colors[4*i + k];
+
+		low[s][0] = std::min(low[s][0], out.x); high[s][0] = std::max(high[s][0], out.x);
+		low[s][1] = std::min(low[s][1], out.y); high[s][1] = std::max(high[s][1], out.y);
+		low[s][2] = std::min(low[s][2], out.z); high[s][2] = std::max(high[s][2], out.z);
+	}
+
+	// a sphere around each sector's box, grown by the biggest rock
+	for (int s = 0; s < BELT_SECTORS; s++) {
+		if (sectorStart[s] == sectorStart[s+1]) {
+			sectorCenter[s][0] = sectorCenter[s][1] = sectorCenter[s][2] = 0;
+			sectorRadius[s] = 0;
+			continue;
+		}
+		float squared = 0;
+		for (int k = 0; k < 3; k++) {
+			sectorCenter[s][k] = 0.5f * (low[s][k] + high[s][k]);
+			float half = 0.5f * (high[s][k] - low[s][k]);
+			squared += half * half;
+		}
+		sectorRadius[s] = sqrtf(squared) + largest;
+	}
+	// numbered across every belt, so a renderer handed a copy of the one it
+	// drew last time still uploads it
+	static int lastVersion = 0;
+	version = ++lastVersion;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Rendering side ///////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+BeltRenderer::BeltRenderer()
+	: program(0), instanceBuffer(0), vao(0), modelviewLocation(-1), normalMatrixLocation(-1), uploadedVersion(-1) {
+}
+
+// Compiles one shader stage from its parts, printing the log if it fails
+static GLuint compileShader(GLenum type, const char *const *parts, int count) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, count, parts, NULL);
+	glCompileShader(shader);
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "belt shader failed to compile: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+bool BeltRenderer::init(bool coreProfile) {
+	// glDrawArraysInstanced is GL 3.1 and glVertexAttribDivisor is GL 3.3
+	int major = 0, minor = 0;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	if (!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33) {
+		fprintf(stderr, "asteroid belt needs OpenGL 3.3, have %s\n", version ? version : "none");
+		return false;
+	}
+
+	const char *coreVertexParts[] = {"#version 330\n", frameBlockSource, coreVertexSource};
+	GLuint vertex = coreProfile ? compileShader(GL_VERTEX_SHADER, coreVertexParts, 3)
+		: compileShader(GL_VERTEX_SHADER, &vertexSource, 1);
+	GLuint fragment = compileShader(GL_FRAGMENT_SHADER, coreProfile ? &coreFragmentSource : &fragmentSource, 1);
+	if (!vertex || !fragment)
+		return false;
+	program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	if (coreProfile) {
+		glBindAttribLocation(program, POSITION_ATTRIBUTE, "position");
+		glBindAttribLocation(program, NORMAL_ATTRIBUTE, "normal");
+	}
+	glBindAttribLocation(program, INSTANCE_ATTRIBUTE, "instance");
+	glBindAttribLocation(program, COLOR_ATTRIBUTE, "instanceColor");
+	glLinkProgram(program);
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+	GLint ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "belt shader failed to link: %s\n", log);
+		release();
+		return false;
+	}
+
+	// the asteroids change sector as they move, so the colors are uploaded
+	// with the positions every frame
+	glGenBuffers(1, &instanceBuffer);
+	uploadedVersion = -1;
+
+	if (coreProfile) {
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Frame"), FRAME_BINDING);
+		modelviewLocation = glGetUniformLocation(program, "modelview");
+		normalMatrixLocation = glGetUniformLocation(program, "normalMatrix");
+		// the instance attributes move with each run of sectors, so only
+		// which attributes are on lives in the vertex array object
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 1);
+		glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+		glVertexAttribDivisor(COLOR_ATTRIBUTE, 1);
+		glBindVertexArray(0);
+	}
+	return true;
+}
+
+int BeltRenderer::draw(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible, const float *modelview) {
+	if (!program || belt.getCount() == 0)
+		return 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	if (uploadedVersion != belt.getVersion()) {
+		// orphan the old storage so the upload doesn't wait on the last draw
+		GLsizeiptr bytes = belt.instances.size() * sizeof(BeltInstance);
+		glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &belt.instances[0]);
+		uploadedVersion = belt.getVersion();
+	}
+	if (vao)
+		return drawCore(belt, mesh, visible, modelview);
+	glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+	glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 1);
+	glEnableVertexAttribArray(COLOR_ATTRIBUTE);
+	glVertexAttribDivisor(COLOR_ATTRIBUTE, 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), (const GLvoid *)0);
+	glNormalPointer(GL_FLOAT, 6 * sizeof(float), (const GLvoid *)(3 * sizeof(float)));
+
+	glUseProgram(program);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	int calls = drawSectors(belt, mesh, visible);
+	glUseProgram(0);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glVertexAttribDivisor(COLOR_ATTRIBUTE, 0);
+	glVertexAttribDivisor(INSTANCE_ATTRIBUTE, 0);
+	glDisableVertexAttribArray(COLOR_ATTRIBUTE);
+	glDisableVertexAttribArray(INSTANCE_ATTRIBUTE);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return calls;
+}
+
+int BeltRenderer::drawCore(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible, const float *modelview) {
+	glUseProgram(program);
+	float normal[9];
+	mat4NormalMatrix(modelview, normal);
+	glUniformMatrix4fv(modelviewLocation, 1, GL_FALSE, modelview);
+	glUniformMatrix3fv(normalMatrixLocation, 1, GL_FALSE, normal);
+
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)0);
+	glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)(3 * sizeof(float)));
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	int calls = drawSectors(belt, mesh, visible);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return calls;
+}
+
+// One instanced draw per run of neighbouring visible sectors, with the
+// instance buffer bound. Returns how many draws that was.
+int BeltRenderer::drawSectors(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible) {
+	int s = 0, calls = 0;
+	while (s < BELT_SECTORS) {
+		if (visible && !visible[s]) {
+			s++;
+			continue;
+		}
+		// draw the whole run of visible sectors starting here at once
+		int end = s + 1;
+		while (end < BELT_SECTORS && (!visible || visible[end]))
+			end++;
+		int firstInstance = belt.sectorStart[s], instances = belt.sectorStart[end] - firstInstance;
+		if (instances > 0) {
+			// GL 3.3 has no base instance, so the attributes start at the run instead
+			size_t offset = firstInstance * sizeof(BeltInstance);
+			glVertexAttribPointer(INSTANCE_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(BeltInstance),
+				(const GLvoid *)offset);
+			glVertexAttribPointer(COLOR_ATTRIBUTE, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BeltInstance),
+				(const GLvoid *)(offset + 4 * sizeof(float)));
+			glDrawArraysInstanced(mesh.mode, 0, mesh.count, instances);
+			calls++;
+		}
+		s = end;
+	}
+	return calls;
+}
+
+void BeltRenderer::release() {
+	if (program)
+		glDeleteProgram(program);
+	if (instanceBuffer)
+		glDeleteBuffers(1, &instanceBuffer);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	program = instanceBuffer = vao = 0;
+	uploadedVersion = -1;
+}
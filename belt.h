@@ -0,0 +1,118 @@
+#ifndef BELT_H
+#define BELT_H
+
+#include "glplatform.h"
+#include "bodystore.h"
+#include "meshcache.h"
+
+#include<vector>
+
+class JobSystem;
+
+// The belt is cut into this many wedges around its parent, so the parts that
+// are out of view can be skipped
+static const int BELT_SECTORS = 32;
+
+// One asteroid as the renderer sees it: position and scale in the parent's
+// space, then its color
+struct BeltInstance {
+	float x, y, z, scale;
+	unsigned char color[4];
+};
+
+// Asteroid belt made of many small bodies. The bodies themselves live in the
+// body store like everything else and are moved by its update, whether they
+// came from the scene or were added at random; the belt remembers which range
+// they are and turns their angles into the per-instance data the renderer
+// draws from.
+class AsteroidBelt {
+public:
+	AsteroidBelt();
+
+	// Adds count random asteroids orbiting parent, between innerRadius and
+	// outerRadius, to the store. seed makes the belt the same every run.
+	static void addRocks(BodyStore &store, int parent, int count, float innerRadius, float outerRadius, unsigned int seed);
+
+	// Makes the count bodies from first on in the store the belt. They all
+	// have to orbit parent.
+	void attach(const BodyStore &store, int parent, int first, int count);
+
+	// Work out every asteroid's position from its render angle, grouped by
+	// sector, along with each sector's bounds. Call after the store has been
+	// interpolated for the frame. With jobs, the positions are worked out on
+	// its threads.
+	void update(const BodyStore &store, JobSystem *jobs = NULL);
+
+	// The same, but with the asteroids at the given positions instead of on
+	// their orbits: x, y and z are indexed from the belt's first body, and
+	// origin is the parent's position, in the same space.
+	void update(const BodyStore &store, const float *x, const float *y, const float *z, const float origin[3],
+		JobSystem *jobs = NULL);
+
+	int getParent() const { return parent; }
+	int getFirst() const { return first; }
+	int getCount() const { return count; }
+	// new with every update of any belt, so renderers know when to upload
+	// again. Belts are updated by one thread at a time.
+	int getVersion() const { return version; }
+
+	// Per-instance data, sorted by sector: sector s is instances
+	// sectorStart[s] up to sectorStart[s+1]
+	std::vector<BeltInstance> instances;
+	int sectorStart[BELT_SECTORS + 1];
+	// bounding sphere of each sector, in the parent's space
+	float sectorCenter[BELT_SECTORS][3];
+	float sectorRadius[BELT_SECTORS];
+
+private:
+	void sortIntoSectors(const BodyStore &store);
+
+	int parent, first, count, version;
+	float largest;
+	std::vector<unsigned char> colors;   // in store order
+	std::vector<int> sectorOf;
+	// each asteroid's orbit is cos(angle) * u + sin(angle) * w, times its
+	// orbit radius; the two axes come from its inclination
+	std::vector<float> ux, uy, uz, wx, wy, wz;
+	// positions for this update, in store order
+	std::vector<float> px, py, pz;
+};
+
+// Draws an asteroid belt with instancing, in ONE OpenGL context. A single low
+// poly mesh is drawn once per asteroid, with the position, scale and color
+// coming from per-instance vertex attributes. Each run of neighbouring visible
+// sectors is one draw call.
+class BeltRenderer {
+public:
+	BeltRenderer();
+
+	// Compile the shader and create the instance buffers. Returns false if the
+	// context can't do instancing. With coreProfile the shader is the GLSL 3.30
+	// one, lit from a CoreRenderer's frame block. Must be called with the
+	// owning context current.
+	bool init(bool coreProfile = false);
+
+	// Draw the asteroids with the current modelview matrix, which should be
+	// the belt parent's space; in the core profile there is none, so the
+	// matrix is passed as modelview. Only sectors with visible[sector] set are
+	// drawn, or all of them if visible is NULL. Uploads the instance data
+	// first if the belt has been updated since the last draw. The core
+	// profile leaves the belt's program in use. Returns the number of draw
+	// calls made.
+	int draw(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible = NULL, const float *modelview = NULL);
+
+	// delete the program and buffers
+	void release();
+
+private:
+	int drawSectors(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible);
+	int drawCore(const AsteroidBelt &belt, const Mesh &mesh, const bool *visible, const float *modelview);
+
+	GLuint program;
+	GLuint instanceBuffer;
+	GLuint vao;   // core profile only
+	GLint modelviewLocation, normalMatrixLocation;
+	int uploadedVersion;
+};
+
+#endif
@@ -0,0 +1,833 @@
+#include "benchmark.h"
+#include "matrix.h"
+#include "bodystore.h"
+#include "nbody.h"
+#include "ephemeris.h"
+#include "scenefile.h"
+#include "jobsystem.h"
+
+#include<algorithm>
+#include<chrono>
+#include<errno.h>
+#include<math.h>
+#include<stdarg.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#if defined(_WIN32)
+#include<direct.h>
+#else
+#include<unistd.h>
+#endif
+
+const char *phaseNames[PHASE_COUNT] = {
+	"simulation",
+	"projection",
+	"camera",
+	"draw_ship",
+	"draw_solar_system",
+	"flush",
+	"swap",
+	"other"
+};
+
+const char *counterNames[COUNTER_COUNT] = {
+	"objects_drawn",
+	"objects_culled",
+	"draw_commands",
+	"draw_calls",
+	"state_changes"
+};
+
+double currentTimeMs() {
+	using namespace std::chrono;
+	return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+FrameTimings::FrameTimings() : last(0) {
+	for (int i = 0; i < PHASE_COUNT; i++)
+		current[i] = 0;
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		counts[i] = 0;
+}
+
+int FrameTimings::addGroup(const std::string &name) {
+	groups.push_back(name);
+	samples.push_back(std::vector<std::vector<double> >(PHASE_COUNT + 1 + COUNTER_COUNT));
+	return (int)groups.size() - 1;
+}
+
+void FrameTimings::beginFrame() {
+	for (int i = 0; i < PHASE_COUNT; i++)
+		current[i] = 0;
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		counts[i] = 0;
+	last = currentTimeMs();
+}
+
+void FrameTimings::mark(FramePhase phase) {
+	double now = currentTimeMs();
+	current[phase] += now - last;
+	last = now;
+}
+
+void FrameTimings::count(FrameCounter counter, int amount) {
+	counts[counter] += amount;
+}
+
+void FrameTimings::endFrame(int group) {
+	mark(PHASE_OTHER);
+	double total = 0;
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		samples[group][i].push_back(current[i]);
+		total += current[i];
+	}
+	samples[group][PHASE_COUNT].push_back(total);
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		samples[group][PHASE_COUNT + 1 + i].push_back(counts[i]);
+}
+
+FrameTimings::Stats FrameTimings::summarize(std::vector<double> values) {
+	Stats stats = {0, 0, 0, 0};
+	if (values.empty())
+		return stats;
+	std::sort(values.begin(), values.end());
+	size_t n = values.size();
+	stats.min = values[0];
+	stats.median = n % 2 ? values[n/2] : 0.5 * (values[n/2 - 1] + values[n/2]);
+	// nearest-rank 99th percentile
+	size_t rank = (size_t)(0.99 * n + 0.999999);
+	stats.p99 = values[rank > 0 ? rank - 1 : 0];
+	double sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += values[i];
+	stats.mean = sum / n;
+	return stats;
+}
+
+std::vector<std::vector<double> > FrameTimings::allSamples() const {
+	std::vector<std::vector<double> > all(PHASE_COUNT + 1 + COUNTER_COUNT);
+	for (size_t g = 0; g < groups.size(); g++)
+		for (int p = 0; p < PHASE_COUNT + 1 + COUNTER_COUNT; p++)
+			all[p].insert(all[p].end(), samples[g][p].begin(), samples[g][p].end());
+	return all;
+}
+
+void FrameTimings::printGroup(FILE *out, const std::string &name, const std::vector<std::vector<double> > &group) const {
+	fprintf(out, "%s (%d frames)\n", name.c_str(), (int)group[PHASE_COUNT].size());
+	fprintf(out, "  %-18s %9s %9s %9s %9s\n", "phase (ms)", "min", "median", "p99", "mean");
+	for (int p = 0; p <= PHASE_COUNT; p++) {
+		Stats s = summarize(group[p]);
+		fprintf(out, "  %-18s %9.3f %9.3f %9.3f %9.3f\n", p < PHASE_COUNT ? phaseNames[p] : "total",
+			s.min, s.median, s.p99, s.mean);
+	}
+	fprintf(out, "  %-18s %9s %9s %9s %9s\n", "per frame", "min", "median", "p99", "mean");
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		Stats s = summarize(group[PHASE_COUNT + 1 + c]);
+		fprintf(out, "  %-18s %9.0f %9.1f %9.0f %9.1f\n", counterNames[c], s.min, s.median, s.p99, s.mean);
+	}
+}
+
+void FrameTimings::print(FILE *out) const {
+	for (size_t g = 0; g < groups.size(); g++)
+		printGroup(out, groups[g], samples[g]);
+	printGroup(out, "all", allSamples());
+}
+
+void FrameTimings::writeGroup(FILE *out, const std::string &name, const std::vector<std::vector<double> > &group, bool last) const {
+	fprintf(out, "    \"%s\": {\n", name.c_str());
+	fprintf(out, "      \"frames\": %d,\n", (int)group[PHASE_COUNT].size());
+	for (int p = 0; p <= PHASE_COUNT; p++) {
+		Stats s = summarize(group[p]);
+		fprintf(out, "      \"%s\": {\"min\": %.4f, \"median\": %.4f, \"p99\": %.4f, \"mean\": %.4f},\n",
+			p < PHASE_COUNT ? phaseNames[p] : "total", s.min, s.median, s.p99, s.mean);
+	}
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		Stats s = summarize(group[PHASE_COUNT + 1 + c]);
+		fprintf(out, "      \"%s\": {\"min\": %.0f, \"median\": %.1f, \"p99\": %.0f, \"mean\": %.2f}%s\n",
+			counterNames[c], s.min, s.median, s.p99, s.mean, c + 1 < COUNTER_COUNT ? "," : "");
+	}
+	fprintf(out, "    }%s\n", last ? "" : ",");
+}
+
+void FrameTimings::writeJson(FILE *out, const std::string &extra) const {
+	fprintf(out, "{\n");
+	if (!extra.empty())
+		fprintf(out, "  %s,\n", extra.c_str());
+	fprintf(out, "  \"groups\": {\n");
+	for (size_t g = 0; g < groups.size(); g++)
+		writeGroup(out, groups[g], samples[g], false);
+	writeGroup(out, "all", allSamples(), true);
+	fprintf(out, "  }\n}\n");
+}
+
+std::string jsonString(const char *text) {
+	std::string out = "\"";
+	for (const char *c = text; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			out += '\\';
+			out += *c;
+		}
+		else if ((unsigned char)*c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*c);
+			out += escape;
+		}
+		else
+			out += *c;
+	}
+	return out + "\"";
+}
+
+static FrameTimings *activeTimings = NULL;
+
+void setPhaseTimings(FrameTimings *timings) {
+	activeTimings = timings;
+}
+
+void markPhase(FramePhase phase) {
+	if (activeTimings)
+		activeTimings->mark(phase);
+}
+
+void countFrame(FrameCounter counter, int amount) {
+	if (activeTimings)
+		activeTimings->count(counter, amount);
+}
+
+//////////////////////////////////////////////////////////////////
+/// Scripted session /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+static const char *modeNames[] = { "lookat", "relative", "geosync" };
+
+int benchmarkModeCount() {
+	return 3;
+}
+
+const char *benchmarkModeName(int mode) {
+	return modeNames[mode];
+}
+
+int benchmarkMode(int frame, int frames) {
+	int mode = frame * 3 / std::max(frames, 1);
+	return std::min(mode, 2);
+}
+
+// Returns the index of the first frame of the given mode
+static int modeStart(int mode, int frames) {
+	int start = 0;
+	while (start < frames && benchmarkMode(start, frames) < mode)
+		start++;
+	return start;
+}
+
+std::string benchmarkKeys(int frame, int frames) {
+	int mode = benchmarkMode(frame, frames);
+	int start = modeStart(mode, frames);
+	int length = modeStart(mode + 1, frames) - start;
+	int k = frame - start;
+	std::string keys;
+
+	switch (mode) {
+	case 0:
+		// nudge the eye and look-at points around, from the mothership then the scout ship
+		if (k == 0)
+			keys += 'l';
+		if (k == length / 2)
+			keys += '<';
+		if (k % 4 == 1)
+			keys += "xyzabcXYZ"[(k / 4) % 9];
+		break;
+	case 1:
+		// fly forwards while turning, swapping ships half way
+		if (k == 0)
+			keys += "r>";
+		if (k == length / 2)
+			keys += '<';
+		if (k % 2 == 1)
+			keys += 'w';
+		else if (k > 0)
+			keys += "qaxecd"[(k / 2) % 6];
+		break;
+	case 2:
+		// orbit each planet in turn, moving in and out, with both ships
+		if (k == 0)
+			keys += "g>";
+		if (k == length / 2)
+			keys += '<';
+		if (k % 30 == 15)
+			keys += (char)('1' + (k / 30) % 9);
+		if (k % 30 < 15)
+			keys += (k % 2) ? 'w' : 's';
+		break;
+	}
+	return keys;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Shared by the benchmarks /////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Small deterministic generator, so every run checks the same data
+static const unsigned int BENCH_SEED = 12345;
+static unsigned int benchSeed = BENCH_SEED;
+static float randomFloat(float lo, float hi) {
+	benchSeed = benchSeed * 1664525u + 1013904223u;
+	return lo + (hi - lo) * ((benchSeed >> 8) / 16777216.0f);
+}
+
+// Each benchmark starts the generator over, so it gets the same data
+// whichever ran before it
+static void seedRandom() {
+	benchSeed = BENCH_SEED;
+}
+
+// Prints whether a benchmark's check passed, followed by what it was checked
+// against, and returns the process exit code for it
+static int reportCheck(bool passed, const char *format, ...) {
+	char detail[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(detail, sizeof(detail), format, args);
+	va_end(args);
+	printf("%s (%s)\n", passed ? "passed" : "FAILED", detail);
+	return passed ? 0 : 1;
+}
+
+// The results of a benchmark as the fields of a JSON object, in the order
+// they were added. Values added with addJson are already JSON, for nesting.
+class BenchJson {
+public:
+	void add(const char *name, int value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%d", value);
+		addJson(name, text);
+	}
+	void add(const char *name, double value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%.6g", value);
+		addJson(name, text);
+	}
+	void add(const char *name, bool value) {
+		addJson(name, value ? "true" : "false");
+	}
+	void addJson(const char *name, const std::string &value) {
+		fields.push_back(jsonString(name) + ": " + value);
+	}
+
+	// The object, its fields one to a line indented by depth levels
+	std::string text(int depth = 0) const {
+		std::string indent(2 * depth, ' '), out = "{\n";
+		for (size_t i = 0; i < fields.size(); i++)
+			out += indent + "  " + fields[i] + (i + 1 < fields.size() ? ",\n" : "\n");
+		return out + indent + "}";
+	}
+
+	// Writes the object to path, if there is one
+	void write(const char *path) const {
+		if (!path)
+			return;
+		FILE *file = fopen(path, "w");
+		bool ok = file && fprintf(file, "%s\n", text().c_str()) >= 0;
+		if (file && fclose(file) != 0)
+			ok = false;
+		if (!ok)
+			fprintf(stderr, "benchmark: could not write %s\n", path);
+	}
+
+private:
+	std::vector<std::string> fields;
+};
+
+//////////////////////////////////////////////////////////////////
+/// Matrix kernels ///////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// random rotation about a random axis plus a random translation
+static void randomPose(float *m) {
+	mat4Rotation(randomFloat(-180, 180), randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1), m);
+	m[12] = randomFloat(-20, 20);
+	m[13] = randomFloat(-20, 20);
+	m[14] = randomFloat(-20, 20);
+}
+
+static float maxDifference(const std::vector<float> &a, const std::vector<float> &b) {
+	float worst = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		worst = std::max(worst, fabsf(a[i] - b[i]));
+	return worst;
+}
+
+struct KernelResult {
+	std::string name;
+	double nsPerMatrix;   // 0 if the kernel was only checked, not timed
+	float maxError;
+};
+
+int runMatrixBenchmark(const char *jsonPath) {
+	const int COUNT = 4096;
+	const int REPEATS = 200;
+	const float TOLERANCE = 1e-4f;
+
+	std::vector<float> poses(16 * COUNT), others(16 * COUNT);
+	seedRandom();
+	for (int i = 0; i < COUNT; i++) {
+		randomPose(&poses[16*i]);
+		randomPose(&others[16*i]);
+	}
+
+	// reference results from the original routines
+	std::vector<float> inverse(16 * COUNT), product(16 * COUNT);
+	for (int i = 0; i < COUNT; i++) {
+		mat4Invert(&poses[16*i], &inverse[16*i]);
+		mat4Multiply(&poses[16*i], &others[16*i], &product[16*i]);
+	}
+
+	std::vector<KernelResult> results;
+	std::vector<float> out(16 * COUNT);
+	// keeps the optimizer from throwing the timed loops away
+	volatile float sink = 0;
+
+	double start = currentTimeMs();
+	for (int r = 0; r < REPEATS; r++) {
+		for (int i = 0; i < COUNT; i++)
+			mat4Invert(&poses[16*i], &out[16*i]);
+		sink = sink + out[r];
+	}
+	KernelResult general = { "invert_general", (currentTimeMs() - start) * 1e6 / (REPEATS * COUNT), 0 };
+	results.push_back(general);
+
+	start = currentTimeMs();
+	for (int r = 0; r < REPEATS; r++) {
+		for (int i = 0; i < COUNT; i++)
+			mat4InvertRigid(&poses[16*i], &out[16*i]);
+		sink = sink + out[r];
+	}
+	KernelResult rigid = { "invert_rigid", (currentTimeMs() - start) * 1e6 / (REPEATS * COUNT), maxDifference(out, inverse) };
+	results.push_back(rigid);
+
+	static const Mat4Kernel kernels[] = { MAT4_SCALAR, MAT4_SSE, MAT4_AVX };
+	for (int k = 0; k < 3; k++) {
+		if (!mat4KernelSupported(kernels[k]))
+			continue;
+		std::string name = mat4KernelName(kernels[k]);
+
+		start = currentTimeMs();
+		for (int r = 0; r < REPEATS; r++) {
+			mat4InvertRigidBatch(&poses[0], &out[0], COUNT, kernels[k]);
+			sink = sink + out[r];
+		}
+		KernelResult inv = { "invert_rigid_batch_" + name, (currentTimeMs() - start) * 1e6 / (REPEATS * COUNT), maxDifference(out, inverse) };
+		results.push_back(inv);
+
+		start = currentTimeMs();
+		for (int r = 0; r < REPEATS; r++) {
+			mat4MultiplyBatch(&poses[0], &others[0], &out[0], COUNT, kernels[k]);
+			sink = sink + out[r];
+		}
+		KernelResult mul = { "multiply_batch_" + name, (currentTimeMs() - start) * 1e6 / (REPEATS * COUNT), maxDifference(out, product) };
+		results.push_back(mul);
+	}
+
+	// invert_pose inverts one matrix over itself, and the batch is allowed to
+	// alias too, so check both forms in place
+	out = poses;
+	for (int i = 0; i < COUNT; i++)
+		mat4InvertRigid(&out[16*i], &out[16*i]);
+	KernelResult inPlace = { "invert_rigid_in_place", 0, maxDifference(out, inverse) };
+	results.push_back(inPlace);
+
+	out = poses;
+	mat4InvertRigidBatch(&out[0], &out[0], COUNT);
+	KernelResult batchInPlace = { "invert_rigid_batch_in_place", 0, maxDifference(out, inverse) };
+	results.push_back(batchInPlace);
+
+	bool passed = true;
+	BenchJson kernelJson;
+	printf("%-30s %12s %12s\n", "kernel", "ns/matrix", "max error");
+	for (size_t i = 0; i < results.size(); i++) {
+		bool ok = results[i].maxError <= TOLERANCE;
+		passed = passed && ok;
+		if (results[i].nsPerMatrix > 0)
+			printf("%-30s %12.2f %12.3g %s\n", results[i].name.c_str(), results[i].nsPerMatrix,
+				results[i].maxError, ok ? "" : "FAILED");
+		else
+			printf("%-30s %12s %12.3g %s\n", results[i].name.c_str(), "-", results[i].maxError, ok ? "" : "FAILED");
+
+		BenchJson kernel;
+		kernel.add("ns_per_matrix", results[i].nsPerMatrix);
+		kernel.add("max_error", results[i].maxError);
+		kernelJson.addJson(results[i].name.c_str(), kernel.text(2));
+	}
+
+	BenchJson json;
+	json.add("matrices", COUNT);
+	json.add("passed", passed);
+	json.addJson("kernels", kernelJson.text(1));
+	json.write(jsonPath);
+	return reportCheck(passed, "tolerance %g against the general inverse and scalar multiply", TOLERANCE);
+}
+
+//////////////////////////////////////////////////////////////////
+/// Body store ///////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+int runBodyBenchmark(int count, const char *jsonPath) {
+	const int STEPS = 1000;
+	const float TOLERANCE = 1e-3f;
+
+	BodyStore store;
+	store.reserve(count);
+	seedRandom();
+	for (int i = 0; i < count; i++)
+		store.add(randomFloat(0.1f, 2), randomFloat(0.01f, 0.05f), randomFloat(10, 12), randomFloat(-5, 5), 0,
+			0.5f, 0.5f, 0.5f, 1);
+
+	// the same steps done one body at a time, the way rotateInSpace did it
+	std::vector<float> expected(count, 0), previous(count, 0);
+	volatile float sink = 0;
+	double stepMs = 0, interpolateMs = 0, worstStepMs = 0;
+	float maxError = 0;
+
+	for (int s = 0; s < STEPS; s++) {
+		double start = currentTimeMs();
+		store.step();
+		double stepped = currentTimeMs();
+		store.interpolate(0.5f);
+		double done = currentTimeMs();
+		stepMs += stepped - start;
+		interpolateMs += done - stepped;
+		worstStepMs = std::max(worstStepMs, done - start);
+		sink = sink + store.renderAngle[s % count];
+
+		for (int i = 0; i < count; i++) {
+			previous[i] = expected[i];
+			if (expected[i] >= 360)
+				expected[i] -= 360;
+			expected[i] += store.rate[i];
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		float delta = expected[i] - previous[i];
+		if (delta < -180)
+			delta += 360;
+		else if (delta > 180)
+			delta -= 360;
+		maxError = std::max(maxError, fabsf(store.angle[i] - expected[i]));
+		maxError = std::max(maxError, fabsf(store.renderAngle[i] - (previous[i] + delta * 0.5f)));
+	}
+	bool passed = maxError <= TOLERANCE;
+
+	printf("%d bodies, %d steps\n", count, STEPS);
+	printf("step          %8.4f ms mean\n", stepMs / STEPS);
+	printf("interpolate   %8.4f ms mean\n", interpolateMs / STEPS);
+	printf("both          %8.4f ms mean, %.4f ms worst\n", (stepMs + interpolateMs) / STEPS, worstStepMs);
+
+	BenchJson json;
+	json.add("bodies", count);
+	json.add("steps", STEPS);
+	json.add("passed", passed);
+	json.add("step_ms", stepMs / STEPS);
+	json.add("interpolate_ms", interpolateMs / STEPS);
+	json.add("worst_ms", worstStepMs);
+	json.add("max_error", maxError);
+	json.write(jsonPath);
+	return reportCheck(passed, "max error %g against the scalar rule", maxError);
+}
+
+//////////////////////////////////////////////////////////////////
+/// N-body integrator ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Random direction scaled to length
+static void randomVector(float length, float *out) {
+	float cosTheta = randomFloat(-1, 1);
+	float sinTheta = sqrtf(std::max(0.0f, 1 - cosTheta * cosTheta));
+	float phi = randomFloat(0, 2 * 3.14159265f);
+	out[0] = length * sinTheta * cosf(phi);
+	out[1] = length * sinTheta * sinf(phi);
+	out[2] = length * cosTheta;
+}
+
+// Plummer sphere with total mass 1 and scale radius 1, in equilibrium, drawn
+// the way Aarseth, Henon and Wielen do it
+static void makePlummer(NBodySystem &system, int count) {
+	system.reserve(count);
+	float m = 1.0f / count;
+	for (int i = 0; i < count; i++) {
+		float u = randomFloat(1e-4f, 0.999f);
+		float r = 1 / sqrtf(powf(u, -2.0f / 3) - 1);
+		// speed as a fraction of escape speed, by rejection from q^2 (1-q^2)^3.5
+		float q, g;
+		do {
+			q = randomFloat(0, 1);
+			g = randomFloat(0, 0.1f);
+		} while (g > q * q * powf(1 - q * q, 3.5f));
+		float speed = q * sqrtf(2.0f) * powf(1 + r * r, -0.25f);
+		float p[3], v[3];
+		randomVector(r, p);
+		randomVector(speed, v);
+		system.add(p[0], p[1], p[2], v[0], v[1], v[2], m);
+	}
+	system.removeNetMomentum();
+}
+
+int runNBodyBenchmark(int count, int steps, float theta, float dt, int threads, const char *jsonPath) {
+	const int SAMPLES = 64;
+
+	NBodySystem system;
+	seedRandom();
+	makePlummer(system, count);
+	system.setTheta(theta);
+	system.setSoftening(0.01f);
+	JobSystem jobs;
+	jobs.start(threads);
+
+	double startMs = currentTimeMs();
+	system.start(&jobs);
+	double startupMs = currentTimeMs() - startMs;
+	double initial = system.energy();
+
+	// tree accelerations against the exact sum, for a spread of particles
+	std::vector<float> errors;
+	for (int s = 0; s < SAMPLES && s < count; s++) {
+		int i = (int)((long long)s * count / std::min(SAMPLES, count));
+		float exact[3];
+		system.directAcceleration(i, exact);
+		float dx = system.ax[i] - exact[0], dy = system.ay[i] - exact[1], dz = system.az[i] - exact[2];
+		float size = sqrtf(exact[0]*exact[0] + exact[1]*exact[1] + exact[2]*exact[2]);
+		errors.push_back(sqrtf(dx*dx + dy*dy + dz*dz) / std::max(size, 1e-20f));
+	}
+	std::sort(errors.begin(), errors.end());
+	float medianError = errors.empty() ? 0 : errors[errors.size() / 2];
+	float worstError = errors.empty() ? 0 : errors.back();
+
+	double buildMs = 0, forceMs = 0, integrateMs = 0, worstDrift = 0;
+	int nodes = 0;
+	for (int s = 0; s < steps; s++) {
+		system.step(dt, &jobs);
+		const NBodyStats &stats = system.getStats();
+		buildMs += stats.buildMs;
+		forceMs += stats.forceMs;
+		integrateMs += stats.integrateMs;
+		nodes = stats.nodes;
+		worstDrift = std::max(worstDrift, fabs((system.energy() - initial) / initial));
+	}
+	double finalDrift = (system.energy() - initial) / initial;
+	double stepMs = steps > 0 ? (buildMs + forceMs + integrateMs) / steps : 0;
+	double particleSteps = stepMs > 0 ? count / (stepMs / 1000) : 0;
+	bool finite = system.energy() == system.energy() && fabs(system.energy()) < 1e30;
+
+	printf("%d particles, %d steps of %g, theta %g, %d threads, %d tree nodes\n",
+		count, steps, dt, theta, jobs.getThreads(), nodes);
+	printf("first forces  %9.3f ms\n", startupMs);
+	if (steps > 0) {
+		printf("tree build    %9.3f ms mean\n", buildMs / steps);
+		printf("forces        %9.3f ms mean\n", forceMs / steps);
+		printf("integrate     %9.3f ms mean\n", integrateMs / steps);
+		printf("step          %9.3f ms mean, %.3g particle steps/s\n", stepMs, particleSteps);
+	}
+	printf("energy drift  %9.3g at the end, %.3g worst\n", finalDrift, worstDrift);
+	printf("force error   %9.3g median, %.3g worst of %d particles\n", medianError, worstError, (int)errors.size());
+
+	BenchJson json;
+	json.add("particles", count);
+	json.add("steps", steps);
+	json.add("dt", dt);
+	json.add("theta", theta);
+	json.add("threads", jobs.getThreads());
+	json.add("passed", finite);
+	json.add("nodes", nodes);
+	json.add("build_ms", steps > 0 ? buildMs / steps : 0);
+	json.add("force_ms", steps > 0 ? forceMs / steps : 0);
+	json.add("integrate_ms", steps > 0 ? integrateMs / steps : 0);
+	json.add("step_ms", stepMs);
+	json.add("particle_steps_per_second", particleSteps);
+	json.add("energy_drift", finalDrift);
+	json.add("worst_energy_drift", worstDrift);
+	json.add("median_force_error", medianError);
+	json.add("worst_force_error", worstError);
+	json.write(jsonPath);
+	return reportCheck(finite, "energy %s finite", finite ? "stays" : "is no longer");
+}
+
+//////////////////////////////////////////////////////////////////
+/// Ephemeris ////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+int runKeplerBenchmark(int count, const char *jsonPath) {
+	// time in steps: from a few frames in to about a million years of
+	// earth's 360 step orbit
+	const double times[] = {1, 1000, 1e6, 1e9, 1e11};
+	const int TIMES = sizeof(times) / sizeof(times[0]);
+	const int REPEATS = 20;
+	const int CHECKED = 1000;
+	// position error allowed, as a fraction of the orbit's size
+	const float TOLERANCE = 1e-4f;
+
+	Ephemeris ephemeris;
+	ephemeris.reserve(count);
+	seedRandom();
+	for (int i = 0; i < count; i++) {
+		OrbitalElements e;
+		e.semiMajorAxis = randomFloat(0.5f, 50);
+		e.eccentricity = randomFloat(0, 0.9f);
+		e.inclination = randomFloat(0, 180);
+		e.ascendingNode = randomFloat(0, 360);
+		e.periapsis = randomFloat(0, 360);
+		e.meanAnomaly = randomFloat(0, 360);
+		e.meanMotion = randomFloat(0.01f, 5);
+		ephemeris.add(e);
+	}
+
+	double evaluateMs[TIMES];
+	int iterations[TIMES];
+	float maxError = 0;
+	for (int t = 0; t < TIMES; t++) {
+		double start = currentTimeMs();
+		for (int r = 0; r < REPEATS; r++)
+			ephemeris.evaluate(times[t] + r * 0.5);
+		evaluateMs[t] = (currentTimeMs() - start) / REPEATS;
+		iterations[t] = ephemeris.getIterations();
+
+		// the last evaluation was at times[t] + (REPEATS - 1) / 2
+		int stride = std::max(1, count / CHECKED);
+		for (int i = 0; i < count; i += stride) {
+			double exact[3];
+			ephemeris.positionAt(i, times[t] + (REPEATS - 1) * 0.5, exact);
+			double dx = ephemeris.x[i] - exact[0], dy = ephemeris.y[i] - exact[1], dz = ephemeris.z[i] - exact[2];
+			float error = (float)(sqrt(dx*dx + dy*dy + dz*dz) / ephemeris.getElements(i).semiMajorAxis);
+			maxError = std::max(maxError, error);
+		}
+	}
+	bool passed = maxError <= TOLERANCE;
+
+	printf("%d orbits, eccentricity up to 0.9\n", count);
+	printf("  time (steps)   evaluate (ms)   newton iterations\n");
+	for (int t = 0; t < TIMES; t++)
+		printf("  %12g   %13.4f   %17d\n", times[t], evaluateMs[t], iterations[t]);
+
+	std::string timeJson = "[\n";
+	for (int t = 0; t < TIMES; t++) {
+		BenchJson entry;
+		entry.add("time", times[t]);
+		entry.add("evaluate_ms", evaluateMs[t]);
+		entry.add("iterations", iterations[t]);
+		timeJson += "    " + entry.text(2) + (t + 1 < TIMES ? ",\n" : "\n");
+	}
+
+	BenchJson json;
+	json.add("orbits", count);
+	json.add("passed", passed);
+	json.add("max_error", maxError);
+	json.addJson("times", timeJson + "  ]");
+	json.write(jsonPath);
+	return reportCheck(passed, "max error %g of the semi-major axis against double precision", maxError);
+}
+
+//////////////////////////////////////////////////////////////////
+/// Scene files //////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Makes a new, empty directory of its own under the system's temporary one,
+// so the scene benchmark neither overwrites nor leaves files anywhere else
+static bool makeScratchDirectory(std::string &path) {
+#if defined(_WIN32)
+	char *name = _tempnam(NULL, "ssbench");
+	bool made = name && _mkdir(name) == 0;
+	if (name)
+		path = name;
+	free(name);
+#else
+	const char *base = getenv("TMPDIR");
+	std::string pattern = std::string(base && *base ? base : "/tmp") + "/ssbench.XXXXXX";
+	std::vector<char> name(pattern.begin(), pattern.end());
+	name.push_back(0);
+	bool made = mkdtemp(&name[0]) != NULL;
+	path = &name[0];
+#endif
+	if (!made)
+		fprintf(stderr, "benchmark: could not create a directory like %s: %s\n", path.c_str(), strerror(errno));
+	return made;
+}
+
+static int runSceneFiles(int count, const char *textPath, const char *compiledPath, const char *jsonPath) {
+	FILE *out = fopen(textPath, "w");
+	if (!out) {
+		fprintf(stderr, "benchmark: could not write %s\n", textPath);
+		return 1;
+	}
+	seedRandom();
+	fprintf(out, "body Sun - 1 0.7 0 0 0.8 0.3 0 1 mass=1\nbelt Sun 4.3 4.7\n");
+	for (int i = 0; i < count; i++) {
+		float grey = randomFloat(0.35f, 0.6f);
+		fprintf(out, "rock Sun %.4f %.4f %.4f %.3f %.3f %.3f %.3f %.2f e=%.3f\n",
+			randomFloat(1.3f, 1.7f), randomFloat(0.004f, 0.015f), randomFloat(4.3f, 4.7f), randomFloat(-6, 6),
+			grey, grey, grey, randomFloat(0, 360), randomFloat(0, 0.12f));
+	}
+	fclose(out);
+
+	SceneFile text, compiled;
+	double start = currentTimeMs();
+	bool ok = text.load(textPath);
+	double parseMs = currentTimeMs() - start;
+	start = currentTimeMs();
+	ok = ok && text.save(compiledPath);
+	double saveMs = currentTimeMs() - start;
+	start = currentTimeMs();
+	ok = ok && compiled.load(compiledPath);
+	double mapMs = currentTimeMs() - start;
+
+	// the first pass over a compiled scene is what pulls its pages in
+	start = currentTimeMs();
+	volatile float sink = 0;
+	float total = 0;
+	const float *radius = compiled.floats(SCENE_RADIUS);
+	for (int i = 0; ok && i < compiled.count(); i++)
+		total += radius[i];
+	sink = total;
+	double touchMs = currentTimeMs() - start;
+	(void)sink;
+
+	bool same = ok && compiled.isCompiled() && compiled.count() == text.count() && compiled.count() == count + 1;
+	for (int a = 0; a < SCENE_ARRAY_COUNT && same; a++)
+		same = memcmp(text.floats((SceneArray)a), compiled.floats((SceneArray)a), 4 * (size_t)compiled.count()) == 0;
+
+	printf("scene of %d rocks\n", count);
+	printf("  parse text     %10.3f ms\n", parseMs);
+	printf("  compile        %10.3f ms\n", saveMs);
+	printf("  map compiled   %10.3f ms\n", mapMs);
+	printf("  first pass     %10.3f ms (reading every radius)\n", touchMs);
+
+	BenchJson json;
+	json.add("rocks", count);
+	json.add("passed", same);
+	json.add("parse_ms", parseMs);
+	json.add("compile_ms", saveMs);
+	json.add("map_ms", mapMs);
+	json.add("first_pass_ms", touchMs);
+	json.write(jsonPath);
+	text.close();
+	compiled.close();
+	return reportCheck(same, "the compiled scene %s the text one", same ? "matches" : "differs from");
+}
+
+int runSceneBenchmark(int count, const char *jsonPath) {
+	std::string directory;
+	if (!makeScratchDirectory(directory))
+		return 1;
+	std::string textPath = directory + "/bench.scene", compiledPath = directory + "/bench.scenebin";
+	int result = runSceneFiles(count, textPath.c_str(), compiledPath.c_str(), jsonPath);
+	// whichever of them got written, on every way out
+	remove(textPath.c_str());
+	remove(compiledPath.c_str());
+#if defined(_WIN32)
+	_rmdir(directory.c_str());
+#else
+	rmdir(directory.c_str());
+#endif
+	return result;
+}
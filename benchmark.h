@@ -0,0 +1,133 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include<stdio.h>
+#include<string>
+#include<vector>
+
+// Phases a frame is split into for timing. Time between two markPhase() calls
+// is charged to the phase passed to the second call.
+enum FramePhase {
+	PHASE_SIMULATION,    // advancing the orbits
+	PHASE_PROJECTION,    // clearing and setting up the projection
+	PHASE_CAMERA,        // lookAtMovement/relativeMovement/geoSyncLock
+	PHASE_SHIP,          // drawShip for the other ship
+	PHASE_SOLAR_SYSTEM,  // drawSolarSystem
+	PHASE_FLUSH,         // the render queue making the draw calls
+	PHASE_SWAP,          // buffer swap, or glFinish when offscreen
+	PHASE_OTHER,         // anything else
+	PHASE_COUNT
+};
+
+extern const char *phaseNames[PHASE_COUNT];
+
+// Things counted during a frame, reported next to the phase times
+enum FrameCounter {
+	COUNTER_DRAWN,         // objects that passed the frustum test
+	COUNTER_CULLED,        // objects skipped by the frustum test
+	COUNTER_COMMANDS,      // draw commands submitted to the render queue
+	COUNTER_DRAW_CALLS,    // draw calls the queue made for them
+	COUNTER_STATE_CHANGES, // program, lighting, color and array changes between those
+	COUNTER_COUNT
+};
+
+extern const char *counterNames[COUNTER_COUNT];
+
+// milliseconds from a fixed but arbitrary point
+double currentTimeMs();
+
+// Collects per-phase times for every frame, grouped by a caller chosen label
+// (the benchmark uses the camera mode), and reports min/median/p99 for each
+// group and for all frames together.
+class FrameTimings {
+public:
+	FrameTimings();
+
+	// Group labels must be added before frames are recorded under them
+	int addGroup(const std::string &name);
+
+	void beginFrame();
+	void mark(FramePhase phase);
+	void count(FrameCounter counter, int amount);
+	void endFrame(int group);
+
+	// print a table of every group to out
+	void print(FILE *out) const;
+
+	// write every group as JSON; extra is a JSON object body (without braces)
+	// placed before the results, e.g. the frame count and renderer
+	void writeJson(FILE *out, const std::string &extra) const;
+
+private:
+	struct Stats {
+		double min, median, p99, mean;
+	};
+	static Stats summarize(std::vector<double> samples);
+	void printGroup(FILE *out, const std::string &name, const std::vector<std::vector<double> > &group) const;
+	void writeGroup(FILE *out, const std::string &name, const std::vector<std::vector<double> > &group, bool last) const;
+	// every group's samples merged together
+	std::vector<std::vector<double> > allSamples() const;
+
+	double last;
+	double current[PHASE_COUNT];
+	int counts[COUNTER_COUNT];
+	std::vector<std::string> groups;
+	// samples[group][phase], phase PHASE_COUNT holds the frame total and
+	// counter c is at PHASE_COUNT + 1 + c
+	std::vector<std::vector<std::vector<double> > > samples;
+};
+
+// Direct markPhase() calls to timings, or turn them off with NULL
+void setPhaseTimings(FrameTimings *timings);
+
+// Marks the end of a phase of the current frame. Does nothing unless a
+// FrameTimings has been set, so it can stay in the render path.
+void markPhase(FramePhase phase);
+
+// Adds to a counter for the current frame, likewise only when timing
+void countFrame(FrameCounter counter, int amount);
+
+// text as a quoted JSON string, with quotes, backslashes and control
+// characters escaped
+std::string jsonString(const char *text);
+
+// The scripted benchmark session: an equal share of the frames is spent in
+// each camera mode (lookat, relative, geosync), pressing the keys a user would.
+int benchmarkModeCount();
+const char *benchmarkModeName(int mode);
+// camera mode the given frame belongs to
+int benchmarkMode(int frame, int frames);
+// keys to press before rendering the given frame
+std::string benchmarkKeys(int frame, int frames);
+
+// --bench-matrix: checks the rigid inverse and the batched matrix kernels
+// against the general MESA inverse and the scalar multiply, and times each of
+// them. Returns the process exit code, which is non-zero if any kernel is out
+// of tolerance. If jsonPath is set the timings are also written there.
+int runMatrixBenchmark(const char *jsonPath);
+
+// --bench-bodies N: fills a body store with N bodies and times a simulation
+// step plus the interpolation for rendering, checking the SIMD pass against
+// the scalar rule. Returns the process exit code.
+int runBodyBenchmark(int count, const char *jsonPath);
+
+// --bench-nbody N: runs steps leapfrog steps of an N particle Plummer sphere
+// through the Barnes-Hut integrator with the given opening angle and step
+// size, and reports the time per step, the energy drift and the tree's force
+// error against direct summation. threads 0 uses every core. Returns the
+// process exit code, which is non-zero if the energy stops being finite.
+int runNBodyBenchmark(int count, int steps, float theta, float dt, int threads, const char *jsonPath);
+
+// --bench-kepler N: evaluates an ephemeris of N random elliptical orbits at
+// times from now to far in the future, checking the SIMD Newton solve against
+// a double precision one and timing each evaluation. Returns the process exit
+// code, which is non-zero if any position is out of tolerance.
+int runKeplerBenchmark(int count, const char *jsonPath);
+
+// --bench-scene N: writes a scene of a sun and N rocks as text, compiles it,
+// and times loading each form, checking they hold the same bodies. The files
+// go in a scratch directory of their own, removed again afterwards. Returns
+// the process exit code, which is non-zero if they differ or can't be written.
+int runSceneBenchmark(int count, const char *jsonPath);
+
+#endif
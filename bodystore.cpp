@@ -0,0 +1,166 @@
+#include "bodystore.h"
+#include "jobsystem.h"
+
+#include<stddef.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE__))
+#define BODYSTORE_SSE 1
+#include<xmmintrin.h>
+#endif
+
+// Bodies per job when the updates are split over threads: a pass is only a
+// few operations a body, so a job needs a lot of them to be worth handing out.
+// A multiple of 4, so every job's vector loop starts on a group of four.
+static const int BODY_GRAIN = 16384;
+
+// data() of an empty vector may be NULL, which is fine: nothing reads it
+template<class T> static const T *first(const std::vector<T> &v) {
+	return v.empty() ? NULL : &v[0];
+}
+
+BodyStore::BodyStore() : attached(false) {
+	pointAtOwned();
+}
+
+void BodyStore::pointAtOwned() {
+	rate = first(ownedRate);
+	radius = first(ownedRadius);
+	orbitRadius = first(ownedOrbitRadius);
+	inclination = first(ownedInclination);
+	parent = first(ownedParent);
+	colorR = first(ownedR);
+	colorG = first(ownedG);
+	colorB = first(ownedB);
+	colorA = first(ownedA);
+}
+
+void BodyStore::attach(int n, const BodyConstants &constants, const float *angles) {
+	attached = true;
+	rate = constants.rate;
+	radius = constants.radius;
+	orbitRadius = constants.orbitRadius;
+	inclination = constants.inclination;
+	parent = constants.parent;
+	colorR = constants.colorR;
+	colorG = constants.colorG;
+	colorB = constants.colorB;
+	colorA = constants.colorA;
+	angle.assign(angles, angles + n);
+	previousAngle = angle;
+	renderAngle = angle;
+}
+
+void BodyStore::own() {
+	if (!attached)
+		return;
+	int n = count();
+	ownedRate.assign(rate, rate + n);
+	ownedRadius.assign(radius, radius + n);
+	ownedOrbitRadius.assign(orbitRadius, orbitRadius + n);
+	ownedInclination.assign(inclination, inclination + n);
+	ownedParent.assign(parent, parent + n);
+	ownedR.assign(colorR, colorR + n);
+	ownedG.assign(colorG, colorG + n);
+	ownedB.assign(colorB, colorB + n);
+	ownedA.assign(colorA, colorA + n);
+	attached = false;
+	pointAtOwned();
+}
+
+int BodyStore::add(float bodyRate, float bodyRadius, float bodyOrbitRadius, float bodyInclination, int bodyParent,
+	float r, float g, float b, float a) {
+	own();
+	angle.push_back(0);
+	previousAngle.push_back(0);
+	renderAngle.push_back(0);
+	ownedRate.push_back(bodyRate);
+	ownedRadius.push_back(bodyRadius);
+	ownedOrbitRadius.push_back(bodyOrbitRadius);
+	ownedInclination.push_back(bodyInclination);
+	ownedParent.push_back(bodyParent);
+	ownedR.push_back(r);
+	ownedG.push_back(g);
+	ownedB.push_back(b);
+	ownedA.push_back(a);
+	pointAtOwned();
+	return count() - 1;
+}
+
+void BodyStore::reserve(int n) {
+	own();
+	angle.reserve(n);
+	previousAngle.reserve(n);
+	renderAngle.reserve(n);
+	ownedRate.reserve(n);
+	ownedRadius.reserve(n);
+	ownedOrbitRadius.reserve(n);
+	ownedInclination.reserve(n);
+	ownedParent.reserve(n);
+	ownedR.reserve(n);
+	ownedG.reserve(n);
+	ownedB.reserve(n);
+	ownedA.reserve(n);
+	pointAtOwned();
+}
+
+// Same rule rotateInSpace always used: an angle that has reached 360 wraps
+// back round before the rate is added.
+void BodyStore::step(JobSystem *jobs) {
+	parallelFor(jobs, "BodyStore::step", count(), BODY_GRAIN, [this](int begin, int end) { stepRange(begin, end); });
+}
+
+void BodyStore::stepRange(int begin, int end) {
+	float *a = &angle[0], *prev = &previousAngle[0];
+	const float *r = &rate[0];
+	int i = begin;
+
+#if defined(BODYSTORE_SSE)
+	const __m128 full = _mm_set1_ps(360);
+	for (; i + 4 <= end; i += 4) {
+		__m128 old = _mm_loadu_ps(a + i);
+		__m128 wrap = _mm_and_ps(_mm_cmpge_ps(old, full), full);
+		_mm_storeu_ps(prev + i, old);
+		_mm_storeu_ps(a + i, _mm_add_ps(_mm_sub_ps(old, wrap), _mm_loadu_ps(r + i)));
+	}
+#endif
+
+	for (; i < end; i++) {
+		float old = a[i];
+		prev[i] = old;
+		a[i] = (old >= 360 ? old - 360 : old) + r[i];
+	}
+}
+
+void BodyStore::interpolate(float alpha, JobSystem *jobs) {
+	parallelFor(jobs, "BodyStore::interpolate", count(), BODY_GRAIN,
+		[this, alpha](int begin, int end) { interpolateRange(alpha, begin, end); });
+}
+
+void BodyStore::interpolateRange(float alpha, int begin, int end) {
+	const float *a = &angle[0], *prev = &previousAngle[0];
+	float *out = &renderAngle[0];
+	int i = begin;
+
+#if defined(BODYSTORE_SSE)
+	// a body turns less than half way round in a step, either way, so a
+	// change of more than 180 degrees means the angle wrapped
+	const __m128 full = _mm_set1_ps(360), half = _mm_set1_ps(180), t = _mm_set1_ps(alpha);
+	const __m128 minusHalf = _mm_set1_ps(-180);
+	for (; i + 4 <= end; i += 4) {
+		__m128 p = _mm_loadu_ps(prev + i);
+		__m128 delta = _mm_sub_ps(_mm_loadu_ps(a + i), p);
+		delta = _mm_add_ps(delta, _mm_and_ps(_mm_cmplt_ps(delta, minusHalf), full));
+		delta = _mm_sub_ps(delta, _mm_and_ps(_mm_cmpgt_ps(delta, half), full));
+		_mm_storeu_ps(out + i, _mm_add_ps(p, _mm_mul_ps(delta, t)));
+	}
+#endif
+
+	for (; i < end; i++) {
+		float delta = a[i] - prev[i];
+		if (delta < -180)
+			delta += 360;
+		else if (delta > 180)
+			delta -= 360;
+		out[i] = prev[i] + delta * alpha;
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef BODYSTORE_H
+#define BODYSTORE_H
+
+#include<stddef.h>
+#include<vector>
+
+class JobSystem;
+
+// Where a body store's constants are, when they aren't its own
+struct BodyConstants {
+	const float *rate, *radius, *orbitRadius, *inclination;
+	const int *parent;
+	const float *colorR, *colorG, *colorB, *colorA;
+};
+
+// Every orbiting body in the simulation, stored as one contiguous array per
+// property so that updating all of them is a straight pass over memory.
+// Angles are in degrees and go from 0 to 360, like the old planets table.
+//
+// The constants can live outside the store, e.g. in a scene file mapped into
+// memory, so a big scene is used where it is instead of being copied. Only
+// the angles, which change every step, are always the store's own.
+class BodyStore {
+public:
+	BodyStore();
+
+	// Adds a body and returns its index. parent is the index of the body it
+	// orbits, or -1 for none. inclination tilts the orbit's plane about the
+	// (1,1,1) axis, which is how Pluto's orbit has always been drawn.
+	int add(float rate, float radius, float orbitRadius, float inclination, int parent,
+		float r, float g, float b, float a);
+
+	// Use count bodies whose constants are the given arrays, which have to
+	// outlive the store or the next add(), starting at the given angles.
+	// Replaces any bodies already in the store.
+	void attach(int count, const BodyConstants &constants, const float *angles);
+
+	void reserve(int count);
+	int count() const { return (int)angle.size(); }
+
+	// Move every body one simulation step along its orbit. The angle before
+	// the step is kept for interpolation. With jobs, big stores are split
+	// over its threads.
+	void step(JobSystem *jobs = NULL);
+
+	// Fill renderAngle with previousAngle and angle blended by alpha, the
+	// short way round, so bodies going either way never spin back a turn.
+	// Rates have to stay under 180 degrees a step for that.
+	void interpolate(float alpha, JobSystem *jobs = NULL);
+
+	// Per-body state
+	std::vector<float> angle;          // rotation now, in degrees
+	std::vector<float> previousAngle;  // rotation at the previous step
+	std::vector<float> renderAngle;    // rotation to draw with this frame
+
+	// Per-body constants
+	const float *rate;                 // degrees per step
+	const float *radius;               // size of the body
+	const float *orbitRadius;          // distance from the parent
+	const float *inclination;          // degrees of tilt of the orbit
+	const int *parent;                 // index of the parent body, or -1
+	const float *colorR, *colorG, *colorB, *colorA;
+
+private:
+	// the passes over bodies begin up to end
+	void stepRange(int begin, int end);
+	void interpolateRange(float alpha, int begin, int end);
+
+	// Copy attached constants into the store's own arrays, so more can be added
+	void own();
+	void pointAtOwned();
+
+	bool attached;
+	std::vector<float> ownedRate, ownedRadius, ownedOrbitRadius, ownedInclination;
+	std::vector<int> ownedParent;
+	std::vector<float> ownedR, ownedG, ownedB, ownedA;
+};
+
+#endif
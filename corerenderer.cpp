@@ -0,0 +1,188 @@
+#include "corerenderer.h"
+#include "meshcache.h"
+#include "matrix.h"
+
+#include<math.h>
+#include<stdio.h>
+#include<string.h>
+
+const char *frameBlockSource =
+	"layout(std140) uniform Frame {\n"
+	"	mat4 projection;\n"
+	"	vec4 lightDirection[2];\n"
+	"	vec4 lightDiffuse;\n"
+	"	vec4 ambient;\n"
+	"};\n"
+	"vec3 lightColor(vec3 normal) {\n"
+	"	vec3 light = ambient.rgb;\n"
+	"	for (int i = 0; i < 2; i++)\n"
+	"		light += lightDiffuse.rgb * max(dot(normal, lightDirection[i].xyz), 0.0);\n"
+	"	return light;\n"
+	"}\n";
+
+// Colors are clamped per vertex before they are interpolated, as the fixed
+// function pipeline does
+static const char *vertexSource =
+	"uniform mat4 modelview;\n"
+	"uniform mat3 normalMatrix;\n"
+	"uniform vec4 color;\n"
+	"uniform bool lit;\n"
+	"in vec3 position;\n"
+	"in vec3 normal;\n"
+	"out vec4 shade;\n"
+	"void main() {\n"
+	"	gl_Position = projection * (modelview * vec4(position, 1.0));\n"
+	"	if (lit)\n"
+	"		shade = vec4(clamp(color.rgb * lightColor(normalize(normalMatrix * normal)), 0.0, 1.0), color.a);\n"
+	"	else\n"
+	"		shade = color;\n"
+	"}\n";
+
+static const char *fragmentSource =
+	"#version 330\n"
+	"in vec4 shade;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	fragColor = shade;\n"
+	"}\n";
+
+// Compiles one shader stage from its parts, printing the log if it fails
+static GLuint compileShader(GLenum type, const char *const *parts, int count) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, count, parts, NULL);
+	glCompileShader(shader);
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "core shader failed to compile: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+CoreRenderer::CoreRenderer()
+	: program(0), frameBuffer(0), modelviewLocation(-1), normalMatrixLocation(-1), colorLocation(-1),
+	litLocation(-1), lit(true), bound(false), modelviewDirty(true), normalDirty(true), colorDirty(true), litDirty(true) {
+	memset(&frame, 0, sizeof(frame));
+	for (int i = 0; i < 16; i++)
+		modelview[i] = frame.projection[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	// a fresh context draws in white
+	color[0] = color[1] = color[2] = color[3] = 1;
+}
+
+bool CoreRenderer::init() {
+	const char *vertexParts[] = {"#version 330\n", frameBlockSource, vertexSource};
+	GLuint vertex = compileShader(GL_VERTEX_SHADER, vertexParts, 3);
+	GLuint fragment = compileShader(GL_FRAGMENT_SHADER, &fragmentSource, 1);
+	if (!vertex || !fragment)
+		return false;
+	program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	glBindAttribLocation(program, POSITION_ATTRIBUTE, "position");
+	glBindAttribLocation(program, NORMAL_ATTRIBUTE, "normal");
+	glLinkProgram(program);
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+	GLint ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "core shader failed to link: %s\n", log);
+		release();
+		return false;
+	}
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Frame"), FRAME_BINDING);
+	modelviewLocation = glGetUniformLocation(program, "modelview");
+	normalMatrixLocation = glGetUniformLocation(program, "normalMatrix");
+	colorLocation = glGetUniformLocation(program, "color");
+	litLocation = glGetUniformLocation(program, "lit");
+
+	glGenBuffers(1, &frameBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), &frame, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	bound = false;
+	modelviewDirty = normalDirty = colorDirty = litDirty = true;
+	return true;
+}
+
+void CoreRenderer::setLights(const float position0[4], const float position1[4], const float diffuse[4], const float ambient[4]) {
+	const float *positions[2] = {position0, position1};
+	for (int i = 0; i < 2; i++) {
+		const float *p = positions[i];
+		float length = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		for (int k = 0; k < 3; k++)
+			frame.lightDirection[i][k] = p[k] / length;
+		frame.lightDirection[i][3] = 0;
+	}
+	memcpy(frame.lightDiffuse, diffuse, sizeof(frame.lightDiffuse));
+	memcpy(frame.ambient, ambient, sizeof(frame.ambient));
+}
+
+void CoreRenderer::setProjection(const float projection[16]) {
+	memcpy(frame.projection, projection, sizeof(frame.projection));
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &frame);
+	// the views drawn offscreen share one context, so the last view may have
+	// left another renderer's program in use
+	bound = false;
+}
+
+void CoreRenderer::setModelview(const float m[16]) {
+	memcpy(modelview, m, sizeof(modelview));
+	modelviewDirty = normalDirty = true;
+}
+
+void CoreRenderer::setColor(float r, float g, float b, float a) {
+	if (color[0] == r && color[1] == g && color[2] == b && color[3] == a)
+		return;
+	color[0] = r; color[1] = g; color[2] = b; color[3] = a;
+	colorDirty = true;
+}
+
+void CoreRenderer::setLighting(bool on) {
+	if (lit == on)
+		return;
+	lit = on;
+	litDirty = true;
+}
+
+void CoreRenderer::apply() {
+	if (!bound) {
+		glUseProgram(program);
+		bound = true;
+	}
+	if (modelviewDirty) {
+		glUniformMatrix4fv(modelviewLocation, 1, GL_FALSE, modelview);
+		modelviewDirty = false;
+	}
+	// the normal matrix is only needed lit
+	if (normalDirty && lit) {
+		float normal[9];
+		mat4NormalMatrix(modelview, normal);
+		glUniformMatrix3fv(normalMatrixLocation, 1, GL_FALSE, normal);
+		normalDirty = false;
+	}
+	if (colorDirty) {
+		glUniform4fv(colorLocation, 1, color);
+		colorDirty = false;
+	}
+	if (litDirty) {
+		glUniform1i(litLocation, lit);
+		litDirty = false;
+	}
+}
+
+void CoreRenderer::release() {
+	if (program)
+		glDeleteProgram(program);
+	if (frameBuffer)
+		glDeleteBuffers(1, &frameBuffer);
+	program = frameBuffer = 0;
+	bound = false;
+}
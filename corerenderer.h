@@ -0,0 +1,71 @@
+#ifndef CORERENDERER_H
+#define CORERENDERER_H
+
+#include "glplatform.h"
+
+// Uniform buffer binding point of the per-frame block below
+static const GLuint FRAME_BINDING = 0;
+
+// GLSL for shaders drawn with a CoreRenderer's frame block: the block itself,
+// and lightColor(normal), the light reaching a vertex with that eye space
+// normal. Goes after the #version line.
+extern const char *frameBlockSource;
+
+// Shader side of the OpenGL 3.3 core profile path, for ONE context. It stands
+// in for what the fixed function pipeline did for the compatibility path: the
+// projection and the two lights are in a uniform buffer, written once per
+// view, and the modelview matrix, color and whether lighting is on are
+// uniforms of one program. The lighting is the fixed function model as
+// initView sets it up, worked out per vertex: color * (ambient + the diffuse
+// of each light), with no specular since the material has none.
+//
+// Setting state only marks it changed; apply() hands GL what changed just
+// before a draw, so a run of draws with the same color uploads only their
+// matrices.
+class CoreRenderer {
+public:
+	CoreRenderer();
+
+	// Compile the program and create the uniform buffer. Returns false (and
+	// prints why) if it can't. Must be called with the owning context current.
+	bool init();
+
+	// Light directions (w = 0, in eye space, like GL_POSITION), the diffuse
+	// color they both have and the global ambient light
+	void setLights(const float position0[4], const float position1[4], const float diffuse[4], const float ambient[4]);
+	// Upload the frame block with this projection and bind it for every
+	// program that uses it. Starts a view, so the next apply() uses the
+	// program again.
+	void setProjection(const float projection[16]);
+
+	void setModelview(const float modelview[16]);
+	void setColor(float r, float g, float b, float a);
+	void setLighting(bool on);
+
+	// Use the program and upload whatever changed since the last apply
+	void apply();
+	// Something else used its own program, so apply() has to use this one again
+	void programChanged() { bound = false; }
+
+	// delete the program and buffer
+	void release();
+
+private:
+	// std140 layout of the frame block
+	struct FrameBlock {
+		float projection[16];
+		float lightDirection[2][4];
+		float lightDiffuse[4];
+		float ambient[4];
+	};
+
+	GLuint program, frameBuffer;
+	GLint modelviewLocation, normalMatrixLocation, colorLocation, litLocation;
+	FrameBlock frame;
+	float modelview[16];
+	float color[4];
+	bool lit;
+	bool bound, modelviewDirty, normalDirty, colorDirty, litDirty;
+};
+
+#endif
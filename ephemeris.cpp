@@ -0,0 +1,191 @@
+#include "ephemeris.h"
+
+#include<math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define EPHEMERIS_SSE 1
+#include<emmintrin.h>
+#endif
+
+static const double PI = 3.14159265358979323846;
+static const float DEGREES = (float)(PI / 180);
+
+// Newton's method stops once every body in a group has moved by less than
+// this, in radians, or after MAX_NEWTON iterations whatever happens
+static const float NEWTON_TOLERANCE = 1e-6f;
+static const int MAX_NEWTON = 16;
+
+Ephemeris::Ephemeris() : iterations(0) {
+}
+
+int Ephemeris::add(const OrbitalElements &e) {
+	elements.push_back(e);
+	meanStart.push_back(e.meanAnomaly * PI / 180);
+	meanRate.push_back(e.meanMotion * PI / 180);
+	eccentricity.push_back(e.eccentricity);
+	semiMajor.push_back(e.semiMajorAxis);
+	semiMinor.push_back(e.semiMajorAxis * sqrtf(1 - e.eccentricity * e.eccentricity));
+
+	// periapsis and the direction 90 degrees on from it, in an ecliptic with
+	// z as north, then turned into the parent's space where y is north
+	float cw = cosf(e.periapsis * DEGREES), sw = sinf(e.periapsis * DEGREES);
+	float cn = cosf(e.ascendingNode * DEGREES), sn = sinf(e.ascendingNode * DEGREES);
+	float ci = cosf(e.inclination * DEGREES), si = sinf(e.inclination * DEGREES);
+	float p[3] = {cw * cn - sw * sn * ci, cw * sn + sw * cn * ci, sw * si};
+	float q[3] = {-sw * cn - cw * sn * ci, -sw * sn + cw * cn * ci, cw * si};
+	px.push_back(p[0]); py.push_back(p[2]); pz.push_back(-p[1]);
+	qx.push_back(q[0]); qy.push_back(q[2]); qz.push_back(-q[1]);
+
+	x.push_back(0); y.push_back(0); z.push_back(0);
+	anomaly.push_back(0);
+	return count() - 1;
+}
+
+void Ephemeris::reserve(int n) {
+	elements.reserve(n);
+	meanStart.reserve(n); meanRate.reserve(n);
+	eccentricity.reserve(n); semiMajor.reserve(n); semiMinor.reserve(n);
+	px.reserve(n); py.reserve(n); pz.reserve(n);
+	qx.reserve(n); qy.reserve(n); qz.reserve(n);
+	x.reserve(n); y.reserve(n); z.reserve(n);
+	anomaly.reserve(n);
+}
+
+void Ephemeris::orbitBasis(int body, float basis[9]) const {
+	basis[0] = qx[body]; basis[1] = qy[body]; basis[2] = qz[body];
+	basis[3] = px[body]; basis[4] = py[body]; basis[5] = pz[body];
+	// q cross p
+	basis[6] = qy[body] * pz[body] - qz[body] * py[body];
+	basis[7] = qz[body] * px[body] - qx[body] * pz[body];
+	basis[8] = qx[body] * py[body] - qy[body] * px[body];
+}
+
+// Brings an angle into [-pi, pi). fmod would do it too, but takes longer the
+// bigger the angle is, and these get big far in the future.
+static double wrapAngle(double m) {
+	return m - 2 * PI * floor((m + PI) / (2 * PI));
+}
+
+// Mean anomaly at time. This is the only place time appears, and it costs the
+// same however far away time is.
+static float meanAnomalyAt(double start, double rate, double time) {
+	return (float)wrapAngle(start + rate * time);
+}
+
+double Ephemeris::solveKepler(double m, double e) {
+	// Danby's starting guess converges for any eccentricity below 1
+	double E = m + (m < 0 ? -0.85 : 0.85) * e;
+	for (int i = 0; i < 50; i++) {
+		double step = (E - e * sin(E) - m) / (1 - e * cos(E));
+		E -= step;
+		if (fabs(step) < 1e-14)
+			break;
+	}
+	return E;
+}
+
+void Ephemeris::positionAt(int body, double time, double out[3]) const {
+	double m = wrapAngle(meanStart[body] + meanRate[body] * time);
+	double e = eccentricity[body];
+	double E = solveKepler(m, e);
+	double a = semiMajor[body];
+	double u = a * (cos(E) - e), v = a * sqrt(1 - e * e) * sin(E);
+	out[0] = u * px[body] + v * qx[body];
+	out[1] = u * py[body] + v * qy[body];
+	out[2] = u * pz[body] + v * qz[body];
+}
+
+#if defined(EPHEMERIS_SSE)
+// Sine and cosine of four angles at once: the angle is brought into
+// [-pi/4, pi/4] by the nearest multiple of pi/2, both are found there with the
+// Cephes polynomials, and the quadrant picks which one is which and its sign.
+// Good to a few float ulps for angles of the size Kepler's equation sees.
+static inline void sinCos4(__m128 angle, __m128 &s, __m128 &c) {
+	__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(angle, _mm_set1_ps((float)(2 / PI))));
+	__m128 k = _mm_cvtepi32_ps(quadrant);
+	__m128 r = _mm_sub_ps(angle, _mm_mul_ps(k, _mm_set1_ps(1.5703125f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(4.837512969970703125e-4f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(7.54978995489188216e-8f)));
+	__m128 r2 = _mm_mul_ps(r, r);
+
+	__m128 sinR = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f));
+	sinR = _mm_add_ps(_mm_mul_ps(sinR, r2), _mm_set1_ps(-1.6666654611e-1f));
+	sinR = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sinR, r2), r), r);
+	__m128 cosR = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+	cosR = _mm_add_ps(_mm_mul_ps(cosR, r2), _mm_set1_ps(4.166664568298827e-2f));
+	cosR = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cosR, r2), r2), _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(r2, _mm_set1_ps(0.5f))));
+
+	// odd quadrants swap the two; sine is negated in quadrants 2 and 3,
+	// cosine in 1 and 2
+	const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+	__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+	__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, two), 30));
+	__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one), two), 30));
+	s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cosR), _mm_andnot_ps(swap, sinR)), sinSign);
+	c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sinR), _mm_andnot_ps(swap, cosR)), cosSign);
+}
+#endif
+
+void Ephemeris::evaluate(double time) {
+	int n = count();
+	for (int i = 0; i < n; i++)
+		anomaly[i] = meanAnomalyAt(meanStart[i], meanRate[i], time);
+
+	float *E = n > 0 ? &anomaly[0] : NULL;
+	const float *ecc = n > 0 ? &eccentricity[0] : NULL;
+	int worst = 0;
+	int i = 0;
+
+#if defined(EPHEMERIS_SSE)
+	const __m128 one = _mm_set1_ps(1), tolerance = _mm_set1_ps(NEWTON_TOLERANCE);
+	const __m128 start = _mm_set1_ps(0.85f), signBit = _mm_set1_ps(-0.0f);
+	for (; i + 4 <= n; i += 4) {
+		__m128 m = _mm_loadu_ps(E + i), e = _mm_loadu_ps(ecc + i);
+		// Danby's guess, m + 0.85 e with the sign of m
+		__m128 guess = _mm_or_ps(_mm_mul_ps(start, e), _mm_and_ps(m, signBit));
+		__m128 ea = _mm_add_ps(m, guess);
+		int steps = 0;
+		while (steps < MAX_NEWTON) {
+			__m128 s, c;
+			sinCos4(ea, s, c);
+			__m128 f = _mm_sub_ps(_mm_sub_ps(ea, _mm_mul_ps(e, s)), m);
+			__m128 step = _mm_div_ps(f, _mm_sub_ps(one, _mm_mul_ps(e, c)));
+			ea = _mm_sub_ps(ea, step);
+			steps++;
+			__m128 size = _mm_andnot_ps(signBit, step);
+			if (_mm_movemask_ps(_mm_cmpge_ps(size, tolerance)) == 0)
+				break;
+		}
+		if (steps > worst)
+			worst = steps;
+
+		__m128 s, c;
+		sinCos4(ea, s, c);
+		__m128 u = _mm_mul_ps(_mm_loadu_ps(&semiMajor[i]), _mm_sub_ps(c, e));
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(&semiMinor[i]), s);
+		_mm_storeu_ps(&x[i], _mm_add_ps(_mm_mul_ps(u, _mm_loadu_ps(&px[i])), _mm_mul_ps(v, _mm_loadu_ps(&qx[i]))));
+		_mm_storeu_ps(&y[i], _mm_add_ps(_mm_mul_ps(u, _mm_loadu_ps(&py[i])), _mm_mul_ps(v, _mm_loadu_ps(&qy[i]))));
+		_mm_storeu_ps(&z[i], _mm_add_ps(_mm_mul_ps(u, _mm_loadu_ps(&pz[i])), _mm_mul_ps(v, _mm_loadu_ps(&qz[i]))));
+	}
+#endif
+
+	for (; i < n; i++) {
+		float m = E[i], e = ecc[i];
+		float ea = m + (m < 0 ? -0.85f : 0.85f) * e;
+		int steps = 0;
+		while (steps < MAX_NEWTON) {
+			float step = (ea - e * sinf(ea) - m) / (1 - e * cosf(ea));
+			ea -= step;
+			steps++;
+			if (fabsf(step) < NEWTON_TOLERANCE)
+				break;
+		}
+		if (steps > worst)
+			worst = steps;
+		float u = semiMajor[i] * (cosf(ea) - e), v = semiMinor[i] * sinf(ea);
+		x[i] = u * px[i] + v * qx[i];
+		y[i] = u * py[i] + v * qy[i];
+		z[i] = u * pz[i] + v * qz[i];
+	}
+	iterations = worst;
+}
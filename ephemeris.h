@@ -0,0 +1,69 @@
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include<vector>
+
+// Classical elements of an orbit around its parent. Angles are in degrees,
+// measured in the parent's ecliptic: the xz plane, with +y as north.
+struct OrbitalElements {
+	float semiMajorAxis;   // a
+	float eccentricity;    // e, from 0 (circle) to below 1
+	float inclination;     // i, tilt of the orbit's plane
+	float ascendingNode;   // longitude of the ascending node
+	float periapsis;       // argument of periapsis, from the ascending node
+	float meanAnomaly;     // mean anomaly at time 0
+	float meanMotion;      // degrees of mean anomaly per unit of time
+};
+
+// Positions on elliptical orbits worked out straight from the elements, so
+// any time costs the same to evaluate: reaching a year ahead is no more work
+// than reaching the next frame. Kepler's equation is solved with Newton's
+// method for every body, four at a time with SSE, until every body in the
+// group has converged.
+class Ephemeris {
+public:
+	Ephemeris();
+
+	// Adds a body and returns its index
+	int add(const OrbitalElements &elements);
+	void reserve(int count);
+	int count() const { return (int)semiMajor.size(); }
+	const OrbitalElements &getElements(int body) const { return elements[body]; }
+
+	// Fill x, y and z with every body's position at time, relative to the
+	// body it orbits
+	void evaluate(double time);
+
+	// Rotation taking the orbit's own plane into the parent's space, as a
+	// column-major 3x3 matrix: column 1 points at periapsis, column 0 is the
+	// way the body moves there, and column 2 is the orbit's normal turned
+	// so that the matrix is a rotation
+	void orbitBasis(int body, float basis[9]) const;
+
+	// most Newton iterations any group of bodies needed in the last evaluate
+	int getIterations() const { return iterations; }
+
+	// Eccentric anomaly for the given mean anomaly (radians), in double
+	// precision one body at a time. The reference evaluate() is checked against.
+	static double solveKepler(double meanAnomaly, double eccentricity);
+
+	// Position at time for one body, in double precision, using solveKepler
+	void positionAt(int body, double time, double out[3]) const;
+
+	// Positions from the last evaluate
+	std::vector<float> x, y, z;
+
+private:
+	std::vector<OrbitalElements> elements;
+	// mean anomaly at time 0 and its rate, in radians, kept in double so a
+	// time far in the future still lands on the right point of the orbit
+	std::vector<double> meanStart, meanRate;
+	std::vector<float> eccentricity, semiMajor, semiMinor;
+	// unit vectors toward periapsis (p) and 90 degrees on from it (q)
+	std::vector<float> px, py, pz, qx, qy, qz;
+	// mean then eccentric anomaly during evaluate
+	std::vector<float> anomaly;
+	int iterations;
+};
+
+#endif
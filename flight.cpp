@@ -0,0 +1,169 @@
+#include "flight.h"
+
+#include<math.h>
+
+static const double PI = 3.14159265358979323846;
+
+// Below these the ship has stopped, rather than creeping for ever
+static const double REST_DEGREES_PER_SECOND = 1e-3;
+static const double REST_UNITS_PER_SECOND = 1e-5;
+
+// out = a * b, applying b first. out may be a or b.
+static void quatMultiply(const double *a, const double *b, double *out) {
+	double w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+	double x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+	double y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+	double z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+	out[0] = w;
+	out[1] = x;
+	out[2] = y;
+	out[3] = z;
+}
+
+static void quatNormalize(double *q) {
+	double length = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	for (int i = 0; i < 4; i++)
+		q[i] /= length;
+}
+
+// The rotation matrix of unit quaternion q, as r[row][col]
+static void quatToRotation(const double *q, double r[3][3]) {
+	double w = q[0], x = q[1], y = q[2], z = q[3];
+	r[0][0] = 1 - 2 * (y * y + z * z);
+	r[0][1] = 2 * (x * y - w * z);
+	r[0][2] = 2 * (x * z + w * y);
+	r[1][0] = 2 * (x * y + w * z);
+	r[1][1] = 1 - 2 * (x * x + z * z);
+	r[1][2] = 2 * (y * z - w * x);
+	r[2][0] = 2 * (x * z - w * y);
+	r[2][1] = 2 * (y * z + w * x);
+	r[2][2] = 1 - 2 * (x * x + y * y);
+}
+
+// The quaternion of rotation matrix r, taking the square root of whichever
+// term is largest so nothing is divided by something near 0
+static void quatFromRotation(const double r[3][3], double *q) {
+	double trace = r[0][0] + r[1][1] + r[2][2];
+	if (trace > 0) {
+		double s = 2 * sqrt(trace + 1);
+		q[0] = s / 4;
+		q[1] = (r[2][1] - r[1][2]) / s;
+		q[2] = (r[0][2] - r[2][0]) / s;
+		q[3] = (r[1][0] - r[0][1]) / s;
+	}
+	else if (r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+		double s = 2 * sqrt(1 + r[0][0] - r[1][1] - r[2][2]);
+		q[0] = (r[2][1] - r[1][2]) / s;
+		q[1] = s / 4;
+		q[2] = (r[0][1] + r[1][0]) / s;
+		q[3] = (r[0][2] + r[2][0]) / s;
+	}
+	else if (r[1][1] > r[2][2]) {
+		double s = 2 * sqrt(1 + r[1][1] - r[0][0] - r[2][2]);
+		q[0] = (r[0][2] - r[2][0]) / s;
+		q[1] = (r[0][1] + r[1][0]) / s;
+		q[2] = s / 4;
+		q[3] = (r[1][2] + r[2][1]) / s;
+	}
+	else {
+		double s = 2 * sqrt(1 + r[2][2] - r[0][0] - r[1][1]);
+		q[0] = (r[1][0] - r[0][1]) / s;
+		q[1] = (r[0][2] + r[2][0]) / s;
+		q[2] = (r[1][2] + r[2][1]) / s;
+		q[3] = s / 4;
+	}
+	quatNormalize(q);
+}
+
+ShipFlight::ShipFlight() : speed(0) {
+	orientation[0] = 1;
+	for (int i = 0; i < 3; i++) {
+		orientation[i + 1] = 0;
+		position[i] = 0;
+		angularVelocity[i] = 0;
+	}
+}
+
+void ShipFlight::setView(const float *view) {
+	// the camera's rotation is the transpose of the view's, and its position
+	// the view's translation turned back and negated
+	double r[3][3];
+	for (int row = 0; row < 3; row++)
+		for (int col = 0; col < 3; col++)
+			r[row][col] = view[row * 4 + col];
+	quatFromRotation(r, orientation);
+	for (int row = 0; row < 3; row++)
+		position[row] = -(r[row][0] * view[12] + r[row][1] * view[13] + r[row][2] * view[14]);
+	for (int i = 0; i < 3; i++)
+		angularVelocity[i] = 0;
+	speed = 0;
+}
+
+void ShipFlight::turn(int axis, float degrees) {
+	// velocity v decaying over time constant T covers v * T in all
+	angularVelocity[axis] += degrees / FLIGHT_DAMPING_SECONDS;
+}
+
+void ShipFlight::thrust(float distance) {
+	speed += distance / FLIGHT_DAMPING_SECONDS;
+}
+
+bool ShipFlight::fly(double seconds) {
+	if (!isMoving() || seconds <= 0)
+		return false;
+	// Every velocity dies away at the same rate, so the axis of turn stays put
+	// and this is the exact distance covered, however long the frame
+	double decay = exp(-seconds / FLIGHT_DAMPING_SECONDS);
+	double covered = FLIGHT_DAMPING_SECONDS * (1 - decay);
+
+	double turned[3], angle = 0;
+	for (int i = 0; i < 3; i++) {
+		turned[i] = angularVelocity[i] * covered;
+		angle += turned[i] * turned[i];
+	}
+	angle = sqrt(angle);
+	if (angle > 0) {
+		// about the ship's own axes, so applied on the ship's side
+		double half = angle * PI / 360, s = sin(half) / angle;
+		double step[4] = {cos(half), turned[0] * s, turned[1] * s, turned[2] * s};
+		quatMultiply(orientation, step, orientation);
+		quatNormalize(orientation);
+	}
+
+	// along the nose as it points once turned
+	double r[3][3];
+	quatToRotation(orientation, r);
+	double distance = speed * covered;
+	for (int i = 0; i < 3; i++)
+		position[i] -= r[i][2] * distance;
+
+	for (int i = 0; i < 3; i++)
+		angularVelocity[i] *= decay;
+	speed *= decay;
+	if (!isMoving()) {
+		for (int i = 0; i < 3; i++)
+			angularVelocity[i] = 0;
+		speed = 0;
+	}
+	return true;
+}
+
+bool ShipFlight::isMoving() const {
+	double turning = sqrt(angularVelocity[0] * angularVelocity[0] + angularVelocity[1] * angularVelocity[1]
+		+ angularVelocity[2] * angularVelocity[2]);
+	return turning > REST_DEGREES_PER_SECOND || fabs(speed) > REST_UNITS_PER_SECOND;
+}
+
+void ShipFlight::getView(float *out) const {
+	// the inverse of the ship's pose: its rotation transposed, and its
+	// position turned into ship space and negated
+	double r[3][3];
+	quatToRotation(orientation, r);
+	for (int row = 0; row < 3; row++) {
+		for (int col = 0; col < 3; col++)
+			out[col * 4 + row] = (float)r[col][row];
+		out[12 + row] = (float)-(r[0][row] * position[0] + r[1][row] * position[1] + r[2][row] * position[2]);
+		out[row * 4 + 3] = 0;
+	}
+	out[15] = 1;
+}
@@ -0,0 +1,50 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+// How long a ship's velocity takes to die down to 1/e of itself, in seconds
+static const double FLIGHT_DAMPING_SECONDS = 0.25;
+
+// A ship flown in relative mode. Its orientation is a unit quaternion and its
+// position is in doubles, both in world space, so turning and moving for as
+// long as anyone likes never leaves it skewed or scaled, and the view matrix
+// is built from them fresh every frame rather than by piling rotations onto
+// the last one.
+//
+// Keys don't move the ship themselves. Each press adds velocity, about one of
+// the ship's own axes or along its nose, which then dies away smoothly over a
+// fraction of a second. A press adds just enough for the ship to have turned
+// or moved by the amount asked once it has, so a single tap goes as far as it
+// always did, and holding a key down flies at a steady rate.
+//
+// Trivially copyable, so it can be saved into a snapshot as it is.
+class ShipFlight {
+public:
+	ShipFlight();
+
+	// Puts the ship where the camera of view is, a rotation plus translation
+	// from world to eye space, and stops it
+	void setView(const float *view);
+
+	// Adds velocity about the ship's x (pitch), y (yaw) or z (roll) axis worth
+	// degrees of turn, counterclockwise looking down the axis
+	void turn(int axis, float degrees);
+	// Adds velocity worth distance along the ship's nose, its -z axis, or
+	// backwards for a negative distance
+	void thrust(float distance);
+
+	// Moves the ship on by seconds. Returns whether it moved at all.
+	bool fly(double seconds);
+	bool isMoving() const;
+
+	// The world to eye matrix for the ship's camera, column-major
+	void getView(float *out) const;
+	const double *getPosition() const { return position; }
+
+private:
+	double orientation[4];       // w, x, y, z, turning ship space into world space
+	double position[3];
+	double angularVelocity[3];   // degrees per second about the ship's own axes
+	double speed;                // units per second along the nose
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "framescheduler.h"
+#include "glplatform.h"
+
+#include<string.h>
+
+#if defined(__APPLE_CC__)
+#include<OpenGL/OpenGL.h>
+#elif !defined(WIN32)
+#include<GL/glx.h>
+#endif
+
+// Weight of the newest frame in the smoothed times
+static const double SMOOTHING = 0.1;
+
+// Longest a frame's period is stretched to, in periods
+static const int MAX_STRETCH = 4;
+
+// Stretch when the work takes more than this much of the period, and come
+// back down once it would take less than this much of the shorter one
+static const double STRETCH_ABOVE = 0.95;
+static const double SHRINK_BELOW = 0.75;
+
+FrameScheduler::FrameScheduler(double periodMs, ScheduleMode mode)
+	: periodMs(periodMs), mode(mode), deadlineMs(-1), startMs(-1), lastRedrawMs(-1), workMs(0), intervalMs(0),
+	stretch(1), missed(0), skipped(0) {
+}
+
+static void smooth(double &average, double sample) {
+	average = average > 0 ? average + (sample - average) * SMOOTHING : sample;
+}
+
+double FrameScheduler::beginFrame(double nowMs, bool drawing) {
+	// what the last frame took, now that all of its redraws are in
+	if (startMs >= 0) {
+		if (lastRedrawMs >= startMs) {
+			smooth(workMs, lastRedrawMs - startMs);
+			// deadlineMs is when this frame was due
+			if (mode == SCHEDULE_DEADLINE && lastRedrawMs > deadlineMs)
+				missed++;
+		}
+		smooth(intervalMs, nowMs - startMs);
+	}
+	startMs = nowMs;
+	if (!drawing)
+		skipped++;
+
+	if (mode == SCHEDULE_DEADLINE && workMs > 0) {
+		if (workMs > periodMs * stretch * STRETCH_ABOVE && stretch < MAX_STRETCH)
+			stretch++;
+		else if (stretch > 1 && workMs < periodMs * (stretch - 1) * SHRINK_BELOW)
+			stretch--;
+	}
+
+	if (drawing && mode != SCHEDULE_DEADLINE) {
+		// the swap paces vsync frames, and nothing paces uncapped ones
+		deadlineMs = nowMs;
+		return nowMs;
+	}
+	double target = mode == SCHEDULE_DEADLINE ? getTargetMs() : periodMs;
+	if (deadlineMs < 0 || nowMs - deadlineMs > target)
+		deadlineMs = nowMs;
+	deadlineMs += target;
+	return deadlineMs;
+}
+
+void FrameScheduler::redrawn(double nowMs) {
+	lastRedrawMs = nowMs;
+}
+
+bool setSwapInterval(int interval) {
+#if defined(__APPLE_CC__)
+	GLint value = interval;
+	return CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &value) == kCGLNoError;
+#elif defined(WIN32)
+	typedef BOOL (WINAPI *SwapIntervalProc)(int);
+	SwapIntervalProc swapInterval = (SwapIntervalProc)wglGetProcAddress("wglSwapIntervalEXT");
+	return swapInterval && swapInterval(interval);
+#else
+	// glXGetProcAddress hands out a pointer for any name, so the extension
+	// list decides which of the three there is
+	Display *display = glXGetCurrentDisplay();
+	if (!display)
+		return false;
+	const char *extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+	if (!extensions)
+		return false;
+	if (strstr(extensions, "GLX_EXT_swap_control")) {
+		typedef void (*SwapIntervalProc)(Display *, GLXDrawable, int);
+		SwapIntervalProc swapInterval = (SwapIntervalProc)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalEXT");
+		swapInterval(display, glXGetCurrentDrawable(), interval);
+		return true;
+	}
+	if (strstr(extensions, "GLX_MESA_swap_control")) {
+		typedef int (*SwapIntervalProc)(unsigned int);
+		SwapIntervalProc swapInterval = (SwapIntervalProc)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalMESA");
+		return swapInterval(interval) == 0;
+	}
+	// GLX_SGI_swap_control can't turn the wait off
+	if (strstr(extensions, "GLX_SGI_swap_control") && interval > 0) {
+		typedef int (*SwapIntervalProc)(int);
+		SwapIntervalProc swapInterval = (SwapIntervalProc)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalSGI");
+		return swapInterval(interval) == 0;
+	}
+	return false;
+#endif
+}
@@ -0,0 +1,64 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+// How the windowed loop paces its frames
+enum ScheduleMode {
+	SCHEDULE_DEADLINE,   // frames start on a fixed grid of deadlines, period apart
+	SCHEDULE_VSYNC,      // the buffer swap waits for the display's refresh
+	SCHEDULE_UNCAPPED    // as fast as frames can be drawn, for measuring
+};
+
+// Decides when the next frame starts. Frames are due on deadlines a period
+// apart, counted from the last deadline rather than from when the frame's
+// work finished, so the time spent drawing doesn't stretch the period. The
+// time each frame actually takes is measured, from its start to the end of
+// its last redraw. If that keeps running past the period, frames are given
+// two, three or four periods each, so they land on a steady rate instead of
+// missing every other deadline. The period comes back down once the work
+// fits again.
+//
+// A frame that falls more than a period behind starts the grid again from
+// now instead of trying to catch up.
+class FrameScheduler {
+public:
+	FrameScheduler(double periodMs, ScheduleMode mode = SCHEDULE_DEADLINE);
+
+	void setMode(ScheduleMode mode) { this->mode = mode; }
+	ScheduleMode getMode() const { return mode; }
+	// the period asked for, before any stretching
+	void setPeriodMs(double period) { periodMs = period; }
+	double getPeriodMs() const { return periodMs; }
+
+	// A frame starts at nowMs. Returns when the next one should start, on the
+	// same clock. drawing is whether this frame redraws anything; with nothing
+	// drawn there is no swap to wait on, so vsync and uncapped frames wait a
+	// period instead of spinning.
+	double beginFrame(double nowMs, bool drawing);
+	// A redraw of the current frame finished now
+	void redrawn(double nowMs);
+
+	// Measured so far, smoothed over the last few frames: the time from the
+	// start of a frame to the end of its last redraw, and between frame starts
+	double getWorkMs() const { return workMs; }
+	double getIntervalMs() const { return intervalMs; }
+	// the period frames are being given now, a whole multiple of the period
+	double getTargetMs() const { return periodMs * stretch; }
+	// frames whose work ran past their deadline, and frames that drew nothing
+	int getMissed() const { return missed; }
+	int getSkipped() const { return skipped; }
+
+private:
+	double periodMs;
+	ScheduleMode mode;
+	double deadlineMs;     // when the current frame was due, -1 before the first
+	double startMs, lastRedrawMs;
+	double workMs, intervalMs;
+	int stretch;
+	int missed, skipped;
+};
+
+// Ask for buffer swaps of the current context to wait for interval display
+// refreshes, 0 for not at all. Returns false if the platform can't.
+bool setSwapInterval(int interval);
+
+#endif
@@ -0,0 +1,40 @@
+#include "frustum.h"
+
+#include<math.h>
+
+Frustum::Frustum() {
+	// until a projection is set everything is visible
+	for (int i = 0; i < 6; i++)
+		planes[i][0] = planes[i][1] = planes[i][2] = 0, planes[i][3] = 1;
+}
+
+void Frustum::setProjection(const float *p) {
+	// Gribb/Hartmann: each plane is the last row of the matrix plus or minus
+	// one of the others. Row r of a column-major matrix is p[r], p[4+r], ...
+	for (int i = 0; i < 6; i++) {
+		int row = i / 2;
+		float sign = (i % 2) ? -1.0f : 1.0f;
+		float length = 0;
+		for (int k = 0; k < 4; k++)
+			planes[i][k] = p[4*k + 3] + sign * p[4*k + row];
+		for (int k = 0; k < 3; k++)
+			length += planes[i][k] * planes[i][k];
+		length = sqrtf(length);
+		for (int k = 0; k < 4; k++)
+			planes[i][k] /= length;
+	}
+}
+
+bool Frustum::sphereVisible(const float center[3], float radius) const {
+	for (int i = 0; i < 6; i++) {
+		const float *p = planes[i];
+		if (p[0]*center[0] + p[1]*center[1] + p[2]*center[2] + p[3] < -radius)
+			return false;
+	}
+	return true;
+}
+
+bool Frustum::sphereVisibleAt(const float *modelview, float radius) const {
+	float scale = sqrtf(modelview[0]*modelview[0] + modelview[1]*modelview[1] + modelview[2]*modelview[2]);
+	return sphereVisible(modelview + 12, radius * scale);
+}
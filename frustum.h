@@ -0,0 +1,32 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+// The six planes of a view volume, in eye space, for testing bounding spheres
+// before anything is sent to GL. Because the planes are in eye space the
+// camera is already part of whatever modelview matrix an object is drawn
+// with, so the planes only change when the projection does.
+class Frustum {
+public:
+	Frustum();
+
+	// Take the planes from a column-major projection matrix
+	void setProjection(const float *projection);
+
+	// Is any of a sphere at the eye space point center inside the view volume?
+	bool sphereVisible(const float center[3], float radius) const;
+
+	// Same, for a sphere centered at the origin of modelview. radius is in
+	// modelview's units and is grown by its scale.
+	bool sphereVisibleAt(const float *modelview, float radius) const;
+
+private:
+	// a x + b y + c z + d >= 0 inside, with (a,b,c) unit length
+	float planes[6][4];
+};
+
+// How many objects passed and failed the frustum test for one view
+struct CullStats {
+	int drawn, culled;
+};
+
+#endif
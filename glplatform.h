@@ -0,0 +1,29 @@
+#ifndef GLPLATFORM_H
+#define GLPLATFORM_H
+
+// Platform specific OpenGL/GLUT includes, shared by every source file.
+// Buffer objects are GL 1.5, so on Windows the entry points come from GLEW.
+#if defined(__APPLE_CC__)
+#include<OpenGL/gl.h>
+#include<OpenGL/glu.h>
+#include<GLUT/glut.h>
+#elif defined(WIN32)
+#include<windows.h>
+#include<GL/glew.h>
+#include<GL/glu.h>
+#include<GL/glut.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include<GL/gl.h>
+#include<GL/glext.h>
+#include<GL/glu.h>
+#include<GL/glut.h>
+#include<stdint.h>
+#endif
+
+// freeglut can ask for a core profile context, which --core needs
+#if defined(FREEGLUT)
+#include<GL/freeglut_ext.h>
+#endif
+
+#endif
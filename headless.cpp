@@ -0,0 +1,178 @@
+#include "headless.h"
+
+#include<errno.h>
+#include<stdio.h>
+#include<string.h>
+#include<sys/stat.h>
+#include<vector>
+
+#if defined(_WIN32)
+#include<direct.h>
+#endif
+
+#if defined(__linux__)
+#include<EGL/egl.h>
+#include<EGL/eglext.h>
+#endif
+
+HeadlessContext::HeadlessContext() : display(0), context(0) {
+}
+
+#if defined(__linux__)
+
+bool HeadlessContext::create(bool coreProfile) {
+	// prefer the surfaceless platform, which needs neither X nor a GPU device
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy == EGL_NO_DISPLAY)
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major, minor;
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, &major, &minor)) {
+		fprintf(stderr, "headless: could not initialize EGL (error 0x%x)\n", eglGetError());
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "headless: EGL has no desktop OpenGL support\n");
+		eglTerminate(dpy);
+		return false;
+	}
+
+	// rendering only ever goes to framebuffer objects, so any config will do
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = 0;
+	EGLint numConfigs = 0;
+	eglChooseConfig(dpy, configAttribs, &config, 1, &numConfigs);
+
+	EGLint coreAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext ctx = eglCreateContext(dpy, numConfigs ? config : (EGLConfig)0, EGL_NO_CONTEXT,
+		coreProfile ? coreAttribs : NULL);
+	if (ctx == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+		fprintf(stderr, "headless: could not create a surfaceless context (error 0x%x)\n", eglGetError());
+		if (ctx != EGL_NO_CONTEXT)
+			eglDestroyContext(dpy, ctx);
+		eglTerminate(dpy);
+		return false;
+	}
+
+	display = dpy;
+	context = ctx;
+	return true;
+}
+
+void HeadlessContext::destroy() {
+	if (!display)
+		return;
+	eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+	eglTerminate((EGLDisplay)display);
+	display = 0;
+	context = 0;
+}
+
+#else
+
+bool HeadlessContext::create(bool coreProfile) {
+	fprintf(stderr, "headless: only supported on Linux (EGL)\n");
+	return false;
+}
+
+void HeadlessContext::destroy() {
+}
+
+#endif
+
+const char *HeadlessContext::renderer() const {
+	return (const char *)glGetString(GL_RENDERER);
+}
+
+bool createTarget(OffscreenTarget &target, int width, int height) {
+	target.width = width;
+	target.height = height;
+
+	glGenRenderbuffers(1, &target.color);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &target.depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "headless: framebuffer incomplete (0x%x)\n", status);
+		return false;
+	}
+	return true;
+}
+
+void bindTarget(const OffscreenTarget &target) {
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glViewport(0, 0, target.width, target.height);
+}
+
+bool writeTarget(const OffscreenTarget &target, const char *path) {
+	int rowSize = target.width * 3;
+	std::vector<unsigned char> pixels(rowSize * target.height);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, target.width, target.height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "headless: could not write %s\n", path);
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", target.width, target.height);
+	// GL rows go bottom to top, PPM rows go top to bottom
+	bool ok = true;
+	for (int y = target.height - 1; y >= 0 && ok; y--)
+		ok = fwrite(&pixels[y * rowSize], 1, rowSize, file) == (size_t)rowSize;
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		fprintf(stderr, "headless: could not write all of %s\n", path);
+	return ok;
+}
+
+bool makeOutputDirectory(const char *path) {
+#if defined(_WIN32)
+	int made = _mkdir(path);
+#else
+	int made = mkdir(path, 0777);
+#endif
+	if (made != 0 && errno != EEXIST) {
+		fprintf(stderr, "headless: could not create %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	struct stat info;
+	if (stat(path, &info) != 0 || !(info.st_mode & S_IFDIR)) {
+		fprintf(stderr, "headless: %s is not a directory\n", path);
+		return false;
+	}
+	return true;
+}
+
+void destroyTarget(OffscreenTarget &target) {
+	glDeleteFramebuffers(1, &target.fbo);
+	glDeleteRenderbuffers(1, &target.color);
+	glDeleteRenderbuffers(1, &target.depth);
+	target.fbo = target.color = target.depth = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "glplatform.h"
+
+// OpenGL context with no window or display behind it, for running on render
+// servers and in CI. On Linux this is an EGL surfaceless context, which Mesa
+// provides in software through llvmpipe when there is no GPU.
+class HeadlessContext {
+public:
+	HeadlessContext();
+
+	// Create the context and make it current. Returns false (and prints why)
+	// if no context could be made. coreProfile asks for a 3.3 core context
+	// instead of a compatibility one.
+	bool create(bool coreProfile = false);
+
+	// renderer string of the current context, for logs
+	const char *renderer() const;
+
+	void destroy();
+
+private:
+	void *display;
+	void *context;
+};
+
+// Color + depth framebuffer object to render a view into
+struct OffscreenTarget {
+	GLuint fbo, color, depth;
+	int width, height;
+};
+
+// Allocate the framebuffer. Returns false if it is incomplete.
+bool createTarget(OffscreenTarget &target, int width, int height);
+
+// Direct drawing into the target and set the viewport to cover it
+void bindTarget(const OffscreenTarget &target);
+
+// Write the target's color buffer to a binary PPM file. Returns false (and
+// prints why) if the file couldn't be written in full.
+bool writeTarget(const OffscreenTarget &target, const char *path);
+
+// Create the directory frames are written to, unless it is there already.
+// Returns false (and prints why) if it can't be made or isn't a directory.
+bool makeOutputDirectory(const char *path);
+
+void destroyTarget(OffscreenTarget &target);
+
+#endif
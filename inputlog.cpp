@@ -0,0 +1,155 @@
+#include "inputlog.h"
+
+#include<string.h>
+
+static const char MAGIC[4] = {'S', 'S', 'I', 'N'};
+static const unsigned char VERSION = 1;
+
+// frames written between flushes, about a second at 30 frames per second
+static const int FLUSH_FRAMES = 32;
+
+InputRecorder::InputRecorder() : file(NULL), frames(0) {
+}
+
+InputRecorder::~InputRecorder() {
+	close();
+}
+
+void InputRecorder::put(unsigned int value) {
+	while (value >= 0x80) {
+		buffer.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((unsigned char)value);
+}
+
+bool InputRecorder::open(const char *path, const std::vector<std::string> &options) {
+	close();
+	file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "record: could not write %s\n", path);
+		return false;
+	}
+	buffer.assign(MAGIC, MAGIC + 4);
+	buffer.push_back(VERSION);
+	put((unsigned int)options.size());
+	for (size_t i = 0; i < options.size(); i++) {
+		put((unsigned int)options[i].size());
+		buffer.insert(buffer.end(), options[i].begin(), options[i].end());
+	}
+	fwrite(&buffer[0], 1, buffer.size(), file);
+	buffer.clear();
+	keys.clear();
+	frames = 0;
+	return true;
+}
+
+void InputRecorder::key(unsigned char key) {
+	if (file)
+		keys.push_back(key);
+}
+
+void InputRecorder::endFrame(int steps, float alpha, unsigned int realMicros) {
+	if (!file)
+		return;
+	put((unsigned int)keys.size());
+	buffer.insert(buffer.end(), keys.begin(), keys.end());
+	put((unsigned int)steps);
+	unsigned int bits;
+	memcpy(&bits, &alpha, 4);
+	for (int i = 0; i < 4; i++)
+		buffer.push_back((unsigned char)(bits >> (8 * i)));
+	put(realMicros);
+	keys.clear();
+
+	fwrite(&buffer[0], 1, buffer.size(), file);
+	buffer.clear();
+	if (++frames % FLUSH_FRAMES == 0)
+		fflush(file);
+}
+
+void InputRecorder::close() {
+	if (file)
+		fclose(file);
+	file = NULL;
+}
+
+InputReplay::InputReplay() : position(0) {
+}
+
+// Reads a varint at pos, moving pos past it. Returns false if the data runs
+// out first.
+static bool readVarint(const std::vector<unsigned char> &data, size_t &pos, unsigned int &value) {
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (pos >= data.size())
+			return false;
+		unsigned char byte = data[pos++];
+		value |= (unsigned int)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool InputReplay::open(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "replay: could not read %s\n", path);
+		return false;
+	}
+	std::vector<unsigned char> data;
+	unsigned char chunk[65536];
+	size_t got;
+	while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data.insert(data.end(), chunk, chunk + got);
+	fclose(file);
+
+	if (data.size() < 5 || memcmp(&data[0], MAGIC, 4) != 0 || data[4] != VERSION) {
+		fprintf(stderr, "replay: %s is not an input log this version can read\n", path);
+		return false;
+	}
+	size_t pos = 5;
+	unsigned int count, length;
+	options.clear();
+	if (!readVarint(data, pos, count)) {
+		fprintf(stderr, "replay: %s is cut off in its header\n", path);
+		return false;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		if (!readVarint(data, pos, length) || pos + length > data.size()) {
+			fprintf(stderr, "replay: %s is cut off in its header\n", path);
+			return false;
+		}
+		options.push_back(std::string(data.begin() + pos, data.begin() + pos + length));
+		pos += length;
+	}
+
+	frames.clear();
+	position = 0;
+	while (pos < data.size()) {
+		InputFrame frame;
+		unsigned int keyCount, steps, bits = 0;
+		if (!readVarint(data, pos, keyCount) || pos + keyCount > data.size())
+			break;
+		frame.keys.assign(data.begin() + pos, data.begin() + pos + keyCount);
+		pos += keyCount;
+		if (!readVarint(data, pos, steps) || pos + 4 > data.size())
+			break;
+		for (int i = 0; i < 4; i++)
+			bits |= (unsigned int)data[pos++] << (8 * i);
+		memcpy(&frame.alpha, &bits, 4);
+		if (!readVarint(data, pos, frame.realMicros))
+			break;
+		frame.steps = (int)steps;
+		frames.push_back(frame);
+	}
+	return true;
+}
+
+bool InputReplay::next(InputFrame &frame) {
+	if (position >= (int)frames.size())
+		return false;
+	frame = frames[position++];
+	return true;
+}
@@ -0,0 +1,78 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include<stdio.h>
+#include<string>
+#include<vector>
+
+// Everything that happened in one frame, as far as the simulation is
+// concerned: the keys that take effect at its start, then how many fixed
+// steps it advanced and the interpolation fraction it was drawn at. A key's
+// tick is the number of steps in all the frames before it. realMicros is the
+// wall clock time since the previous frame, for replaying in real time.
+struct InputFrame {
+	std::vector<unsigned char> keys;
+	int steps;
+	float alpha;
+	unsigned int realMicros;
+};
+
+// Input log file format, all integers as unsigned LEB128 varints:
+//   "SSIN", version byte
+//   option count, then each option as length and bytes
+//   per frame: key count, the keys, steps, alpha (4 bytes, little endian
+//   IEEE float), real microseconds
+// A frame cut off at the end of the file, e.g. by a crash, is ignored.
+
+// Writes an input log as the program runs. Frames are written as they end
+// and flushed every so often, so most of a session survives a crash.
+class InputRecorder {
+public:
+	InputRecorder();
+	~InputRecorder();
+
+	// Start a log, storing the command line options the session needs to be
+	// reproduced. Returns false (and prints why) if the file can't be written.
+	bool open(const char *path, const std::vector<std::string> &options);
+	bool isOpen() const { return file != NULL; }
+
+	// A key that takes effect at the start of the frame being recorded
+	void key(unsigned char key);
+	// Finish the frame being recorded
+	void endFrame(int steps, float alpha, unsigned int realMicros);
+
+	void close();
+	int getFrames() const { return frames; }
+
+private:
+	void put(unsigned int value);
+
+	FILE *file;
+	std::vector<unsigned char> keys;
+	std::vector<unsigned char> buffer;
+	int frames;
+};
+
+// Reads a whole input log into memory and hands its frames back in order
+class InputReplay {
+public:
+	InputReplay();
+
+	// Returns false (and prints why) if the file is missing or isn't a log
+	bool open(const char *path);
+
+	const std::vector<std::string> &getOptions() const { return options; }
+	int getFrameCount() const { return (int)frames.size(); }
+
+	// Next frame, or false once every frame has been handed out
+	bool next(InputFrame &frame);
+	// frames handed out so far
+	int getPosition() const { return position; }
+
+private:
+	std::vector<std::string> options;
+	std::vector<InputFrame> frames;
+	int position;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "jobsystem.h"
+#include "profiler.h"
+
+#include<algorithm>
+#include<stdio.h>
+
+// Most ranges parallelFor splits into per thread; more than one, so a thread
+// that finishes early has something to take
+static const int RANGES_PER_THREAD = 4;
+
+// the calling thread's queue, -1 until an outside thread has been given one,
+// and the outside thread whose work it is doing
+static thread_local int threadQueue = -1;
+static thread_local int threadOwner = -1;
+
+JobSystem::JobSystem() : outsiders(0), queued(0), stopping(false), jobsRun(0), jobsStolen(0) {
+	for (int i = 0; i < OUTSIDE_QUEUES; i++)
+		queues.push_back(new Queue);
+}
+
+JobSystem::~JobSystem() {
+	stop();
+	for (int i = 0; i < OUTSIDE_QUEUES; i++)
+		delete queues[i];
+}
+
+void JobSystem::start(int threads) {
+	stop();
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	stopping = false;
+	for (int i = 1; i < threads; i++)
+		queues.push_back(new Queue);
+	for (int i = 1; i < threads; i++)
+		workers.push_back(std::thread([this, i]() { work(OUTSIDE_QUEUES + i - 1); }));
+}
+
+void JobSystem::stop() {
+	if (workers.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	for (size_t i = OUTSIDE_QUEUES; i < queues.size(); i++)
+		delete queues[i];
+	queues.resize(OUTSIDE_QUEUES);
+}
+
+int JobSystem::ownQueue() {
+	if (threadQueue < 0) {
+		threadQueue = std::min((int)outsiders++, OUTSIDE_QUEUES - 1);
+		threadOwner = threadQueue;
+	}
+	return threadQueue;
+}
+
+void JobSystem::push(const char *name, const std::function<void()> &run, std::atomic<int> &pending) {
+	Queue &own = *queues[ownQueue()];
+	{
+		std::lock_guard<std::mutex> lock(own.mutex);
+		Job job = {name, run, &pending, threadOwner};
+		own.jobs.push_back(job);
+	}
+	queued++;
+	// a worker checks queued with sleepMutex held before it sleeps, so taking
+	// it here means one can't miss this
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+void JobSystem::wait(std::atomic<int> &pending) {
+	ownQueue();
+	while (pending > 0) {
+		if (!runOne(threadOwner))
+			std::this_thread::yield();
+	}
+}
+
+bool JobSystem::take(Queue &queue, int owner, bool newest, Job &job) {
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	int count = (int)queue.jobs.size();
+	for (int k = 0; k < count; k++) {
+		int i = newest ? count - 1 - k : k;
+		if (owner >= 0 && queue.jobs[i].owner != owner)
+			continue;
+		job = queue.jobs[i];
+		queue.jobs.erase(queue.jobs.begin() + i);
+		return true;
+	}
+	return false;
+}
+
+bool JobSystem::runOne(int owner) {
+	int self = threadQueue, count = (int)queues.size();
+	Job job;
+	// the newest of its own
+	bool found = take(*queues[self], owner, true, job), stolen = false;
+	// or the oldest of someone else's, the biggest piece left there. An
+	// outside thread's own jobs are only ever on its queue or a worker's.
+	for (int i = 1; i < count && !found; i++) {
+		int other = (self + i) % count;
+		if (owner >= 0 && other < OUTSIDE_QUEUES)
+			continue;
+		found = stolen = take(*queues[other], owner, false, job);
+	}
+	if (!found)
+		return false;
+	queued--;
+
+	// jobs this one queues are part of the same outside thread's work
+	int previousOwner = threadOwner;
+	threadOwner = job.owner;
+	{
+		ProfileScope scope(job.name);
+		job.run();
+	}
+	threadOwner = previousOwner;
+	jobsRun++;
+	if (stolen)
+		jobsStolen++;
+	// the waiter may be gone as soon as this reaches 0
+	(*job.pending)--;
+	return true;
+}
+
+void JobSystem::work(int index) {
+	threadQueue = index;
+	char name[32];
+	snprintf(name, sizeof(name), "worker %d", index - OUTSIDE_QUEUES + 1);
+	profileThread(name);
+	for (;;) {
+		if (runOne(-1))
+			continue;
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() { return queued > 0 || stopping; });
+		if (stopping && queued == 0)
+			return;
+	}
+}
+
+void parallelFor(JobSystem *jobs, const char *name, int count, int grain, const std::function<void(int, int)> &body) {
+	grain = std::max(1, grain);
+	int threads = jobs ? jobs->getThreads() : 1;
+	if (threads == 1 || count <= grain) {
+		if (count > 0)
+			body(0, count);
+		return;
+	}
+	// whole grains per range, and no more ranges than are worth handing out
+	int grains = (count + grain - 1) / grain;
+	int ranges = std::min(grains, threads * RANGES_PER_THREAD);
+	int size = (grains + ranges - 1) / ranges * grain;
+	ranges = (count + size - 1) / size;
+
+	std::atomic<int> pending(ranges);
+	for (int r = 0; r < ranges; r++) {
+		int begin = r * size, end = std::min(count, begin + size);
+		jobs->push(name, [&body, begin, end]() { body(begin, end); }, pending);
+	}
+	jobs->wait(pending);
+}
+
+TaskGraph::TaskGraph(JobSystem *jobs) : jobs(jobs), pending(0) {
+}
+
+int TaskGraph::add(const char *name, const std::function<void()> &run, int after, int after2) {
+	int id = (int)tasks.size();
+	Task task = {name, run, std::vector<int>(), 0};
+	tasks.push_back(task);
+	int before[2] = {after, after2};
+	for (int k = 0; k < 2; k++) {
+		if (before[k] < 0 || (k == 1 && after2 == after))
+			continue;
+		tasks[before[k]].next.push_back(id);
+		tasks[id].after++;
+	}
+	return id;
+}
+
+void TaskGraph::run() {
+	if (!jobs || jobs->getThreads() == 1) {
+		// added after what they come after, so this order always works
+		for (size_t i = 0; i < tasks.size(); i++) {
+			ProfileScope scope(tasks[i].name);
+			tasks[i].run();
+		}
+		return;
+	}
+	std::vector<std::atomic<int> > counts(tasks.size());
+	waiting.swap(counts);
+	for (size_t i = 0; i < tasks.size(); i++)
+		waiting[i] = tasks[i].after;
+	pending = (int)tasks.size();
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks[i].after == 0)
+			queue((int)i);
+	}
+	jobs->wait(pending);
+}
+
+void TaskGraph::queue(int task) {
+	jobs->push(tasks[task].name, [this, task]() {
+		tasks[task].run();
+		// queued before this one counts as done, so pending can't reach 0
+		// while any are left
+		for (size_t i = 0; i < tasks[task].next.size(); i++) {
+			int next = tasks[task].next[i];
+			if (--waiting[next] == 0)
+				queue(next);
+		}
+	}, pending);
+}
@@ -0,0 +1,126 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include<atomic>
+#include<condition_variable>
+#include<deque>
+#include<functional>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+// A fixed pool of worker threads that run jobs, small pieces of a bigger
+// piece of work. Every worker has a queue of its own: jobs a worker queues go
+// on its queue, and it takes the newest one back first, while it is still
+// warm in its cache. A worker with nothing left takes the oldest job off
+// someone else's queue instead, so work spreads to whoever is free without a
+// single queue everyone waits on.
+//
+// Threads outside the pool, the drawing thread and the simulation thread,
+// each get a queue of their own the first time they queue a job. A job
+// belongs to the outside thread whose work it is part of, and so do the jobs
+// it queues in turn. While an outside thread waits it only helps with its own
+// jobs, wherever they have got to, so a frame never ends up running a
+// simulation step or the other way round.
+//
+// Every job is timed as a section of the profiler, under the name it was
+// queued with, on the track of the thread that ran it.
+class JobSystem {
+public:
+	JobSystem();
+	~JobSystem();
+
+	// Start threads-1 workers, the thread waiting on its jobs being the other
+	// one. 0 is one thread per core. Only one thread runs jobs until then.
+	void start(int threads);
+	// finish the queued jobs and join the workers
+	void stop();
+	int getThreads() const { return (int)workers.size() + 1; }
+
+	// Queue run, counting pending down once it has been run
+	void push(const char *name, const std::function<void()> &run, std::atomic<int> &pending);
+	// Run queued jobs of the caller's own until pending is down to 0
+	void wait(std::atomic<int> &pending);
+
+	// jobs run so far, and how many of them were taken off another thread's queue
+	int getJobsRun() const { return jobsRun; }
+	int getJobsStolen() const { return jobsStolen; }
+
+private:
+	struct Job {
+		const char *name;
+		std::function<void()> run;
+		std::atomic<int> *pending;
+		int owner;   // the outside thread's queue this job's work came from
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// Outside threads past the first few share the last of their queues
+	static const int OUTSIDE_QUEUES = 4;
+
+	// The calling thread's queue, giving it one if it is new
+	int ownQueue();
+	// Run one queued job, from the queue of the calling thread if it can, and
+	// only one belonging to owner unless it is -1. Returns false if there were
+	// none.
+	bool runOne(int owner);
+	// Take the newest or oldest job in queue belonging to owner, or any if -1
+	static bool take(Queue &queue, int owner, bool newest, Job &job);
+	void work(int index);
+
+	// the outside threads' queues, then a worker each
+	std::vector<Queue *> queues;
+	std::atomic<int> outsiders;
+	std::vector<std::thread> workers;
+	std::atomic<int> queued;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping;
+	std::atomic<int> jobsRun, jobsStolen;
+};
+
+// Splits [0, count) into ranges and calls body(begin, end) for each, on the
+// job system's threads and the calling one, returning once all are done.
+// Ranges are whole multiples of grain long, but for the last, so grain also
+// keeps them lined up for vector loops. Without a job system, or with no
+// more than grain to do, it is one call on the calling thread. body has to be
+// safe to run on several ranges at once.
+void parallelFor(JobSystem *jobs, const char *name, int count, int grain, const std::function<void(int, int)> &body);
+
+// The work of one frame as tasks, each run once the ones it comes after have
+// finished, on the job system's threads. Tasks can only come after tasks
+// added before them. Tasks that don't depend on each other may run at the
+// same time, and each may use parallelFor itself. Without a job system they
+// run one at a time in the order they were added.
+class TaskGraph {
+public:
+	explicit TaskGraph(JobSystem *jobs);
+
+	// Adds a task that runs after after and after2, ids returned by add() or
+	// -1 for none, and returns its id
+	int add(const char *name, const std::function<void()> &run, int after = -1, int after2 = -1);
+
+	// Runs every task and returns once all of them have
+	void run();
+
+private:
+	struct Task {
+		const char *name;
+		std::function<void()> run;
+		std::vector<int> next;   // the tasks that come after it
+		int after;               // how many it comes after
+	};
+
+	void queue(int task);
+
+	JobSystem *jobs;
+	std::vector<Task> tasks;
+	std::vector<std::atomic<int> > waiting;   // per task, while running
+	std::atomic<int> pending;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "lod.h"
+
+#include<math.h>
+
+static const float PI = 3.14159265358979f;
+
+float projectedRadius(float radius, const float *modelview, float pixelScale) {
+	float distance = sqrtf(modelview[12]*modelview[12] + modelview[13]*modelview[13] + modelview[14]*modelview[14]);
+	// the scale of the matrix grows the sphere as well
+	float scale = sqrtf(modelview[0]*modelview[0] + modelview[1]*modelview[1] + modelview[2]*modelview[2]);
+	radius *= scale;
+	// from inside the sphere it covers the whole view
+	if (distance <= radius)
+		return 1e9f;
+	return radius * pixelScale / distance;
+}
+
+LodChain::LodChain(const int *segments, int levels, float tolerancePixels) {
+	for (int i = 0; i < levels; i++) {
+		segmentCounts.push_back(segments[i]);
+		// a circle of radius r drawn with n segments is off by r(1 - cos(pi/n))
+		// at worst, so level i is needed once level i-1 is off by the tolerance
+		if (i == 0)
+			minPixels.push_back(0);
+		else
+			minPixels.push_back(tolerancePixels / (1 - cosf(PI / segments[i-1])));
+	}
+}
+
+int LodChain::levelFor(float pixels) const {
+	int level = 0;
+	while (level + 1 < levels() && pixels >= minPixels[level + 1])
+		level++;
+	return level;
+}
+
+int LodChain::select(float pixels, int previous) const {
+	if (previous < 0 || previous >= levels())
+		return levelFor(pixels);
+	int level = previous;
+	while (level + 1 < levels() && pixels >= minPixels[level + 1] * (1 + LOD_HYSTERESIS))
+		level++;
+	while (level > 0 && pixels < minPixels[level] * (1 - LOD_HYSTERESIS))
+		level--;
+	return level;
+}
@@ -0,0 +1,39 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include<vector>
+
+// Fraction past a switching point that the projected size has to go before
+// the level changes, so an object sitting right on a threshold doesn't flick
+// between two levels every frame
+static const float LOD_HYSTERESIS = 0.2f;
+
+// Radius in pixels of a sphere of the given radius centered at the origin of
+// modelview (a column-major matrix whose translation is the eye space
+// position). pixelScale is the number of pixels per unit at a distance of 1.
+float projectedRadius(float radius, const float *modelview, float pixelScale);
+
+// A chain of detail levels for a round mesh, coarsest first. Each level is a
+// segment count around the circumference. A level is used once the level
+// below it would be off by more than tolerancePixels at the silhouette, the
+// same rule the orbit rings use.
+class LodChain {
+public:
+	LodChain(const int *segments, int levels, float tolerancePixels = 0.5f);
+
+	int levels() const { return (int)segmentCounts.size(); }
+	int segments(int level) const { return segmentCounts[level]; }
+
+	// Level needed for a circle pixels in radius, ignoring history
+	int levelFor(float pixels) const;
+
+	// Level to use now, given the level used last frame (or -1 for none).
+	// It only moves once pixels is LOD_HYSTERESIS past a switching point.
+	int select(float pixels, int previous) const;
+
+private:
+	std::vector<int> segmentCounts;
+	std::vector<float> minPixels;   // smallest radius each level is used at
+};
+
+#endif
@@ -1,21 +1,38 @@
-#if defined(__APPLE_CC__)
-#include<OpenGL/gl.h>
-#include<OpenGL/glu.h>
-#include<GLUT/glut.h>
-#elif defined(WIN32)
-#include<windows.h>
-#include<GL/gl.h>
-#include<GL/glu.h>
-#include<GL/glut.h>
-#else
-#include<GL/gl.h>
-#include<GL/glu.h>
-#include<GL/glut.h>
-#include<stdint.h>
-#endif
+#include "glplatform.h"
+#include "meshcache.h"
+#include "orbitrings.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "matrix.h"
+#include "simclock.h"
+#include "bodystore.h"
+#include "belt.h"
+#include "lod.h"
+#include "frustum.h"
+#include "scenegraph.h"
+#include "nbody.h"
+#include "ephemeris.h"
+#include "inputlog.h"
+#include "scenefile.h"
+#include "snapshot.h"
+#include "corerenderer.h"
+#include "renderqueue.h"
+#include "profiler.h"
+#include "framescheduler.h"
+#include "simthread.h"
+#include "jobsystem.h"
+#include "flight.h"
 
 #include<iostream>
 #include<stdlib.h>
+#include<math.h>
+#include<stdio.h>
+#include<string.h>
+#include<algorithm>
+#include<vector>
+#include<string>
+#include<thread>
+#include<chrono>
 
 void incrementLookatVar(int x);
 void decrementLookatVar(int x);
@@ -23,20 +40,71 @@ void lookAtMovement(int current_window);
 void relativeMovement(int current_window);
 void drawShip();
 bool invert_pose( float *m );
-void drawCannon();
-void drawWing();
+void drawCannon(int slices);
+void drawWing(int slices);
 void drawShip(int slices);
-void relChange();
 void loadDefault(int current_window);
-void drawPlanet(int planetIndex, float colorR, float colorG, float colorB, float colorA);
+void drawPlanet(int planetIndex);
+void eyeOffset(int planetIndex, float *out);
 void drawSolarSystem();
-void drawSun();
-void drawEarth();
-void drawSaturn();
-void drawPluto();
-void rotateInSpace(int arrayIndex);
+void cullSolarSystem();
+void drawOrbitRings(int parent);
+void initBodies();
+void initScene(int count);
+void initGravity();
+void initEphemeris();
+void reportGravity();
+void updateScene(SceneGraph &graph);
 void geoSyncLock(int current_window);
+void geoSyncOrbit(int planetIndex, float distance, float *saved);
 void resetGeoSyncVars();
+void initView(int window, int width, int height);
+void releaseView(int window);
+void renderView(int current_window, int width, int height);
+void renderViewports(int width, int height);
+void viewportGrid(int count, int &columns, int &rows);
+void useResources(int slot);
+void setProjection(int width, int height);
+void drawShipView(int current_window);
+void drawOverview(int view);
+bool advanceSimulation(double realSeconds, bool oneStep = false);
+void stepSimulation(int steps, float alpha);
+int runClock(double realSeconds, bool oneStep, float &alpha);
+bool takeSimulationFrame(double realSeconds);
+bool flyShips(double seconds);
+void simulationTick();
+void startSimThread();
+void stopSimThread();
+void reportJobs();
+void applyKey(unsigned char key);
+void waitForReplay(unsigned int realMicros);
+void captureSnapshot(Snapshot &snapshot);
+bool restoreSnapshot(const Snapshot &snapshot);
+void saveSnapshot();
+bool loadSnapshot(const char *path);
+void reportSnapshots();
+void writeProfile();
+void setSwapIntervals();
+std::vector<std::string> sessionOptions(int argc, char **argv);
+int runHeadless();
+int runBenchmark();
+void parseOptions(int argc, char **argv);
+void drawSphere(float radius, int slices, int stacks);
+void drawDisk(float inner, float outer, int slices, int loops);
+void drawCylinder(float base, float top, float height, int slices, int stacks);
+void drawCube(float size);
+void setColor(float r, float g, float b, float a);
+void setLighting(bool on);
+void drawBelt();
+void drawBody(int index);
+int shipSlices(int ship);
+bool countCulling(bool visible);
+bool inView(float radius);
+bool inView(const float center[3], float radius);
+void initOrbitRings(OrbitRings &set);
+void orbitBasis(int body, float *basis);
+float orbitEccentricity(int body);
+float randomUnit(unsigned int &seed);
 
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
@@ -44,9 +112,13 @@ void resetGeoSyncVars();
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
 
-// time increment between calls to idle() in ms,
-// currently set to 30 FPS
-float dt = 1000.0f*1.0f/30.0f;
+// Paces the calls to idle() in a window. --schedule deadline (the default)
+// starts frames on a fixed grid, 1000/--fps ms apart (30 FPS unless set),
+// however long each takes to draw; vsync leaves it to the buffer swap and
+// uncapped draws as fast as it can. Each window is only drawn again when its
+// view can have changed since it was last drawn.
+FrameScheduler scheduler(1000.0/30);
+bool needsRedraw[2] = {true, true};
 
 // flag to indicate that we should clean up and exit
 bool quit = false;
@@ -58,14 +130,66 @@ bool onMotherShip = true;
 // display width and height
 int disp_width=512, disp_height=512;
 
+// --headless renders both ship views offscreen, without GLUT, for
+// headlessFrames frames. If frameDirectory is set (--output DIR) every frame
+// is written there as falco_NNNNN.ppm and peppy_NNNNN.ppm.
+bool headless = false;
+int headlessFrames = 300;
+const char *frameDirectory = NULL;
+
+// --benchmark runs a scripted session through every camera mode headless,
+// timing each phase of the frame. --json FILE also writes the results as JSON.
+bool benchmark = false;
+const char *benchmarkJson = NULL;
+
+// --bench-matrix checks and times the matrix kernels, with no GL at all
+bool matrixBenchmark = false;
+
+// --scene FILE loads the bodies from a scene file, text or compiled, instead
+// of solarsystem.scene. --compile-scene OUT writes the scene in its compiled
+// form, which is mapped into memory and used in place when loaded.
+const char *scenePath = "solarsystem.scene";
+const char *compiledScenePath = NULL;
+SceneFile sceneFile;
+
+// --bench-scene N times loading a scene of N rocks as text and compiled
+int sceneBenchmarkCount = 0;
+
+// --belt N adds an asteroid belt of N random rocks where the scene says,
+// between Mars and Jupiter in the solar system
+int beltCount = 0;
+
+// --bench-bodies N times the body store update for N bodies, also with no GL
+int bodyBenchmarkCount = 0;
+
+// --bench-nbody N times the gravity integrator on N particles. --steps,
+// --theta, --dt and --threads tune it; --theta also applies to --nbody, whose
+// force walk runs on the job threads.
+int nbodyBenchmarkCount = 0;
+int nbodySteps = 10;
+float nbodyTheta = 0.5f;
+float nbodyDt = 0.01f;
+int nbodyThreads = 0;
+
+// --bench-kepler N checks and times the ephemeris on N random orbits
+int keplerBenchmarkCount = 0;
+
+// --viewports N draws every view into one window (or one offscreen target)
+// in a single pass instead of one window per ship: a grid of N viewports, 2
+// to 16, Falco's and Peppy's first and overview cameras after them. 0 keeps
+// the two windows. Headless frames are written as views_NNNNN.ppm.
+const int MAX_VIEWS = 16;
+int viewportCount = 0;
+
 // 16 slot arrays, which are how openGL represents matrices
-// falcoLast and peppyLast are for relative mode, and the geosync
-// matrices are for geosync mode. Separated for clarity in code.
+// The geosync matrices are for geosync mode. Separated for clarity in code.
 float lastShip[16];
-float falcoLast[16];
-float peppyLast[16];
-float geosyncTargetFalco[16];
-float geosyncTargetPeppy[16];
+// world pose of each ship as of the last time its camera was set up, 0 for
+// Falco and 1 for Peppy, for the overview viewports to draw them at
+float shipPoses[2][16];
+// Falco's and Peppy's ships in relative mode, flown on by the real time each
+// frame covers. Both keep going once the keys have moved to the other ship.
+ShipFlight flights[2];
 float geoSyncFalco[16];
 float geoSyncPeppy[16];
 
@@ -76,23 +200,98 @@ bool isPaused = false;
 // to reset the default view.
 bool hasModeChanged = true;
 int modeChangedCounter = 0;
-// Planet numbers stored in a 2d-array
-// first column is rotation in degrees
-// second column is amount to increment during orbit
-// third column is size of planet
-float planets[10][3] =
-{
-	{0,1,0.7},   // Sun
-	{0,1.2,0.18},   // Mercury
-	{0,1.1,0.25},   // Venus
-	{0,1,0.25},   // Earth
-	{0,1.7,0.22},   // Mars
-	{0,1.3,0.45},   // Jupiter
-	{0,1.4,0.23},   // Saturn
-	{0,1.3,0.24},   // Uranus
-	{0,1.0,0.22},   // Neptune
-	{0,0.78,0.13}    // Pluto
-};
+// Every body, in the scene file's order: the rocks are last, after the ones
+// --belt adds. The number keys pick bodies 1 to 9 in geosync mode, which are
+// the planets in the solar system. The constants of a compiled scene are its
+// mapped file's.
+BodyStore bodies;
+
+// Where every body is, as a hierarchy: each body's node is its position on its
+// orbit around its parent, and its spin node turns it about its own axis.
+// Moons hang off their planet's node. The world matrices are worked out once
+// per step, in the copy of the graph in the frame being published, and both
+// views and the geosync cameras read them from the frame being shown (see
+// simFrames); this one is the layout the copies start from. The belt isn't in
+// the graph; it is drawn in its parent's space as a whole.
+SceneGraph scene;
+std::vector<int> bodyNodes;
+std::vector<int> spinNodes;
+
+// --nbody moves the sun, the planets and the belt by their gravity on each
+// other instead of round fixed circles: every body at the center of the scene
+// and everything orbiting one directly. Moons stay on their circles around
+// their planet: at this scale the moon is far further out than earth's
+// gravity could hold it. bodyParticles is each body's particle, or -1.
+bool nbodyMode = false;
+NBodySystem gravity;
+std::vector<int> bodyParticles;
+double gravityStartEnergy = 0;
+
+// --kepler puts every body on an elliptical orbit worked out from its orbital
+// elements at the current time, instead of stepping round circles. Nothing
+// accumulates from step to step, so time can jump for free: 't' and 'T' go
+// ten years forward and back, and --seek Y starts Y years in. bodyOrbits is
+// each body's orbit in the ephemeris, or -1 for the sun.
+bool keplerMode = false;
+Ephemeris ephemeris;
+std::vector<int> bodyOrbits;
+double ephemerisTime = 0;     // in simulation steps
+const double EARTH_YEAR = 360;
+
+// --record FILE writes an input log: every key, stamped with the frame it
+// took effect in, and how many steps each frame moved the simulation.
+// --replay FILE feeds one back, each key landing on the tick it was recorded
+// at, which reproduces the session exactly. Headless replays run as fast as
+// they can unless --realtime keeps them to the recorded pace; in a window the
+// replay hands over to the keyboard once the log runs out. Keys from GLUT
+// are queued and applied at the start of the next frame for the same reason.
+const char *recordPath = NULL;
+const char *replayPath = NULL;
+bool replayRealtime = false;
+bool replaying = false;
+InputRecorder inputRecorder;
+InputReplay inputReplay;
+std::vector<unsigned char> pendingKeys;
+double replayDueMs = -1;      // wall clock time the next frame is due at
+
+// 'o' saves a snapshot of the whole session, simulation and cameras, to
+// snapshotPath (--snapshot FILE, session.snapshot by default) and 'O' goes
+// back to it. The frame that saves only copies the state; the file is written
+// on a thread of its own. --restore FILE starts the session from a snapshot.
+// A snapshot only fits the scene and modes (--belt, --nbody, --kepler) it was
+// taken with.
+const char *snapshotPath = "session.snapshot";
+const char *restorePath = NULL;
+SnapshotWriter snapshotWriter;
+
+// Orbits move one step every 1/30th of a simulated second, which is the speed
+// they always moved at with a 30 FPS timer. A frame never counts for more
+// than a quarter second of real time, so falling behind can't snowball.
+SimClock simClock(1.0/30.0, 0.25);
+
+// wall clock time of the previous call to idle(), in ms
+double lastIdleTime = -1;
+// blend between steps the last frame was drawn with, to tell if anything moved
+float lastAlpha = -1;
+
+// The simulation hands what there is to draw to the renderer in simFrames:
+// stepSimulation fills in a frame and publishes it, and each frame is drawn
+// from the newest one, shownFrame, without waiting for anything. In a window
+// the simulation steps on simThread by its own clock, ticking twice a frame
+// period, so a slow step doesn't hold up drawing and a slow draw doesn't hold
+// up the orbits. Keys are still applied on the GLUT thread, with the
+// simulation thread held between ticks. A recording or replay needs each
+// frame's steps to line up with its keys, so it steps in idle() as before, and
+// so do headless runs unless --sim-thread is given; --no-sim-thread does the
+// same in a window.
+SimFrames simFrames;
+const SimFrame *shownFrame = NULL;
+int shownSequence = 0;
+SimThread simThread;
+int simThreadOption = -1;     // 1 for --sim-thread, 0 for --no-sim-thread
+double lastTickMs = -1;       // wall clock time of the thread's last tick
+float lastTickAlpha = -1;
+bool keysApplied = false;     // keys may have changed the simulation since
 
 
 // Absolute look-at variables
@@ -119,12 +318,6 @@ float absoluteVars[9][5] =
 // Relative mode variables
 // yaw, pitch, roll, forward/backward, increase/decrease speed
 float relativeVars[5] = {2.0f, 2.0f, 2.0f, 0.1f, 0.1f};
-// Flag is true when a change in a relative variable is requested with a keypress
-bool relativeFlag = false;
-// relVal determines which relative variable to increment
-int relVal = 0;
-// Determines whether we are incrementing or decrementing the variable
-int upOrDown = 0;
 // Set to true when we enter relative mode
 bool inRelativeMode = false;
 
@@ -144,6 +337,100 @@ float geoSyncSpeed = 0.1;
 // if the other ship also starts orbitting.
 bool otherShipOrbiting = false;
 
+// The modelview matrix stack. All transforms are built here on the CPU and GL
+// only ever gets the final matrix of each draw, so there are no readbacks.
+MatrixStack modelview;
+
+// Tessellated geometry, one cache per window since each window has its own
+// GL context. meshes points at the cache of the window being drawn. With
+// --viewports every view shares the first.
+MeshCache meshCaches[2];
+MeshCache *meshes = &meshCaches[0];
+
+// Orbit rings, one set per window like the meshes. The rings of the bodies
+// orbiting a body are together, ringFirst[body] to ringLast[body], so they go
+// out in one draw in that body's space; a body with none has ringFirst past
+// ringLast. ringVisible is scratch space for culling them.
+OrbitRings orbitRingSets[2];
+OrbitRings *rings = &orbitRingSets[0];
+std::vector<int> ringFirst, ringLast;
+std::vector<unsigned char> ringVisible;
+
+// The asteroid belt's bodies are the last ones in the body store. Each
+// window draws them with its own instancing renderer.
+AsteroidBelt belt;
+BeltRenderer beltRenderers[2];
+BeltRenderer *beltRenderer = &beltRenderers[0];
+
+// --core draws through an OpenGL 3.3 core profile context instead of the
+// fixed function pipeline: shaders do the lighting, the projection goes in a
+// uniform buffer once per view and meshes are drawn from vertex array objects.
+// Each window has its own renderer holding the program and that state.
+bool coreProfile = false;
+CoreRenderer coreRenderers[2];
+CoreRenderer *coreRenderer = &coreRenderers[0];
+
+// Every draw goes into the render queue of the window being drawn, which
+// sorts and merges them and makes the GL calls at the end of each view
+RenderQueue renderQueues[2];
+RenderQueue *queue = &renderQueues[0];
+
+// Times the sections of every frame on the CPU, and on the GPU with each
+// context's timer queries, keeping the last few seconds in memory. It runs
+// all the time in a window; headless only with --profile FILE. 'h' shows the
+// last 120 frames as a graph in each window and 'H' writes what is kept as a
+// Chrome trace to profilePath, as does quitting with --profile.
+Profiler profiler;
+GpuTimer gpuTimers[2];
+ProfileGraph profileGraphs[2];
+const char *profilePath = NULL;
+bool showProfileGraph = false;
+
+// Detail levels for the planets and for the ship's round parts, picked from
+// how big they are on screen. Each view remembers the level it used last for
+// every object, so a level only changes once the size is well past the point
+// where it switches.
+const int sphereSegments[] = {6, 10, 16, 24, 32, 48, 64};
+const int shipSegments[] = {8, 12, 16, 24, 32, 48, 64, 100};
+LodChain sphereLod(sphereSegments, 7);
+LodChain shipLod(shipSegments, 8);
+std::vector<int> bodyLevels[MAX_VIEWS];
+int shipLevels[MAX_VIEWS][2];
+int lodView = 0;
+// radius of the ship's hull, which is what its slices have to keep round
+const float SHIP_RADIUS = 0.07f;
+// radius of a sphere around the whole ship, wings and cannons included
+const float SHIP_BOUNDS = 0.5f;
+
+// View volume of the view being drawn, in eye space, so that objects can be
+// tested at whatever modelview matrix they are drawn with. Each view counts
+// what passed and failed the test; 'k' shows the counts in the window titles.
+Frustum frustum;
+CullStats cullStats[MAX_VIEWS];
+bool showCullStats = false;
+
+// What drawing the solar system needs to know about each body in the view
+// being drawn, worked out for all of them at once before anything is drawn:
+// its modelview matrix, turned with it, whether it is in view, and the
+// modelview matrix its rings are drawn with. The rings' flags go in
+// ringVisible and the detail levels in bodyLevels.
+std::vector<float> bodyModelviews;
+std::vector<unsigned char> bodyVisible;
+std::vector<float> ringModelviews;
+
+// Camera position in world space for the window being drawn, and the number
+// of pixels per unit at a distance of 1 from it. Used to pick ring detail.
+float eyePosition[3] = {0,0,0};
+float pixelScale = 1;
+
+// Worker threads for the work that splits up: stepping the bodies, placing
+// them in the scene graph, the belt, culling and filling the render queue's
+// instances. --jobs N uses N threads in all, counting the one handing out the
+// work; the default is one per core. The results are the same however many
+// there are.
+JobSystem jobs;
+int jobThreads = 0;
+
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
 /// Initialization/Setup and Teardown ////////////////////////////
@@ -153,35 +440,144 @@ bool otherShipOrbiting = false;
 // set up opengl state, allocate objects, etc.  This gets called
 // ONCE PER WINDOW, so don't allocate your objects twice!
 void init(){
+	initView( glutGetWindow(), glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT) );
+}
+
+// Sets up the GL state and objects for one ship's view in the current context.
+// window is 1 for the mothership and 2 for the scout ship.
+void initView( int window, int width, int height ){
 	/////////////////////////////////////////////////////////////
 	/// TODO: Put your initialization code here! ////////////////
 	/////////////////////////////////////////////////////////////
 	glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
 
-	glViewport( 0, 0, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT) );
+	glViewport( 0, 0, width, height );
 	glEnable( GL_DEPTH_TEST );
-	glEnable( GL_NORMALIZE );
 
 	// lighting stuff
 	GLfloat ambient[] = {0.0, 0.0, 0.0, 1.0};
 	GLfloat diffuse[] = {0.9, 0.9, 0.9, 1.0};
 	GLfloat specular[] = {0.4, 0.4, 0.4, 1.0};
 	GLfloat position0[] = {1.0, 1.0, 1.0, 0.0};
-	glLightfv( GL_LIGHT0, GL_POSITION, position0 );
-	glLightfv( GL_LIGHT0, GL_AMBIENT, ambient );
-	glLightfv( GL_LIGHT0, GL_DIFFUSE, diffuse );
-	glLightfv( GL_LIGHT0, GL_SPECULAR, specular );
 	GLfloat position1[] = {-1.0, -1.0, -1.0, 0.0};
-	glLightfv( GL_LIGHT1, GL_POSITION, position1 );
-	glLightfv( GL_LIGHT1, GL_AMBIENT, ambient );
-	glLightfv( GL_LIGHT1, GL_DIFFUSE, diffuse );
-	glLightfv( GL_LIGHT1, GL_SPECULAR, specular );
+	// GL's default global ambient, which the shaders have to be told about
+	GLfloat sceneAmbient[] = {0.2, 0.2, 0.2, 1.0};
+
+#if defined(WIN32)
+	glewInit();
+#endif
+
+	coreRenderer = &coreRenderers[window-1];
+	if (coreProfile) {
+		// the color material has no specular, so only the diffuse matters
+		if (!coreRenderer->init())
+			exit(1);
+		coreRenderer->setLights(position0, position1, diffuse, sceneAmbient);
+	}
+	else {
+		glEnable( GL_NORMALIZE );
+		glLightfv( GL_LIGHT0, GL_POSITION, position0 );
+		glLightfv( GL_LIGHT0, GL_AMBIENT, ambient );
+		glLightfv( GL_LIGHT0, GL_DIFFUSE, diffuse );
+		glLightfv( GL_LIGHT0, GL_SPECULAR, specular );
+		glLightfv( GL_LIGHT1, GL_POSITION, position1 );
+		glLightfv( GL_LIGHT1, GL_AMBIENT, ambient );
+		glLightfv( GL_LIGHT1, GL_DIFFUSE, diffuse );
+		glLightfv( GL_LIGHT1, GL_SPECULAR, specular );
+		glLightModelfv( GL_LIGHT_MODEL_AMBIENT, sceneAmbient );
+
+		glEnable( GL_LIGHTING );
+		glEnable( GL_LIGHT0 );
+		glEnable( GL_LIGHT1 );
+		glEnable( GL_COLOR_MATERIAL );
+	}
+
+	// build all of the geometry up front so nothing is tessellated while drawing
+	meshes = &meshCaches[window-1];
+	meshes->setVertexArrays(coreProfile);
+	for (int level = 0; level < sphereLod.levels(); level++)
+		meshes->sphere(sphereLod.segments(level), sphereLod.segments(level) / 2);
+	const float *diskInner = sceneFile.floats(SCENE_DISK_INNER), *diskOuter = sceneFile.floats(SCENE_DISK_OUTER);
+	for (int i = 0; i < sceneFile.getFirstRock(); i++) {
+		if (!(sceneFile.ints(SCENE_FLAGS)[i] & SCENE_HAS_DISK))
+			continue;
+		for (int segments = RING_MIN_SEGMENTS; segments <= RING_MAX_SEGMENTS; segments *= 2)
+			meshes->disk(diskInner[i], diskOuter[i], segments, 1);
+	}
+	for (int level = 0; level < shipLod.levels(); level++) {
+		int slices = shipLod.segments(level);
+		meshes->cylinder(0.7, 0.3, 1.0, slices, 5);
+		meshes->cylinder(0.3, 0, 0.4, slices, 5);
+		meshes->cylinder(0.1, 0.1, 1.2, std::min(slices, 10), 5);
+		meshes->cylinder(0.05, 0.05, 2.4, std::min(slices, 10), 5);
+	}
+	meshes->cube();
+	meshes->octahedron();
+
+	rings = &orbitRingSets[window-1];
+	initOrbitRings(*rings);
+
+	beltRenderer = &beltRenderers[window-1];
+	if (belt.getCount() > 0)
+		beltRenderer->init(coreProfile);
+
+	queue = &renderQueues[window-1];
+	queue->init(coreProfile ? coreRenderer : NULL);
 
-	glEnable( GL_LIGHTING );
-	glEnable( GL_LIGHT0 );
-	glEnable( GL_LIGHT1 );
-	glEnable( GL_COLOR_MATERIAL );
+	gpuTimers[window-1].init();
+	profileGraphs[window-1].init(coreProfile ? coreRenderer : NULL);
+}
+
+// Adds the orbit ring of every scene body that has one to a ring set, grouped
+// by parent, and uploads it. The solar system's rings sit halfway across the
+// old 0.04 wide orbit disks.
+void initOrbitRings(OrbitRings &set) {
+	int count = sceneFile.getFirstRock();
+	const int *flags = sceneFile.ints(SCENE_FLAGS);
+	const float *inset = sceneFile.floats(SCENE_RING_INSET);
+	std::vector<std::vector<int> > children(count);
+	for (int i = 0; i < count; i++)
+		if ((flags[i] & SCENE_HAS_RING) && bodies.parent[i] >= 0)
+			children[bodies.parent[i]].push_back(i);
+
+	// gluDisk draws in the xy plane, the orbits were drawn rotated 90 degrees
+	// about x, then tilted by the body's inclination about (1,1,1). Each ring
+	// sits just inside its body's orbit.
+	ringFirst.assign(count, 0);
+	ringLast.assign(count, -1);
+	float basis[9];
+	for (int parent = 0; parent < count; parent++) {
+		ringFirst[parent] = set.count();
+		for (size_t c = 0; c < children[parent].size(); c++) {
+			int i = children[parent][c];
+			orbitBasis(i, basis);
+			set.add(bodies.orbitRadius[i] - inset[i], basis, orbitEccentricity(i));
+		}
+		ringLast[parent] = set.count() - 1;
+	}
+	ringVisible.assign(set.count(), 0);
+	set.build(coreProfile);
+}
 
+// Rotation taking a ring in the xy plane into the plane of a body's orbit, as
+// a column-major 3x3 matrix. Ellipses put their near end along y.
+void orbitBasis(int body, float *basis) {
+	if (keplerMode) {
+		ephemeris.orbitBasis(bodyOrbits[body], basis);
+		return;
+	}
+	float flat[16], tilt[16];
+	mat4Rotation(90, 1, 0, 0, flat);
+	mat4Rotation(bodies.inclination[body], 1, 1, 1, tilt);
+	mat4Multiply(tilt, flat, flat);
+	for (int c = 0; c < 3; c++)
+		for (int r = 0; r < 3; r++)
+			basis[c*3 + r] = flat[c*4 + r];
+}
+
+// How far a body's orbit is from a circle
+float orbitEccentricity(int body) {
+	return keplerMode ? ephemeris.getElements(bodyOrbits[body]).eccentricity : 0;
 }
 
 // free any allocated objects and return
@@ -189,6 +585,32 @@ void cleanup(){
 	/////////////////////////////////////////////////////////////
 	/// TODO: Put your teardown code here! //////////////////////
 	/////////////////////////////////////////////////////////////
+	stopSimThread();
+	reportJobs();
+	inputRecorder.close();
+	snapshotWriter.wait();
+	reportSnapshots();
+	if (profilePath)
+		writeProfile();
+	std::cout << "scheduler: " << scheduler.getMissed() << " frames missed their deadline, "
+		<< scheduler.getSkipped() << " had nothing to redraw" << std::endl;
+	glutSetWindow( mother_window );
+	releaseView( mother_window );
+	if (viewportCount > 0)
+		return;
+	glutSetWindow( scout_window );
+	releaseView( scout_window );
+}
+
+// frees the objects initView() made for a view. Its context must be current.
+void releaseView( int window ){
+	meshCaches[window-1].release();
+	orbitRingSets[window-1].release();
+	beltRenderers[window-1].release();
+	coreRenderers[window-1].release();
+	renderQueues[window-1].release();
+	gpuTimers[window-1].release();
+	profileGraphs[window-1].release();
 }
 
 
@@ -209,8 +631,18 @@ void resize_callback( int width, int height ){
 	glViewport(0,0,width,height);
 }
 
-// keyboard callback
+// keyboard callback. Keys are queued for the next frame to apply; while a
+// replay is running only escape gets through, and it quits straight away.
 void keyboard_callback( unsigned char key, int x, int y ){
+	if (!replaying)
+		pendingKeys.push_back(key);
+	else if (key == 27)
+		quit = true;
+}
+
+// Acts on one key. Everything a key can change goes through here, at the
+// start of a frame, so a log of keys and frames is the whole of the input.
+void applyKey( unsigned char key ){
 	switch( key ){
 	case 27:
 		quit = true;
@@ -218,11 +650,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'x':
 		if (inLookatMode)
 			incrementLookatVar(0);
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 2;
-			upOrDown = 0;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(0, -relativeVars[2]);
 		break;
 	case 'X':
 		if (inLookatMode)
@@ -247,11 +676,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'a':
 		if (inLookatMode)
 			incrementLookatVar(3);
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 1;
-			upOrDown = 0;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(2, -relativeVars[1]);
 		break;
 	case 'A':
 		if (inLookatMode)
@@ -268,11 +694,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'c':
 		if (inLookatMode)
 			incrementLookatVar(5);
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 2;
-			upOrDown = 1;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(0, relativeVars[2]);
 		break;
 	case 'C':
 		if (inLookatMode)
@@ -281,11 +704,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'd':
 		if (inLookatMode)
 			incrementLookatVar(6);
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 1;
-			upOrDown = 1;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(2, relativeVars[1]);
 		break;
 	case 'D':
 		if (inLookatMode)
@@ -294,11 +714,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'e':
 		if (inLookatMode)
 			incrementLookatVar(7);
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 0;
-			upOrDown = 1;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(1, relativeVars[0]);
 		break;
 	case 'E':
 		if (inLookatMode)
@@ -341,11 +758,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 		}
 		break;
 	case 'w':
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 3;
-			upOrDown = 0;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].thrust(relativeVars[3]);
 		if (inGeosyncMode) {
 			if (onMotherShip)
 				geoSyncDistanceFalco += geoSyncSpeed;
@@ -358,11 +772,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 		}
 		break;
 	case 's':
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 3;
-			upOrDown = 1;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].thrust(-relativeVars[3]);
 		if (inGeosyncMode)
 			if (onMotherShip)
 				geoSyncDistanceFalco -= geoSyncSpeed;
@@ -370,11 +781,8 @@ void keyboard_callback( unsigned char key, int x, int y ){
 				geoSyncDistancePeppy -= geoSyncSpeed;
 		break;
 	case 'q':
-		if (inRelativeMode) {
-			relativeFlag = true;
-			relVal = 0;
-			upOrDown = 0;
-		}
+		if (inRelativeMode)
+			flights[onMotherShip ? 0 : 1].turn(1, -relativeVars[0]);
 		break;
 	case 'g':
 		if (!inGeosyncMode) {
@@ -503,6 +911,50 @@ void keyboard_callback( unsigned char key, int x, int y ){
 	case 'p':
 		isPaused = true;
 		break;
+	case 'k':
+		// show or hide how many objects each view draws and culls
+		showCullStats = !showCullStats;
+		if (!showCullStats && !headless && !benchmark) {
+			glutSetWindow(mother_window);
+			glutSetWindowTitle(viewportCount > 0 ? "Falco + Peppy" : "Falco");
+			if (viewportCount == 0) {
+				glutSetWindow(scout_window);
+				glutSetWindowTitle("Peppy");
+			}
+		}
+		break;
+	case 'o':
+		saveSnapshot();
+		break;
+	case 'h':
+		// show or hide the graph of the last 120 frames
+		showProfileGraph = !showProfileGraph;
+		break;
+	case 'H':
+		writeProfile();
+		break;
+	case 'O':
+		loadSnapshot(snapshotPath);
+		break;
+	case '[':
+		// halve the simulation speed, down to 1/16th
+		if (simClock.getTimeScale() > 1.0/16)
+			simClock.setTimeScale(simClock.getTimeScale() / 2);
+		break;
+	case ']':
+		// double the simulation speed, up to 256x
+		if (simClock.getTimeScale() < 256)
+			simClock.setTimeScale(simClock.getTimeScale() * 2);
+		break;
+	case 't':
+		// ten years on, which costs the ephemeris nothing extra
+		if (keplerMode)
+			ephemerisTime += 10 * EARTH_YEAR;
+		break;
+	case 'T':
+		if (keplerMode)
+			ephemerisTime -= 10 * EARTH_YEAR;
+		break;
 	case 'P':
 		isPaused = false;
 	case 'm':
@@ -545,6 +997,51 @@ void display_callback( void ){
 
 	// retrieve the currently active window
 	current_window = glutGetWindow();
+	// this window's GPU timer has to be current before it times anything
+	useResources(viewportCount > 0 ? 0 : current_window-1);
+	ProfileScope scope("display_callback", true);
+
+	if (viewportCount > 0)
+		renderViewports( glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT) );
+	else
+		renderView( current_window, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT) );
+	if (showProfileGraph)
+		profileGraphs[viewportCount > 0 ? 0 : current_window-1].draw(profiler, glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+
+	// swap the front and back buffers to display the scene
+	glutSetWindow( current_window );
+	{
+		ProfileScope swapScope("glutSwapBuffers");
+		glutSwapBuffers();
+	}
+	markPhase(PHASE_SWAP);
+	needsRedraw[viewportCount > 0 ? 0 : current_window-1] = false;
+	scheduler.redrawn(currentTimeMs());
+
+	if (showCullStats && viewportCount > 0) {
+		// every view's counts, drawn/culled, in viewport order
+		char title[512];
+		int length = snprintf(title, sizeof(title), "Views - %.1f of %.1f ms -", scheduler.getWorkMs(), scheduler.getTargetMs());
+		for (int view = 0; view < viewportCount && length < (int)sizeof(title); view++)
+			length += snprintf(title + length, sizeof(title) - length, " %d/%d",
+				cullStats[view].drawn, cullStats[view].culled);
+		glutSetWindowTitle(title);
+	}
+	else if (showCullStats) {
+		char title[128];
+		snprintf(title, sizeof(title), "%s - %d drawn, %d culled, %d draw calls, %.1f of %.1f ms",
+			current_window == mother_window ? "Falco" : "Peppy", cullStats[current_window-1].drawn,
+			cullStats[current_window-1].culled, queue->getDrawCalls(), scheduler.getWorkMs(), scheduler.getTargetMs());
+		glutSetWindowTitle(title);
+	}
+}
+
+// Renders the view from one ship into the current framebuffer. Doesn't touch
+// GLUT, so it works the same in a window and offscreen.
+void renderView( int current_window, int width, int height ){
+	markPhase(PHASE_OTHER);
+	useResources(current_window-1);
+	ProfileScope scope("renderView", true);
 	// clear the color and depth buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -552,18 +1049,89 @@ void display_callback( void ){
 	/////////////////////////////////////////////////////////////
 	/// TODO: Put your rendering code here! /////////////////////
 	/////////////////////////////////////////////////////////////
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective( 70.0f, float(glutGet(GLUT_WINDOW_WIDTH))/float(glutGet(GLUT_WINDOW_HEIGHT)), 0.1f, 2000.0f );
+	setProjection(width, height);
+	markPhase(PHASE_PROJECTION);
+
+	drawShipView(current_window);
+}
+
+// Renders every view into its own viewport of the current framebuffer in one
+// pass. The views share one context, so the meshes, rings and belt instances
+// are bound and uploaded once, the target is cleared once and the projection
+// is worked out once; the scene graph's world matrices are already shared.
+// What is left per view is the camera, culling and detail picking, and the
+// draw calls.
+void renderViewports( int width, int height ){
+	markPhase(PHASE_OTHER);
+	useResources(0);
+	ProfileScope scope("renderViewports", true);
+	int columns, rows;
+	viewportGrid(viewportCount, columns, rows);
+	int cellWidth = width / columns, cellHeight = height / rows;
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	setProjection(cellWidth, cellHeight);
+	markPhase(PHASE_PROJECTION);
+
+	for (int view = 0; view < viewportCount; view++) {
+		// rows count down from the top, GL's viewport origin is the bottom left
+		glViewport(view % columns * cellWidth, (rows - 1 - view / columns) * cellHeight, cellWidth, cellHeight);
+		if (view < 2)
+			drawShipView(view + 1);
+		else
+			drawOverview(view);
+	}
+	glViewport(0, 0, width, height);
+}
+
+// Columns and rows of the viewport grid for count views, as square as it goes
+void viewportGrid(int count, int &columns, int &rows) {
+	columns = 1;
+	while (columns * columns < count)
+		columns++;
+	rows = (count + columns - 1) / columns;
+}
+
+// Points the GL resources at the set made for one context
+void useResources(int slot) {
+	meshes = &meshCaches[slot];
+	rings = &orbitRingSets[slot];
+	beltRenderer = &beltRenderers[slot];
+	coreRenderer = &coreRenderers[slot];
+	queue = &renderQueues[slot];
+	profiler.setGpuTimer(&gpuTimers[slot]);
+}
+
+// Loads the projection for a view of the given size, and the frustum and
+// pixel scale that go with it
+void setProjection(int width, int height) {
+	float projection[16];
+	mat4Perspective( 70.0f, float(width)/float(height), 0.1f, 2000.0f, projection );
+	if (coreProfile) {
+		coreRenderer->setProjection(projection);
+	}
+	else {
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(projection);
+		glMatrixMode(GL_MODELVIEW);
+	}
+	frustum.setProjection(projection);
+	pixelScale = height / (2 * tanf(35.0f * 3.14159265f / 180));
+}
 
-	glMatrixMode(GL_MODELVIEW);
+// Draws the view from one ship, window 1 for the mothership and 2 for the
+// scout ship, with the projection already loaded
+void drawShipView( int current_window ){
+	ProfileScope scope("drawShipView", true);
+	lodView = current_window-1;
+	cullStats[lodView].drawn = cullStats[lodView].culled = 0;
 
-	// Draw the ship from the OTHER window -> need to use saved lastShip matrix to get its world coordinates;
-	glPushMatrix();
-	glMultMatrixf(lastShip);
-	drawShip(100);
-	glPopMatrix();
-	glLoadIdentity();  
+	// lastShip still holds the world pose of the OTHER window's ship; keep it
+	// to draw that ship once this window's camera is set up
+	float otherShip[16];
+	for (int i = 0; i < 16; i++)
+		otherShip[i] = lastShip[i];
+	modelview.loadIdentity();
 
 	if (hasModeChanged)
 		loadDefault(current_window);
@@ -574,14 +1142,26 @@ void display_callback( void ){
 	else if (inGeosyncMode) {
 		geoSyncLock(current_window);
 	}
+	markPhase(PHASE_CAMERA);
 
 	// Move camera to current ship location
-	glPushMatrix();
-	glGetFloatv(GL_MODELVIEW_MATRIX, lastShip);
-	glLoadIdentity();
-	glMultMatrixf(lastShip);
+	modelview.get(lastShip);
 	invert_pose(lastShip);
-	glPopMatrix();
+
+	// lastShip now holds the camera pose in world space
+	mat4Copy(lastShip, shipPoses[current_window-1]);
+	eyePosition[0] = lastShip[12];
+	eyePosition[1] = lastShip[13];
+	eyePosition[2] = lastShip[14];
+
+	// Draw the ship from the OTHER window
+	modelview.push();
+	modelview.mult(otherShip);
+	int slices = shipSlices(2 - current_window);
+	if (inView(SHIP_BOUNDS))
+		drawShip(slices);
+	modelview.pop();
+	markPhase(PHASE_SHIP);
 
 	/*glBegin(GL_LINES);
 	glColor3f( 1.0f, 0.0f, 0.0f );
@@ -597,136 +1177,164 @@ void display_callback( void ){
 
 	// Draw Solar System
 	drawSolarSystem();
-	// swap the front and back buffers to display the scene
+	markPhase(PHASE_SOLAR_SYSTEM);
 
-	glutSetWindow( current_window );
-	glutSwapBuffers();
+	queue->flush(&jobs);
+	markPhase(PHASE_FLUSH);
+}
+
+// Draws an overview viewport: a fixed camera looking down on the sun from
+// outside Pluto's orbit, the extra views spaced evenly around it. Both ships
+// are drawn where their own views last put them.
+void drawOverview(int view) {
+	ProfileScope scope("drawOverview", true);
+	lodView = view;
+	cullStats[lodView].drawn = cullStats[lodView].culled = 0;
+
+	int extra = view - 2, extras = viewportCount - 2;
+	float angle = (45 + 360.0f * extra / extras) * 3.14159265f / 180;
+	eyePosition[0] = 18 * sinf(angle);
+	eyePosition[1] = 10;
+	eyePosition[2] = 18 * cosf(angle);
+	modelview.loadIdentity();
+	modelview.lookAt(eyePosition[0], eyePosition[1], eyePosition[2], 0, 0, 0, 0, 1, 0);
+	markPhase(PHASE_CAMERA);
+
+	for (int ship = 0; ship < 2; ship++) {
+		modelview.push();
+		modelview.mult(shipPoses[ship]);
+		int slices = shipSlices(ship);
+		if (inView(SHIP_BOUNDS))
+			drawShip(slices);
+		modelview.pop();
+	}
+	markPhase(PHASE_SHIP);
+
+	drawSolarSystem();
+	markPhase(PHASE_SOLAR_SYSTEM);
 
+	queue->flush(&jobs);
+	markPhase(PHASE_FLUSH);
 }
 
-// Function that draws the entire solar system
+// Function that draws the entire solar system: every body in the scene, each
+// followed by the orbits of the bodies going round it, and the belt after
+// the body it goes round
 void drawSolarSystem() {
-	drawSun();
-	drawPlanet(1,0.5,0.5,0.5,1); // Draw Mercury
-	drawPlanet(2,0.8,0.7,0,1);   // Draw Venus
-	drawEarth();                 // Draw Earth + moon
-	drawPlanet(4,1,0,0,1);       // Draw Moon 
-	drawPlanet(5,0.7,0.3,0.5,1); // Draw Jupiter
-	drawSaturn();                // Draw Saturn
-	drawPlanet(7,0.3,1,1,1);     // Draw Uranus
-	drawPlanet(8,0.3,0.7,1,1);   // Draw Neptune
-	drawPluto();                 // Draw Pluto
-	glPopMatrix();
-	glPopMatrix();
-}
-
-// Draw the sun, and each of the circles around it for the orbits
-void drawSun() {
-
-	glPushMatrix();
-	glPushMatrix();
-	glPushMatrix();
-	glRotatef(90,1,0,0);
-	glColor4f(1,1,1,1);
-	gluDisk(gluNewQuadric(), 0.96, 1, 100, 100);
-	gluDisk(gluNewQuadric(), 1.96, 2, 100, 100);
-	gluDisk(gluNewQuadric(), 2.96, 3, 100, 100);
-	gluDisk(gluNewQuadric(), 3.96, 4, 100, 100);
-	gluDisk(gluNewQuadric(), 4.96, 5, 100, 100);
-	gluDisk(gluNewQuadric(), 5.96, 6, 100, 100);
-	gluDisk(gluNewQuadric(), 6.96, 7, 100, 100);
-	gluDisk(gluNewQuadric(), 7.96, 8, 100, 100);
-	glRotatef(10,1,1,1);
-	gluDisk(gluNewQuadric(), 9.46, 9.5, 100, 100);
-	glRotatef(10,-1,-1,-1);
-	glPopMatrix();
-	glRotatef(planets[0][0],0,1,0);
-	glColor4f(0.8,0.3,0,1);
-	glutSolidSphere(planets[0][2], 10 , 10);
-	glPopMatrix();
-}
-
-// Helper function to draw a planet. Takes as input an index in the planet array, and the 
-// red, green, and blue parts of the planet color, along with an alpha integer to determine the
-// planet's translucency. 
-void drawPlanet(int planetIndex, float colorR, float colorG, float colorB, float colorA) {
-
-	glPushMatrix();
-	glRotatef(planets[planetIndex][0],0,1,0);
-	glTranslatef(planetIndex,0,0);
-	glRotatef(planets[planetIndex][0],0,1,0);
-	glColor4f(colorR,colorG,colorB,colorA);
-	if (orbitPlanet == planetIndex)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetFalco);
-	if (orbitPlanet2 == planetIndex)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetPeppy);
-	glutSolidSphere(planets[planetIndex][2], 10, 10);
-	glPopMatrix();
-}
-
-// Function to draw Earth - has it's own function because moon orbits earth, therefore we can't pop the matrix before
-// drawing the moon
-void drawEarth() {
-	// Draw Earth
-	glRotatef(planets[3][0],0,1,0);
-	glTranslatef(3,0,0);
-	glRotatef(planets[3][0],0,1,0);
-	glColor4f(0,0,1,1);
-	if (orbitPlanet == 3)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetFalco);
-	if (orbitPlanet2 == 3)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetPeppy);
-	glutSolidSphere(planets[3][2], 10, 10); 
-	// Draw Earth's moon
-	glColor4f(1,1,1,1);
-	glPushMatrix();
-	glRotatef(90,1,0,0);
-	gluDisk(gluNewQuadric(), 0.514, 0.55, 100, 100);
-	glPopMatrix();
-	glRotatef(planets[3][0],0,1,0);
-	glTranslatef(0.55,0,0);
-	glColor4f(0.5,0.5,0.5,1);
-	glutSolidSphere(0.1,10,10);
-	// glPopMatrix();
-	glPopMatrix();
-}
-
-// Function to draw Saturn - givne it's own function due to Saturn's rings
-void drawSaturn() {  
-	// Draw Saturn
-	glPushMatrix();
-	glRotatef(planets[6][0],0,1,0);
-	glTranslatef(6,0,0);
-	glRotatef(planets[6][0],0,1,0);
-	glColor4f(0.3,0.7,0.5,1);
-	if (orbitPlanet == 6)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetFalco);
-	if (orbitPlanet2 == 6)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetPeppy);
-	glutSolidSphere(planets[6][2], 10, 10);
-	// Draw Saturn's rings
-	glPushMatrix();
-	glRotatef(90,1,0,0);
-	glRotatef(30, 1, 1, 0);
-	gluDisk(gluNewQuadric(), 0.5, 0.8, 100, 100);
-	glPopMatrix();
-	glPopMatrix();
-}
-
-// Function to draw Pluto - given it's own function due to unusual orbit.
-void drawPluto() {
-	glPushMatrix();
-	glRotatef(10,1,1,1);
-	glRotatef(planets[9][0],0,1,0);
-	glTranslatef(9.5,0,0);
-	glRotatef(planets[9][0],0,1,0);
-	glColor4f(0.5,0.5,0.5,1);
-	if (orbitPlanet == 9)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetFalco);
-	if (orbitPlanet2 == 9)
-		glGetFloatv(GL_MODELVIEW_MATRIX, geosyncTargetPeppy);
-	glutSolidSphere(planets[9][2], 10, 10);
-	glPopMatrix();
+	ProfileScope scope("drawSolarSystem");
+	cullSolarSystem();
+	for (int i = 0; i < (int)bodyNodes.size(); i++) {
+		drawPlanet(i);
+		drawOrbitRings(i);
+		if (i == belt.getParent())
+			drawBelt();
+	}
+}
+
+// Draws the orbits of the bodies going round a body in one batched draw, less
+// any out of view. They move with the body's position, but don't spin with it.
+void drawOrbitRings(int parent) {
+	if (ringFirst[parent] > ringLast[parent])
+		return;
+	ProfileScope scope("drawOrbitRings");
+	modelview.push();
+	modelview.load(&ringModelviews[16 * parent]);
+	bool any = false;
+	for (int ring = ringFirst[parent]; ring <= ringLast[parent]; ring++)
+		any |= countCulling(ringVisible[ring] != 0);
+	if (any) {
+		float eye[3];
+		eyeOffset(parent, eye);
+		setLighting(false);
+		setColor(1,1,1,1);
+		queue->submitRings(*rings, ringFirst[parent], ringLast[parent], eye, pixelScale, &ringVisible[0], modelview.top());
+		setLighting(true);
+	}
+	modelview.pop();
+}
+
+// Draws the asteroids in the belt sectors that are in view, with instancing,
+// in the space of the body the belt goes round.
+void drawBelt() {
+	if (belt.getCount() == 0)
+		return;
+	ProfileScope scope("drawBelt");
+	modelview.push();
+	modelview.mult(shownFrame->scene.world(bodyNodes[belt.getParent()]));
+	const AsteroidBelt &shown = shownFrame->belt;
+	bool sectorVisible[BELT_SECTORS];
+	for (int sector = 0; sector < BELT_SECTORS; sector++)
+		sectorVisible[sector] = inView(shown.sectorCenter[sector], shown.sectorRadius[sector]);
+	queue->submitBelt(*beltRenderer, shown, meshes->octahedron(), sectorVisible, modelview.top());
+	modelview.pop();
+}
+
+// Works out the frustum tests and detail levels of every body, and of the
+// rings round each, for the view whose camera is the current modelview
+// matrix, split over the job threads. Only the counts are left to do as
+// they are drawn.
+void cullSolarSystem() {
+	ProfileScope scope("cullSolarSystem");
+	int count = (int)bodyNodes.size();
+	bodyModelviews.resize(16 * (size_t)count);
+	ringModelviews.resize(16 * (size_t)count);
+	bodyVisible.resize(count);
+	std::vector<int> &levels = bodyLevels[lodView];
+	if ((int)levels.size() < bodies.count())
+		levels.resize(bodies.count(), -1);
+	float view[16];
+	modelview.get(view);
+	parallelFor(&jobs, "cullSolarSystem", count, 64, [&view, &levels](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			// the same product pushing the camera and multiplying by the
+			// world matrix makes, so nothing is drawn a bit off
+			float *body = &bodyModelviews[16 * i];
+			mat4Multiply(view, shownFrame->scene.world(spinNodes[i]), body);
+			// pick the level even when culled, so the hysteresis state
+			// doesn't depend on what happened to be in view
+			levels[i] = sphereLod.select(projectedRadius(bodies.radius[i], body, pixelScale), levels[i]);
+			bodyVisible[i] = frustum.sphereVisibleAt(body, bodies.radius[i]);
+			if (ringFirst[i] > ringLast[i])
+				continue;
+			float *ring = &ringModelviews[16 * i];
+			mat4Multiply(view, shownFrame->scene.world(bodyNodes[i]), ring);
+			for (int r = ringFirst[i]; r <= ringLast[i]; r++)
+				ringVisible[r] = frustum.sphereVisibleAt(ring, rings->boundingRadius(r));
+		}
+	});
+}
+
+// Helper function to draw a planet. Takes as input an index in the body store,
+// which holds the planet's orbit, size and color. A body with a disk, like
+// Saturn's rings, has it drawn round it, turning with the body.
+void drawPlanet(int planetIndex) {
+	ProfileScope scope("drawPlanet");
+	modelview.push();
+	modelview.load(&bodyModelviews[16 * planetIndex]);
+	setColor(bodies.colorR[planetIndex],bodies.colorG[planetIndex],bodies.colorB[planetIndex],bodies.colorA[planetIndex]);
+	drawBody(planetIndex);
+	if (sceneFile.ints(SCENE_FLAGS)[planetIndex] & SCENE_HAS_DISK) {
+		float inner = sceneFile.floats(SCENE_DISK_INNER)[planetIndex];
+		float outer = sceneFile.floats(SCENE_DISK_OUTER)[planetIndex];
+		modelview.rotate(90,1,0,0);
+		modelview.rotate(sceneFile.floats(SCENE_DISK_TILT)[planetIndex], 1, 1, 0);
+		// the disk is flat so a single loop is enough, only the slices need detail
+		float eye[3];
+		eyeOffset(planetIndex, eye);
+		float distance = sqrtf(eye[0]*eye[0] + eye[1]*eye[1] + eye[2]*eye[2]);
+		if (inView(outer))
+			drawDisk(inner, outer, ringSegments(outer, distance, pixelScale), 1);
+	}
+	modelview.pop();
+}
+
+// Offset of the eye from a body's center, in world space. Orbits are round
+// and flat, so this is all the ring detail needs to know about the eye.
+void eyeOffset(int planetIndex, float *out) {
+	const float *world = shownFrame->scene.world(bodyNodes[planetIndex]);
+	out[0] = eyePosition[0] - world[12];
+	out[1] = eyePosition[1] - world[13];
+	out[2] = eyePosition[2] - world[14];
 }
 
 
@@ -750,43 +1358,611 @@ void idle( int value ){
 	/// TODO: Put your idle code here! //////////////////////////
 	/////////////////////////////////////////////////////////////
 
-	if (!isPaused) {
-		rotateInSpace(0);
-		rotateInSpace(1);
-		rotateInSpace(2);
-		rotateInSpace(3);
-		rotateInSpace(4);
-		rotateInSpace(5);
-		rotateInSpace(6);
-		rotateInSpace(7);
-		rotateInSpace(8);
-		rotateInSpace(9);
-	}
+	profiler.beginFrame();
+	ProfileScope scope("idle");
+
+	// run however many fixed steps the real time since the last tick covers
+	double now = currentTimeMs();
+	bool changed = advanceSimulation(lastIdleTime < 0 ? 0 : (now - lastIdleTime) / 1000.0);
+	lastIdleTime = now;
+
+	// The views stand still unless the scene moved or a key was pressed, a
+	// mode change or relative move is still playing out over the next draws,
+	// or the frame graph is showing. GLUT still redraws a window that was
+	// uncovered or resized by itself.
+	if (changed || hasModeChanged || showProfileGraph)
+		needsRedraw[0] = needsRedraw[1] = true;
+	bool drawScout = viewportCount == 0 && needsRedraw[1];
+	double next = scheduler.beginFrame(now, needsRedraw[0] || drawScout);
 
 	// set the currently active window to the mothership and
 	// request a redisplay
-	glutSetWindow( mother_window );
-	glutPostRedisplay();
+	if (needsRedraw[0]) {
+		glutSetWindow( mother_window );
+		glutPostRedisplay();
+	}
 
 	// now set the currently active window to the scout ship
-	// and redisplay it as well
-	glutSetWindow( scout_window );
-	glutPostRedisplay();
+	// and redisplay it as well, unless both are viewports of one window
+	if (drawScout) {
+		glutSetWindow( scout_window );
+		glutPostRedisplay();
+	}
 
-	// set a timer to call this function again after the
-	// required number of milliseconds
-	glutTimerFunc( dt, idle, 0 );
+	// call this function again when the next frame is due, which doesn't
+	// move with how long this one takes
+	glutTimerFunc( (unsigned int)std::max(0.0, next - currentTimeMs() + 0.5), idle, 0 );
 }
 
-// Helper method to rotate a planet. Takes as input an integer which is the index in the planets array.
-void rotateInSpace(int arrayIndex) {
-
-	if (planets[arrayIndex][0] >= 360) {
-		planets[arrayIndex][0] = planets[arrayIndex][0] - 360 + planets[arrayIndex][1];
+// Applies the keys that came in since the last frame, then runs the
+// simulation forward by realSeconds of wall clock time (scaled by the clock's
+// time scale), in whole fixed steps, or by exactly one step with oneStep.
+// When replaying, the keys, steps and blend come from the log and realSeconds
+// is ignored. Either way the frame goes to the recorder if there is one. The
+// ships fly on by the frame's real time, unscaled. Returns whether anything
+// changed: a key, the bodies or a ship moving. With the simulation on its own
+// thread there is only the keys to apply, the ships to fly and the frame to
+// take.
+bool advanceSimulation(double realSeconds, bool oneStep) {
+	ProfileScope scope("advanceSimulation");
+	if (simThread.isRunning())
+		return takeSimulationFrame(realSeconds);
+	InputFrame frame;
+	bool replayed = replaying && inputReplay.next(frame);
+	if (replaying && !replayed) {
+		replaying = false;
+		std::cout << "replay: finished after " << inputReplay.getPosition() << " frames" << std::endl;
+	}
+	if (replayed && replayRealtime)
+		waitForReplay(frame.realMicros);
+	if (!replayed) {
+		frame.keys.swap(pendingKeys);
+		frame.realMicros = (unsigned int)(std::min(std::max(realSeconds, 0.0), 4000.0) * 1e6);
+	}
+	for (size_t i = 0; i < frame.keys.size(); i++) {
+		applyKey(frame.keys[i]);
+		inputRecorder.key(frame.keys[i]);
 	}
+	// the logged time, so a replay flies the same way
+	bool flown = flyShips(frame.realMicros / 1e6);
+
+	if (replayed)
+		simClock.replay(frame.steps, isPaused ? 0 : frame.alpha);
 	else
-		planets[arrayIndex][0] += planets[arrayIndex][1];
+		frame.steps = runClock(realSeconds, oneStep, frame.alpha);
+	inputRecorder.endFrame(frame.steps, frame.alpha, frame.realMicros);
+	stepSimulation(frame.steps, frame.alpha);
+	shownFrame = &simFrames.latest();
+	reportSnapshots();
+	markPhase(PHASE_SIMULATION);
+
+	bool changed = !frame.keys.empty() || flown || frame.steps > 0 || frame.alpha != lastAlpha;
+	lastAlpha = frame.alpha;
+	return changed;
+}
+
+// Moves the clock on by realSeconds, or by one step with oneStep, and returns
+// how many whole steps that makes, with the blend into the next one in alpha
+int runClock(double realSeconds, bool oneStep, float &alpha) {
+	int steps = oneStep ? simClock.step() : simClock.advance(realSeconds);
+	if (isPaused) {
+		// time passes without the orbits moving, and there's nothing to blend
+		simClock.resetAccumulator();
+		steps = 0;
+	}
+	alpha = isPaused ? 1.0f : (float)simClock.alpha();
+	return steps;
+}
+
+// advanceSimulation's part with the simulation on its own thread: applies the
+// keys that came in, holding the thread while they do, flies the ships, then
+// takes the newest frame it has published. Returns whether there was a key, a
+// ship moved or there is a new frame.
+bool takeSimulationFrame(double realSeconds) {
+	std::vector<unsigned char> keys;
+	keys.swap(pendingKeys);
+	if (!keys.empty()) {
+		simThread.lock();
+		for (size_t i = 0; i < keys.size(); i++)
+			applyKey(keys[i]);
+		keysApplied = true;
+		simThread.unlock();
+	}
+	bool flown = flyShips(std::min(std::max(realSeconds, 0.0), 4000.0));
+	shownFrame = &simFrames.latest();
+	reportSnapshots();
+	markPhase(PHASE_SIMULATION);
+
+	bool changed = !keys.empty() || flown || shownFrame->sequence != shownSequence;
+	shownSequence = shownFrame->sequence;
+	return changed;
+}
+
+// Flies both ships on by seconds of real time, in relative mode. Returns
+// whether either moved.
+bool flyShips(double seconds) {
+	if (!inRelativeMode)
+		return false;
+	bool falco = flights[0].fly(seconds);
+	bool peppy = flights[1].fly(seconds);
+	return falco || peppy;
+}
+
+// One tick of the simulation thread: runs the simulation forward by the wall
+// clock time since the last tick and publishes a frame, unless nothing moved
+// and no key could have changed anything
+void simulationTick() {
+	ProfileScope scope("simulationTick");
+	double now = currentTimeMs();
+	float alpha;
+	int steps = runClock(lastTickMs < 0 ? 0 : (now - lastTickMs) / 1000.0, false, alpha);
+	lastTickMs = now;
+	if (steps > 0 || alpha != lastTickAlpha || keysApplied)
+		stepSimulation(steps, alpha);
+	lastTickAlpha = alpha;
+	keysApplied = false;
+}
+
+// Hands the simulation over to a thread of its own, if it is to have one
+void startSimThread() {
+	bool threaded = simThreadOption < 0 ? !headless && !benchmark : simThreadOption == 1;
+	if (threaded && (recordPath || replaying)) {
+		if (simThreadOption == 1)
+			std::cerr << "simulation: recordings and replays step with the frames, ignoring --sim-thread" << std::endl;
+		threaded = false;
+	}
+	if (!threaded)
+		return;
+	simThread.start(simulationTick, scheduler.getPeriodMs() / 2);
+	std::cout << "simulation: stepping on its own thread, every " << scheduler.getPeriodMs() / 2 << " ms" << std::endl;
+}
+
+void stopSimThread() {
+	if (!simThread.isRunning())
+		return;
+	simThread.stop();
+	std::cout << "simulation: " << simThread.getTicks() << " ticks, " << simThread.getLate() << " ran late" << std::endl;
+}
+
+// Says how much work went to the job threads, if any did
+void reportJobs() {
+	if (jobs.getJobsRun() > 0)
+		std::cout << "jobs: " << jobs.getJobsRun() << " run, " << jobs.getJobsStolen()
+			<< " taken from another thread's queue" << std::endl;
+}
 
+//////////////////////////////////////////////////////////////////
+/// Snapshots ////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Flags and counters of the camera modes, in the order they are saved
+static int *const modeInts[] = {&orbitPlanet, &orbitPlanet2, &modeChangedCounter};
+static bool *const modeFlags[] = {&inLookatMode, &inRelativeMode, &inGeosyncMode, &isPaused, &onMotherShip,
+	&otherShipOrbiting, &hasModeChanged};
+static float *const modeFloats[] = {&geoSyncDistanceFalco, &geoSyncDistancePeppy, &geoSyncSpeed};
+const int MODE_INTS = sizeof(modeInts) / sizeof(modeInts[0]);
+const int MODE_FLAGS = sizeof(modeFlags) / sizeof(modeFlags[0]);
+const int MODE_FLOATS = sizeof(modeFloats) / sizeof(modeFloats[0]);
+
+// The n-body particles' state, and the tags it is saved under. The masses
+// never change and the render positions come from interpolating.
+const int GRAVITY_ARRAYS = 12;
+static const char *const gravityTags[GRAVITY_ARRAYS] = {"GX  ", "GY  ", "GZ  ", "GVX ", "GVY ", "GVZ ",
+	"GAX ", "GAY ", "GAZ ", "GPX ", "GPY ", "GPZ "};
+static std::vector<float> *const gravityArrays[GRAVITY_ARRAYS] = {&gravity.x, &gravity.y, &gravity.z,
+	&gravity.vx, &gravity.vy, &gravity.vz, &gravity.ax, &gravity.ay, &gravity.az,
+	&gravity.previousX, &gravity.previousY, &gravity.previousZ};
+
+// Copies everything the session needs to carry on from this point into
+// snapshot: the bodies' angles, the clock, the n-body particles or the
+// ephemeris time, and the ships' cameras and modes. Nothing is derived from
+// anything else, so this is a copy per array and no more.
+void captureSnapshot(Snapshot &snapshot) {
+	snapshot.clear();
+	int shape[3] = {bodies.count(), nbodyMode ? gravity.count() : -1, keplerMode ? ephemeris.count() : -1};
+	snapshot.put("SHAP", shape);
+	snapshot.putArray("ANGL", bodies.angle);
+	snapshot.putArray("PANG", bodies.previousAngle);
+	long long steps = simClock.getSteps();
+	double clock[2] = {simClock.alpha(), simClock.getTimeScale()};
+	snapshot.put("STEP", steps);
+	snapshot.put("CLOK", clock);
+	if (keplerMode)
+		snapshot.put("TIME", ephemerisTime);
+	if (nbodyMode) {
+		for (int a = 0; a < GRAVITY_ARRAYS; a++)
+			snapshot.putArray(gravityTags[a], *gravityArrays[a]);
+		snapshot.put("GEN0", gravityStartEnergy);
+	}
+
+	snapshot.put("SHIP", lastShip);
+	snapshot.put("POSE", shipPoses);
+	snapshot.put("FLY ", flights);
+	snapshot.put("FGEO", geoSyncFalco);
+	snapshot.put("PGEO", geoSyncPeppy);
+	snapshot.put("ABSV", absoluteVars);
+	snapshot.put("RELV", relativeVars);
+	int ints[MODE_INTS + MODE_FLAGS];
+	float floats[MODE_FLOATS];
+	for (int i = 0; i < MODE_INTS; i++)
+		ints[i] = *modeInts[i];
+	for (int i = 0; i < MODE_FLAGS; i++)
+		ints[MODE_INTS + i] = *modeFlags[i];
+	for (int i = 0; i < MODE_FLOATS; i++)
+		floats[i] = *modeFloats[i];
+	snapshot.put("MODI", ints);
+	snapshot.put("MODF", floats);
+
+	// the detail levels too, since with their hysteresis the level a body is
+	// drawn at depends on the frames before. Rocks don't have one.
+	int spheres = (int)bodyNodes.size();
+	std::vector<int> levels(MAX_VIEWS * (size_t)spheres, -1);
+	for (int view = 0; view < MAX_VIEWS; view++)
+		std::copy(bodyLevels[view].begin(), bodyLevels[view].begin() + std::min(spheres, (int)bodyLevels[view].size()),
+			levels.begin() + view * spheres);
+	snapshot.putArray("LODB", levels);
+	snapshot.put("LODS", shipLevels);
+}
+
+// Puts the session back the way captureSnapshot found it. Returns false,
+// changing nothing, if the snapshot is of a session with other bodies or
+// modes.
+bool restoreSnapshot(const Snapshot &snapshot) {
+	int shape[3];
+	int expected[3] = {bodies.count(), nbodyMode ? gravity.count() : -1, keplerMode ? ephemeris.count() : -1};
+	if (!snapshot.get("SHAP", shape) || memcmp(shape, expected, sizeof(shape)) != 0) {
+		std::cerr << "snapshot: taken with other bodies, or with --nbody or --kepler set differently" << std::endl;
+		return false;
+	}
+	// everything is copied out of the snapshot before anything is touched
+	std::vector<float> angle(bodies.count()), previousAngle(bodies.count());
+	long long steps;
+	double clock[2], time = ephemerisTime, startEnergy = gravityStartEnergy;
+	bool ok = snapshot.getArray("ANGL", angle) && snapshot.getArray("PANG", previousAngle)
+		&& snapshot.get("STEP", steps) && snapshot.get("CLOK", clock)
+		&& (!keplerMode || snapshot.get("TIME", time));
+	std::vector<float> particles[GRAVITY_ARRAYS];
+	if (nbodyMode) {
+		for (int a = 0; a < GRAVITY_ARRAYS && ok; a++) {
+			particles[a].resize(gravity.count());
+			ok = snapshot.getArray(gravityTags[a], particles[a]);
+		}
+		ok = ok && snapshot.get("GEN0", startEnergy);
+	}
+	float ship[16], poses[2][16], geoFalco[16], geoPeppy[16];
+	ShipFlight flown[2];
+	float absolute[9][5], relative[5];
+	int ints[MODE_INTS + MODE_FLAGS];
+	float floats[MODE_FLOATS];
+	int spheres = (int)bodyNodes.size();
+	std::vector<int> levels(MAX_VIEWS * (size_t)spheres);
+	int shipLevelsSaved[MAX_VIEWS][2];
+	ok = ok && snapshot.getArray("LODB", levels) && snapshot.get("LODS", shipLevelsSaved);
+	ok = ok && snapshot.get("SHIP", ship) && snapshot.get("POSE", poses) && snapshot.get("FLY ", flown)
+		&& snapshot.get("FGEO", geoFalco) && snapshot.get("PGEO", geoPeppy)
+		&& snapshot.get("ABSV", absolute) && snapshot.get("RELV", relative)
+		&& snapshot.get("MODI", ints) && snapshot.get("MODF", floats);
+	if (!ok) {
+		std::cerr << "snapshot: some of the session is missing from it" << std::endl;
+		return false;
+	}
+
+	bodies.angle.swap(angle);
+	bodies.previousAngle.swap(previousAngle);
+	simClock.restore(steps, clock[0]);
+	simClock.setTimeScale(clock[1]);
+	ephemerisTime = time;
+	if (nbodyMode) {
+		for (int a = 0; a < GRAVITY_ARRAYS; a++)
+			gravityArrays[a]->swap(particles[a]);
+		gravityStartEnergy = startEnergy;
+	}
+	memcpy(lastShip, ship, sizeof(ship));
+	memcpy(shipPoses, poses, sizeof(poses));
+	flights[0] = flown[0];
+	flights[1] = flown[1];
+	memcpy(geoSyncFalco, geoFalco, sizeof(geoFalco));
+	memcpy(geoSyncPeppy, geoPeppy, sizeof(geoPeppy));
+	memcpy(absoluteVars, absolute, sizeof(absolute));
+	memcpy(relativeVars, relative, sizeof(relative));
+	for (int i = 0; i < MODE_INTS; i++)
+		*modeInts[i] = ints[i];
+	for (int i = 0; i < MODE_FLAGS; i++)
+		*modeFlags[i] = ints[MODE_INTS + i] != 0;
+	for (int i = 0; i < MODE_FLOATS; i++)
+		*modeFloats[i] = floats[i];
+	for (int view = 0; view < MAX_VIEWS; view++)
+		bodyLevels[view].assign(levels.begin() + view * spheres, levels.begin() + (view + 1) * spheres);
+	memcpy(shipLevels, shipLevelsSaved, sizeof(shipLevels));
+
+	// the frame is drawn where the snapshot's was
+	stepSimulation(0, (float)clock[0]);
+	return true;
+}
+
+// Freezes the session and hands it to the writer thread
+void saveSnapshot() {
+	double start = currentTimeMs();
+	Snapshot snapshot;
+	captureSnapshot(snapshot);
+	size_t bytes = snapshot.bytes();
+	snapshotWriter.write(snapshotPath, snapshot);
+	printf("snapshot: took %.1f KB in %.3f ms, writing %s\n", bytes / 1024.0, currentTimeMs() - start, snapshotPath);
+}
+
+// Reads a snapshot and puts the session back to it. Returns false (and
+// prints why) if it can't be used.
+bool loadSnapshot(const char *path) {
+	// a snapshot of the same file may still be on its way out
+	snapshotWriter.wait();
+	double start = currentTimeMs();
+	Snapshot snapshot;
+	if (!snapshot.read(path) || !restoreSnapshot(snapshot))
+		return false;
+	printf("snapshot: restored %s in %.3f ms\n", path, currentTimeMs() - start);
+	return true;
+}
+
+// Says so once a snapshot has been written
+void reportSnapshots() {
+	bool ok;
+	std::string path;
+	double ms;
+	if (snapshotWriter.finished(ok, path, ms) && ok)
+		printf("snapshot: wrote %s in %.1f ms\n", path.c_str(), ms);
+}
+
+// Writes what the profiler has kept to profilePath, profile.json if there was
+// no --profile, as a Chrome trace
+void writeProfile() {
+	if (!activeProfiler())
+		return;
+	const char *path = profilePath ? profilePath : "profile.json";
+	if (profiler.writeTrace(path))
+		std::cout << "profiler: trace written to " << path << std::endl;
+}
+
+// Sleeps until the wall clock has moved on from the last replayed frame as
+// far as it had when the frame was recorded. A replay that falls behind
+// doesn't sleep until it has caught up.
+void waitForReplay(unsigned int realMicros) {
+	double now = currentTimeMs();
+	if (replayDueMs < 0)
+		replayDueMs = now;
+	replayDueMs += realMicros / 1000.0;
+	if (replayDueMs > now)
+		std::this_thread::sleep_for(std::chrono::microseconds((long long)((replayDueMs - now) * 1000)));
+}
+
+// Runs the given number of fixed steps, then sets up everything drawn at
+// alpha of the way from the previous step to the last one and publishes it
+// as the newest frame to draw
+void stepSimulation(int steps, float alpha) {
+	// the scene and the belt both only read what the steps left, so they are
+	// worked out side by side
+	SimFrame &out = simFrames.back();
+	TaskGraph graph(&jobs);
+	int stepped = graph.add("step", [steps]() {
+		// one simulation step is the n-body system's unit of time
+		for (int step = 0; step < steps; step++) {
+			bodies.step(&jobs);
+			if (nbodyMode)
+				gravity.step(1, &jobs);
+		}
+	});
+	int interpolated = graph.add("interpolate", [steps, alpha]() {
+		bodies.interpolate(alpha, &jobs);
+		if (nbodyMode)
+			gravity.interpolate(alpha);
+		if (keplerMode) {
+			// like the interpolated angles, the frame shows a time between the
+			// last two steps
+			ephemerisTime += steps;
+			ephemeris.evaluate(ephemerisTime - 1 + alpha);
+		}
+	}, stepped);
+	graph.add("updateScene", [&out]() { updateScene(out.scene); }, interpolated);
+	graph.add("belt", [&out]() {
+		if (keplerMode && belt.getCount() > 0) {
+			int rock = bodyOrbits[belt.getFirst()];
+			float origin[3] = {0, 0, 0};
+			out.belt.update(bodies, &ephemeris.x[rock], &ephemeris.y[rock], &ephemeris.z[rock], origin, &jobs);
+		}
+		else if (nbodyMode && belt.getCount() > 0 && bodyParticles[belt.getFirst()] >= 0) {
+			int center = bodyParticles[belt.getParent()], rock = bodyParticles[belt.getFirst()];
+			float origin[3] = {gravity.renderX[center], gravity.renderY[center], gravity.renderZ[center]};
+			out.belt.update(bodies, &gravity.renderX[rock], &gravity.renderY[rock], &gravity.renderZ[rock], origin, &jobs);
+		}
+		else
+			out.belt.update(bodies, &jobs);
+	}, interpolated);
+	graph.run();
+	out.steps = simClock.getSteps();
+	out.alpha = alpha;
+	simFrames.publish();
+}
+
+// Fills the body store from the scene, which has to be loaded, and adds
+// the --belt rocks after its own
+void initBodies() {
+	const SceneFile &f = sceneFile;
+	BodyConstants constants = {f.floats(SCENE_RATE), f.floats(SCENE_RADIUS), f.floats(SCENE_ORBIT),
+		f.floats(SCENE_TILT), f.ints(SCENE_PARENT),
+		f.floats(SCENE_RED), f.floats(SCENE_GREEN), f.floats(SCENE_BLUE), f.floats(SCENE_ALPHA)};
+	bodies.attach(f.count(), constants, f.floats(SCENE_ANGLE));
+	if (beltCount > 0)
+		AsteroidBelt::addRocks(bodies, f.getBeltParent(), beltCount, f.getBeltInner(), f.getBeltOuter(), 12345);
+	int sceneBodies = f.getFirstRock();
+	if (bodies.count() > sceneBodies)
+		belt.attach(bodies, f.getBeltParent(), sceneBodies, bodies.count() - sceneBodies);
+	if (nbodyMode && keplerMode) {
+		std::cerr << "--kepler and --nbody can't be used together, using --nbody" << std::endl;
+		keplerMode = false;
+	}
+	if (nbodyMode)
+		initGravity();
+	if (keplerMode)
+		initEphemeris();
+	initScene(sceneBodies);
+	simFrames.init(scene, belt);
+	shownFrame = &simFrames.latest();
+}
+
+// Puts every body at the center of the scene, and everything going round one
+// directly (the sun, the planets and the belt), into the n-body system, each
+// moving at the speed of a circular orbit from where it is on its circle now.
+// Masses are the scene's, relative to the center: its mass is picked so the
+// reference body, earth, still takes as long to go round, or is 1 if there is
+// none. Rocks added by --belt weigh nothing. Everything further down the
+// tree, like the moon, stays on rails.
+void initGravity() {
+	const float PI = 3.14159265f;
+	const float *masses = sceneFile.floats(SCENE_MASS);
+	int reference = sceneFile.getReference();
+	float rootMass = 1;
+	if (reference >= 0 && bodies.parent[reference] >= 0) {
+		float referenceRate = bodies.rate[reference] * PI / 180;
+		rootMass = referenceRate * referenceRate * powf(bodies.orbitRadius[reference], 3);
+	}
+
+	gravity.reserve(bodies.count());
+	gravity.setTheta(nbodyTheta);
+	bodyParticles.assign(bodies.count(), -1);
+	for (int i = 0; i < bodies.count(); i++) {
+		int parent = bodies.parent[i];
+		if (parent >= 0 && bodies.parent[parent] >= 0)
+			continue;
+		float mass = i < sceneFile.count() ? masses[i] * rootMass : 0;
+		if (parent < 0) {
+			bodyParticles[i] = gravity.add(0, 0, 0, 0, 0, 0, mass);
+			continue;
+		}
+		// the same rotations that place it on its circle, applied to the
+		// radius and to the direction it is moving in, around its parent
+		float orbit[16], turn[16];
+		mat4Rotation(bodies.inclination[i], 1, 1, 1, orbit);
+		mat4Rotation(bodies.angle[i], 0, 1, 0, turn);
+		mat4Multiply(orbit, turn, orbit);
+		float r = bodies.orbitRadius[i], speed = sqrtf(masses[parent] * rootMass / r);
+		float out[3] = {r, 0, 0}, along[3] = {0, 0, -speed}, p[3], v[3];
+		mat4TransformPoint(orbit, out, p);
+		mat4TransformPoint(orbit, along, v);
+		int center = bodyParticles[parent];
+		bodyParticles[i] = gravity.add(p[0] + gravity.x[center], p[1] + gravity.y[center], p[2] + gravity.z[center],
+			v[0], v[1], v[2], mass);
+	}
+	gravity.removeNetMomentum();
+	gravity.start(&jobs);
+	gravityStartEnergy = gravity.energy();
+}
+
+// Gives every body but the ones at the center an elliptical orbit in the
+// ephemeris, with the scene's elements. The solar system's planets and moon
+// have roughly their real eccentricities and the angles that place their
+// orbits; rocks added by --belt get small random ones. Sizes and speeds stay
+// the ones the circles use, so a year is as long as it always was.
+void initEphemeris() {
+	const SceneFile &f = sceneFile;
+	unsigned int seed = 2024;
+	ephemeris.reserve(bodies.count());
+	bodyOrbits.assign(bodies.count(), -1);
+	for (int i = 0; i < bodies.count(); i++) {
+		if (bodies.parent[i] < 0)
+			continue;
+		OrbitalElements elements;
+		elements.semiMajorAxis = bodies.orbitRadius[i];
+		elements.meanAnomaly = bodies.angle[i];
+		elements.meanMotion = bodies.rate[i];
+		if (i < f.count()) {
+			elements.eccentricity = f.floats(SCENE_ECCENTRICITY)[i];
+			elements.inclination = f.floats(SCENE_INCLINATION)[i];
+			elements.ascendingNode = f.floats(SCENE_NODE)[i];
+			elements.periapsis = f.floats(SCENE_PERIAPSIS)[i];
+		}
+		else {
+			elements.eccentricity = randomUnit(seed) * 0.12f;
+			elements.inclination = fabsf(bodies.inclination[i]);
+			elements.ascendingNode = randomUnit(seed) * 360;
+			elements.periapsis = randomUnit(seed) * 360;
+		}
+		bodyOrbits[i] = ephemeris.add(elements);
+	}
+	ephemeris.evaluate(ephemerisTime);
+}
+
+// Small deterministic generator for numbers in [0, 1)
+float randomUnit(unsigned int &seed) {
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 8) / 16777216.0f;
+}
+
+// Prints how far the n-body system's energy has wandered, and what a step costs
+void reportGravity() {
+	const NBodyStats &stats = gravity.getStats();
+	printf("n-body: %d particles, energy drift %.3g after %lld steps, last step %.3f ms (%.3f build, %.3f forces)\n",
+		gravity.count(), (gravity.energy() - gravityStartEnergy) / gravityStartEnergy, simClock.getSteps(),
+		stats.buildMs + stats.forceMs + stats.integrateMs, stats.buildMs, stats.forceMs);
+}
+
+// Gives the first count bodies in the store a node in the scene graph, and
+// one for their spin unless the scene says it keeps the same face to its
+// parent, like the moon does to earth.
+void initScene(int count) {
+	const int *flags = sceneFile.ints(SCENE_FLAGS);
+	for (int i = 0; i < count; i++) {
+		int parent = bodies.parent[i];
+		bodyNodes.push_back(scene.add(parent < 0 ? -1 : bodyNodes[parent]));
+		spinNodes.push_back(flags[i] & SCENE_NO_SPIN ? bodyNodes[i] : scene.add(bodyNodes[i]));
+	}
+	updateScene(scene);
+}
+
+// Sets each body's place on its orbit and its spin in graph from the angles
+// to draw with, then brings the world matrices up to date. A body at rest,
+// e.g. while paused, keeps its matrices and nothing under it is recomputed.
+void updateScene(SceneGraph &graph) {
+	// each body only sets its own nodes, so the bodies can be split up
+	parallelFor(&jobs, "updateScene", (int)bodyNodes.size(), 256, [&graph](int begin, int end) {
+		float local[16], step[16];
+		for (int i = begin; i < end; i++) {
+			float angle = bodies.renderAngle[i];
+			// a body with no parent stays at the origin and only spins
+			mat4Identity(local);
+			if (keplerMode && bodyOrbits[i] >= 0) {
+				// on its ellipse, with its parent at the focus
+				int orbit = bodyOrbits[i];
+				mat4Translation(ephemeris.x[orbit], ephemeris.y[orbit], ephemeris.z[orbit], local);
+			}
+			else if (nbodyMode && bodyParticles[i] >= 0) {
+				// placed by gravity, relative to its parent
+				int particle = bodyParticles[i], parent = bodies.parent[i];
+				float x = gravity.renderX[particle], y = gravity.renderY[particle], z = gravity.renderZ[particle];
+				if (parent >= 0) {
+					int above = bodyParticles[parent];
+					x -= gravity.renderX[above];
+					y -= gravity.renderY[above];
+					z -= gravity.renderZ[above];
+				}
+				mat4Translation(x, y, z, local);
+			}
+			else if (bodies.parent[i] >= 0) {
+				if (bodies.inclination[i] != 0) {
+					mat4Rotation(bodies.inclination[i], 1, 1, 1, step);
+					mat4Multiply(local, step, local);
+				}
+				mat4Rotation(angle, 0, 1, 0, step);
+				mat4Multiply(local, step, local);
+				mat4Translation(bodies.orbitRadius[i], 0, 0, step);
+				mat4Multiply(local, step, local);
+			}
+			graph.setLocal(bodyNodes[i], local);
+			if (spinNodes[i] != bodyNodes[i]) {
+				mat4Rotation(angle, 0, 1, 0, local);
+				graph.setLocal(spinNodes[i], local);
+			}
+		}
+	});
+	graph.update(&jobs);
 }
 
 // Loads the default view into the window
@@ -794,7 +1970,7 @@ void loadDefault(int current_window) {
 	// Need to update both windows, therefore we need to make sure that this loadDefault function runs twice.
 	// This is why there is a modeChangedCounter. It is reset to 0 in the keyboard callback if the mode is changed
 	if (modeChangedCounter != 2) {
-		gluLookAt(absoluteVars[0][current_window+2],
+		modelview.lookAt(absoluteVars[0][current_window+2],
 			absoluteVars[1][current_window+2],
 			absoluteVars[2][current_window+2],
 			absoluteVars[3][current_window+2],
@@ -808,15 +1984,11 @@ void loadDefault(int current_window) {
 			absoluteVars[i][current_window-1] = absoluteVars[i][current_window+2];
 		modeChangedCounter++;
 
-		if (current_window == 1)  {
-			glGetFloatv(GL_MODELVIEW_MATRIX, falcoLast);
-			glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncFalco);
-		}
-
-		else {
-			glGetFloatv(GL_MODELVIEW_MATRIX, peppyLast);
-			glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncPeppy);
-		}
+		flights[current_window-1].setView(modelview.top());
+		if (current_window == 1)
+			modelview.get(geoSyncFalco);
+		else
+			modelview.get(geoSyncPeppy);
 		//glGetFloatv(GL_MODELVIEW_MATRIX, lastShip);
 		//glLoadMatrixf(lastShip);
 	}
@@ -827,7 +1999,8 @@ void loadDefault(int current_window) {
 // Updates the eyepoint based on the current window. The correct values will have been updated if necessary
 // in the increment/decrement lookatvar function.
 void lookAtMovement(int current_window) {
-	gluLookAt(absoluteVars[0][current_window-1],
+	ProfileScope scope("lookAtMovement");
+	modelview.lookAt(absoluteVars[0][current_window-1],
 		absoluteVars[1][current_window-1],
 		absoluteVars[2][current_window-1],
 		absoluteVars[3][current_window-1],
@@ -838,337 +2011,515 @@ void lookAtMovement(int current_window) {
 		absoluteVars[8][current_window-1]); 
 }
 
-// Method that updates the ship's position when it is in relative mode 
+// Method that updates the ship's position when it is in relative mode. The
+// ships are flown at the start of the frame, so this is only their camera.
 void relativeMovement(int current_window) {
-
-	// If no key has been pressed, the relative flag will be false. Therefore we can just load the same matrix that 
-	// we used on the last draw.
-	if (!relativeFlag) 
-		if (current_window == 1) 
-			glLoadMatrixf(falcoLast);
-		else
-			glLoadMatrixf(peppyLast);
-	else {
-		if (onMotherShip) {
-			// If we are on Falco's ship (the mothership), and the current window is 1, update to the new location
-			// and save that in falcoLast, otherwise load the last peppyLast (scoutship) value, since we aren't
-			// currently controlling it.
-			if (current_window == 1) {
-				glLoadIdentity();
-				relChange();
-				glMultMatrixf(falcoLast);
-				glGetFloatv(GL_MODELVIEW_MATRIX,falcoLast);
-				relativeFlag = false;
-			}
-			else {
-				glLoadMatrixf(peppyLast);
-				relativeFlag = true;
-			}
-		}
-		else {
-			// If we are on Peppy's ship (the scoutship), and the current window is 2, update to the new location
-			// and save that in peppyLast, otherwise load the last falcoLast (mothership) value, since we aren't
-			// currently controlling it.
-			if (current_window == 2) {
-				glLoadIdentity();
-				relChange();
-				glMultMatrixf(peppyLast);
-				glGetFloatv(GL_MODELVIEW_MATRIX,peppyLast);
-				relativeFlag = false;
-			}
-			else {
-				glLoadMatrixf(falcoLast);
-				relativeFlag = true;
-			}	
-		}
-	}
-}
-
-// Helper function to change relative variables. It switches between the global variable, relVal,
-// and updates the corresponding variables depending on whether it is increasing or decreasing.
-void relChange() {
-
-	switch(relVal){
-	case 0:
-		if(upOrDown == 0)
-			glRotatef(relativeVars[0],0,1,0);
-		else
-			glRotatef(-relativeVars[0],0,1,0);
-		break;
-	case 1:
-		if(upOrDown == 0)
-			glRotatef(relativeVars[1],0,0,1);
-		else
-			glRotatef(-relativeVars[1],0,0,1);
-		break;
-	case 2:
-		if(upOrDown == 0)
-			glRotatef(relativeVars[2],1,0,0);
-		else
-			glRotatef(-relativeVars[2],1,0,0);
-		break;
-	case 3:
-		if (upOrDown == 0)
-			glTranslatef(0,0,relativeVars[3]);
-		else
-			glTranslatef(0,0,-relativeVars[3]);
-		break;
-	}
+	ProfileScope scope("relativeMovement");
+	float view[16];
+	flights[current_window-1].getView(view);
+	modelview.load(view);
 }
 
 // Method that updates the ship's position when it is in geosync mode
 void geoSyncLock(int current_window) {
+	ProfileScope scope("geoSyncLock");
 
-	// If we are on the mothership, and the current window is 1, we need to invert both the lastShip matrix
-	// and the geosyncTargetFalco matrix, to get to the current position of the ship/camera.
+	// If we are on the mothership, window 1 follows Falco's planet. Window 2 follows Peppy's
+	// planet if Peppy is already orbiting, otherwise it stays where it was.
 	if (onMotherShip) {
-		if (current_window == 1) {
-
-			invert_pose(lastShip);
-			glLoadIdentity();
-			invert_pose(geosyncTargetFalco);
-			glTranslatef(0,-0.3,geoSyncDistanceFalco);
-			glRotatef(10,1,0,0);
-			glMultMatrixf(geosyncTargetFalco);
-			glMultMatrixf(lastShip);
-			glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncFalco);
-		}
+		if (current_window == 1)
+			geoSyncOrbit(orbitPlanet, geoSyncDistanceFalco, geoSyncFalco);
 		else {
 			// If the other ship is already orbiting, we need to ensure that it keeps orbiting, so there is a boolean check for that.
 			// Otherwise it will just load the default view, which is at geoSyncPeppy initially.
-			if (otherShipOrbiting) {
-				invert_pose(lastShip);
-				glLoadIdentity();
-				invert_pose(geosyncTargetPeppy);
-				glTranslatef(0,-0.3,geoSyncDistancePeppy);
-				glRotatef(10,1,0,0);
-				glMultMatrixf(geosyncTargetPeppy);
-				glMultMatrixf(lastShip);
-				glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncPeppy);
-			}
+			if (otherShipOrbiting)
+				geoSyncOrbit(orbitPlanet2, geoSyncDistancePeppy, geoSyncPeppy);
 			else
-				glLoadMatrixf(geoSyncPeppy);
+				modelview.load(geoSyncPeppy);
 		}
 	}
 	else {
 
-		// If we are on the scoutship, and the current window is 2, we need to inver both the lastShip matrix and the
-		// geosyncTargetPeppt matrix, to get to the current position of the ship/camera.
-		if (current_window == 2) {
-
-			invert_pose(lastShip);
-			glLoadIdentity();
-			invert_pose(geosyncTargetPeppy);
-			glTranslatef(0,-0.3,geoSyncDistancePeppy);
-			glRotatef(10,1,0,0);
-			glMultMatrixf(geosyncTargetPeppy);
-			glMultMatrixf(lastShip);
-			glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncPeppy);
-		}
+		// If we are on the scoutship, window 2 follows Peppy's planet
+		if (current_window == 2)
+			geoSyncOrbit(orbitPlanet2, geoSyncDistancePeppy, geoSyncPeppy);
 		else {
 			// Check for other ship orbiting
-			if (otherShipOrbiting) {
-				invert_pose(lastShip);
-				glLoadIdentity();
-				invert_pose(geosyncTargetFalco);
-				glTranslatef(0,-0.3,geoSyncDistanceFalco);
-				glRotatef(10,1,0,0);
-				glMultMatrixf(geosyncTargetFalco);
-				glMultMatrixf(lastShip);
-				glGetFloatv(GL_MODELVIEW_MATRIX, geoSyncFalco);
-			}
+			if (otherShipOrbiting)
+				geoSyncOrbit(orbitPlanet, geoSyncDistanceFalco, geoSyncFalco);
 			else
-				glLoadMatrixf(geoSyncFalco);
+				modelview.load(geoSyncFalco);
 		}
 	}
 }
 
+// Loads the camera for a ship orbiting a planet: distance in front of it,
+// a little above and looking slightly down, turning with the planet. The
+// planet's world matrix comes straight from the frame's scene graph. The view is also
+// saved, so it can be loaded again once the ship stops following.
+void geoSyncOrbit(int planetIndex, float distance, float *saved) {
+	// a scene can have fewer bodies than there are number keys
+	planetIndex = std::min(planetIndex, (int)spinNodes.size() - 1);
+	float target[16];
+	mat4Copy(shownFrame->scene.world(spinNodes[planetIndex]), target);
+	invert_pose(target);
+	modelview.loadIdentity();
+	modelview.translate(0,-0.3,distance);
+	modelview.rotate(10,1,0,0);
+	modelview.mult(target);
+	modelview.get(saved);
+}
+
+// Number of slices for a ship's hull (0 for Falco's, 1 for Peppy's) at the
+// current modelview matrix, which should be the ship's pose
+int shipSlices(int ship) {
+	float pixels = projectedRadius(SHIP_RADIUS, modelview.top(), pixelScale);
+	int &level = shipLevels[lodView][ship];
+	level = shipLod.select(pixels, level);
+	return shipLod.segments(level);
+}
+
 // Method to draw a ship
 void drawShip(int slices){
-	glRotatef(180,0,1,0);
-	glScalef(0.1,0.1,0.1);
-	GLUquadricObj* qobj = gluNewQuadric();
-	gluQuadricDrawStyle(qobj, GLU_SMOOTH);
-	gluQuadricTexture(qobj, true);
-	glTranslatef(0,0,-1.5f);
-	glPushMatrix();
-	glScaled(1, 1, 4);
-	gluCylinder(qobj, 0.7, 0.3, 1.0, slices, 5);
-	glPopMatrix();
-	glPushMatrix();
-	glRotatef(-10, 0, 0, 1);
-	drawWing();
-	glRotatef(30, 0, 0, 1);
-	drawWing();
-	glRotatef(-180, 0, 0, 1);
-	drawWing();
-	glRotatef(-30, 0, 0, 1);
-	drawWing();
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0, 0, 4);
-	gluCylinder(qobj, 0.3, 0, 0.4, slices, 5);
-	glPopMatrix();
+	ProfileScope scope("drawShip");
+	modelview.rotate(180,0,1,0);
+	modelview.scale(0.1,0.1,0.1);
+	modelview.translate(0,0,-1.5f);
+	modelview.push();
+	modelview.scale(1, 1, 4);
+	drawCylinder(0.7, 0.3, 1.0, slices, 5);
+	modelview.pop();
+	modelview.push();
+	modelview.rotate(-10, 0, 0, 1);
+	drawWing(slices);
+	modelview.rotate(30, 0, 0, 1);
+	drawWing(slices);
+	modelview.rotate(-180, 0, 0, 1);
+	drawWing(slices);
+	modelview.rotate(-30, 0, 0, 1);
+	drawWing(slices);
+	modelview.pop();
+	modelview.push();
+	modelview.translate(0, 0, 4);
+	drawCylinder(0.3, 0, 0.4, slices, 5);
+	modelview.pop();
 }
 
 // Method to draw a wing of the ship
-void drawWing(){
-	glPushMatrix();
-	glScaled(2.5, 0.1, 1);
-	glTranslatef(0.5, 0, 0.5);
-	glutSolidCube(1);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(2.5, 0, 0);
-	drawCannon();
-	glPopMatrix();
+void drawWing(int slices){
+	modelview.push();
+	modelview.scale(2.5, 0.1, 1);
+	modelview.translate(0.5, 0, 0.5);
+	drawCube(1);
+	modelview.pop();
+	modelview.push();
+	modelview.translate(2.5, 0, 0);
+	drawCannon(slices);
+	modelview.pop();
 }
 
-// Method to draw a cannon on the ship
-void drawCannon(){
-	GLUquadricObj* qobj = gluNewQuadric();
-	gluQuadricTexture(qobj, true);
-	glPushMatrix();
-	gluQuadricDrawStyle(qobj, GLU_FILL);
-	gluCylinder(qobj, 0.1, 0.1, 1.2, 10, 5);
-	gluCylinder(qobj, 0.05, 0.05, 2.4, 10, 5);
-	glPopMatrix();
+// Method to draw a cannon on the ship. The cannons are thin, so they never
+// need more than 10 slices.
+void drawCannon(int slices){
+	modelview.push();
+	drawCylinder(0.1, 0.1, 1.2, std::min(slices, 10), 5);
+	drawCylinder(0.05, 0.05, 2.4, std::min(slices, 10), 5);
+	modelview.pop();
+}
+
+// Adds the result of a frustum test to the counts for the view being drawn
+bool countCulling(bool visible) {
+	if (visible)
+		cullStats[lodView].drawn++;
+	else
+		cullStats[lodView].culled++;
+	countFrame(visible ? COUNTER_DRAWN : COUNTER_CULLED, 1);
+	return visible;
+}
+
+// Frustum tests for the view being drawn, counted for it. The first is for a
+// sphere at the origin of the current modelview matrix, the second for one
+// centered somewhere in the current modelview's space.
+bool inView(float radius) {
+	return countCulling(frustum.sphereVisibleAt(modelview.top(), radius));
+}
+
+bool inView(const float center[3], float radius) {
+	// the same matrix moved to the center, so its scale still applies
+	float moved[16];
+	modelview.get(moved);
+	mat4TransformPoint(modelview.top(), center, moved + 12);
+	return countCulling(frustum.sphereVisibleAt(moved, radius));
+}
+
+// Draws a body from the store as a sphere at the current modelview matrix,
+// tessellated for its size on screen, if cullSolarSystem found it in view
+void drawBody(int index) {
+	if (!countCulling(bodyVisible[index] != 0))
+		return;
+	int slices = sphereLod.segments(bodyLevels[lodView][index]);
+	drawSphere(bodies.radius[index], slices, slices / 2);
+}
+
+// Helpers that draw cached meshes in place of the glut/glu shape functions.
+// They take the same arguments as glutSolidSphere, gluDisk, gluCylinder and
+// glutSolidCube, but never allocate or tessellate anything once the mesh exists.
+// Each one queues the mesh at the current top of the modelview stack.
+void drawSphere(float radius, int slices, int stacks) {
+	modelview.push();
+	modelview.scale(radius, radius, radius);
+	queue->submit(meshes->sphere(slices, stacks), modelview.top());
+	modelview.pop();
+}
+
+void drawDisk(float inner, float outer, int slices, int loops) {
+	queue->submit(meshes->disk(inner, outer, slices, loops), modelview.top());
+}
+
+void drawCylinder(float base, float top, float height, int slices, int stacks) {
+	queue->submit(meshes->cylinder(base, top, height, slices, stacks), modelview.top());
+}
+
+void drawCube(float size) {
+	modelview.push();
+	modelview.scale(size, size, size);
+	queue->submit(meshes->cube(), modelview.top());
+	modelview.pop();
+}
+
+// The color of the draws that follow, glColor4f as it was
+void setColor(float r, float g, float b, float a) {
+	queue->setColor(r, g, b, a);
+}
+
+// Turns lighting on or off for the draws that follow
+void setLighting(bool on) {
+	queue->setLighting(on);
 }
 
 
 
 
-// inversion routine originally from MESA
+// Inverts a pose matrix in place. Poses are nearly always a rotation plus a
+// translation, and those are inverted by transposing the rotation instead of
+// going through the general cofactor inverse.
 bool invert_pose( float *m ){
-	float inv[16], det;
-	int i;
-
-	inv[0] = m[5] * m[10] * m[15] -
-		m[5] * m[11] * m[14] -
-		m[9] * m[6] * m[15] +
-		m[9] * m[7] * m[14] +
-		m[13] * m[6] * m[11] -
-		m[13] * m[7] * m[10];
-
-	inv[4] = -m[4] * m[10] * m[15] +
-		m[4] * m[11] * m[14] +
-		m[8] * m[6] * m[15] -
-		m[8] * m[7] * m[14] -
-		m[12] * m[6] * m[11] +
-		m[12] * m[7] * m[10];
-
-	inv[8] = m[4] * m[9] * m[15] -
-		m[4] * m[11] * m[13] -
-		m[8] * m[5] * m[15] +
-		m[8] * m[7] * m[13] +
-		m[12] * m[5] * m[11] -
-		m[12] * m[7] * m[9];
-
-	inv[12] = -m[4] * m[9] * m[14] +
-		m[4] * m[10] * m[13] +
-		m[8] * m[5] * m[14] -
-		m[8] * m[6] * m[13] -
-		m[12] * m[5] * m[10] +
-		m[12] * m[6] * m[9];
-
-	inv[1] = -m[1] * m[10] * m[15] +
-		m[1] * m[11] * m[14] +
-		m[9] * m[2] * m[15] -
-		m[9] * m[3] * m[14] -
-		m[13] * m[2] * m[11] +
-		m[13] * m[3] * m[10];
-
-	inv[5] = m[0] * m[10] * m[15] -
-		m[0] * m[11] * m[14] -
-		m[8] * m[2] * m[15] +
-		m[8] * m[3] * m[14] +
-		m[12] * m[2] * m[11] -
-		m[12] * m[3] * m[10];
-
-	inv[9] = -m[0] * m[9] * m[15] +
-		m[0] * m[11] * m[13] +
-		m[8] * m[1] * m[15] -
-		m[8] * m[3] * m[13] -
-		m[12] * m[1] * m[11] +
-		m[12] * m[3] * m[9];
-
-	inv[13] = m[0] * m[9] * m[14] -
-		m[0] * m[10] * m[13] -
-		m[8] * m[1] * m[14] +
-		m[8] * m[2] * m[13] +
-		m[12] * m[1] * m[10] -
-		m[12] * m[2] * m[9];
-
-	inv[2] = m[1] * m[6] * m[15] -
-		m[1] * m[7] * m[14] -
-		m[5] * m[2] * m[15] +
-		m[5] * m[3] * m[14] +
-		m[13] * m[2] * m[7] -
-		m[13] * m[3] * m[6];
-
-	inv[6] = -m[0] * m[6] * m[15] +
-		m[0] * m[7] * m[14] +
-		m[4] * m[2] * m[15] -
-		m[4] * m[3] * m[14] -
-		m[12] * m[2] * m[7] +
-		m[12] * m[3] * m[6];
-
-	inv[10] = m[0] * m[5] * m[15] -
-		m[0] * m[7] * m[13] -
-		m[4] * m[1] * m[15] +
-		m[4] * m[3] * m[13] +
-		m[12] * m[1] * m[7] -
-		m[12] * m[3] * m[5];
-
-	inv[14] = -m[0] * m[5] * m[14] +
-		m[0] * m[6] * m[13] +
-		m[4] * m[1] * m[14] -
-		m[4] * m[2] * m[13] -
-		m[12] * m[1] * m[6] +
-		m[12] * m[2] * m[5];
-
-	inv[3] = -m[1] * m[6] * m[11] +
-		m[1] * m[7] * m[10] +
-		m[5] * m[2] * m[11] -
-		m[5] * m[3] * m[10] -
-		m[9] * m[2] * m[7] +
-		m[9] * m[3] * m[6];
-
-	inv[7] = m[0] * m[6] * m[11] -
-		m[0] * m[7] * m[10] -
-		m[4] * m[2] * m[11] +
-		m[4] * m[3] * m[10] +
-		m[8] * m[2] * m[7] -
-		m[8] * m[3] * m[6];
-
-	inv[11] = -m[0] * m[5] * m[11] +
-		m[0] * m[7] * m[9] +
-		m[4] * m[1] * m[11] -
-		m[4] * m[3] * m[9] -
-		m[8] * m[1] * m[7] +
-		m[8] * m[3] * m[5];
-
-	inv[15] = m[0] * m[5] * m[10] -
-		m[0] * m[6] * m[9] -
-		m[4] * m[1] * m[10] +
-		m[4] * m[2] * m[9] +
-		m[8] * m[1] * m[6] -
-		m[8] * m[2] * m[5];
-
-	det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
-
-	if (det == 0)
-		return false;
+	if (mat4IsRigid(m)) {
+		mat4InvertRigid(m, m);
+		return true;
+	}
+	return mat4Invert(m, m);
+}
 
-	det = 1.0 / det;
 
-	for (i = 0; i < 16; i++)
-		m[i] = inv[i] * det;
 
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+/// Headless Rendering ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Creates the surfaceless context and one framebuffer per ship view, and sets
+// up both views in it. GLUT never gets initialized, so the window handles are
+// fixed at the numbers GLUT would have given them.
+bool startHeadless( HeadlessContext &context, OffscreenTarget targets[2] ){
+	if (frameDirectory && !makeOutputDirectory(frameDirectory))
+		return false;
+	if (!context.create(coreProfile))
+		return false;
+	std::cout << "headless: rendering on " << context.renderer() << std::endl;
+
+	mother_window = 1;
+	scout_window = 2;
+	if (viewportCount > 0) {
+		// one target holding the whole grid, each cell the size of a window
+		int columns, rows;
+		viewportGrid(viewportCount, columns, rows);
+		if (!createTarget(targets[0], columns * disp_width, rows * disp_height))
+			return false;
+		bindTarget(targets[0]);
+		initView(1, targets[0].width, targets[0].height);
+		return true;
+	}
+	for (int window = 1; window <= 2; window++) {
+		if (!createTarget(targets[window-1], disp_width, disp_height))
+			return false;
+		bindTarget(targets[window-1]);
+		initView(window, disp_width, disp_height);
+	}
 	return true;
 }
 
+// Advances the simulation by one step and draws both views, in the same order
+// GLUT would draw the two windows. glFinish stands in for the buffer swap.
+// frame numbers the files written to --output; a negative one isn't written.
+// Returns false if a frame couldn't be written.
+bool renderHeadlessFrame( OffscreenTarget targets[2], int frame ){
+	profiler.beginFrame();
+	ProfileScope scope("renderHeadlessFrame", true);
+	// exactly one step per frame, so offscreen runs don't depend on how fast
+	// they go. The ships fly by the real time that step stands for.
+	advanceSimulation(simClock.getStepSeconds() / simClock.getTimeScale(), true);
+
+	bool written = true;
+	if (viewportCount > 0) {
+		bindTarget(targets[0]);
+		renderViewports(targets[0].width, targets[0].height);
+		if (showProfileGraph)
+			profileGraphs[0].draw(profiler, targets[0].width, targets[0].height);
+		if (frameDirectory && frame >= 0) {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/views_%05d.ppm", frameDirectory, frame);
+			written = writeTarget(targets[0], path);
+		}
+		{
+			ProfileScope finishScope("glFinish");
+			glFinish();
+		}
+		markPhase(PHASE_SWAP);
+		return written;
+	}
 
+	for (int window = 1; window <= 2; window++) {
+		bindTarget(targets[window-1]);
+		renderView(window, disp_width, disp_height);
+		if (showProfileGraph)
+			profileGraphs[window-1].draw(profiler, disp_width, disp_height);
+
+		if (frameDirectory && frame >= 0) {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%s_%05d.ppm", frameDirectory,
+				window == mother_window ? "falco" : "peppy", frame);
+			written = writeTarget(targets[window-1], path) && written;
+		}
+	}
+	{
+		ProfileScope finishScope("glFinish");
+		glFinish();
+	}
+	markPhase(PHASE_SWAP);
+	return written;
+}
+
+void stopHeadless( HeadlessContext &context, OffscreenTarget targets[2] ){
+	for (int window = 1; window <= (viewportCount > 0 ? 1 : 2); window++) {
+		releaseView(window);
+		destroyTarget(targets[window-1]);
+	}
+	context.destroy();
+}
+
+// Runs the program with no windows for headlessFrames frames. Returns the
+// process exit code.
+int runHeadless(){
+	HeadlessContext context;
+	OffscreenTarget targets[2];
+	if (!startHeadless(context, targets))
+		return 1;
+
+	bool written = true;
+	for (int frame = 0; frame < headlessFrames && !quit && written; frame++)
+		written = renderHeadlessFrame(targets, frame);
+
+	stopSimThread();
+	reportJobs();
+	if (nbodyMode)
+		reportGravity();
+	inputRecorder.close();
+	snapshotWriter.wait();
+	reportSnapshots();
+	writeProfile();
+	stopHeadless(context, targets);
+	return written ? 0 : 1;
+}
+
+// Runs the scripted benchmark session headless and reports per-phase frame
+// times for each camera mode. With --replay the session is the log instead,
+// and frames are grouped by the camera mode they were drawn in. Returns the
+// process exit code.
+int runBenchmark(){
+	HeadlessContext context;
+	OffscreenTarget targets[2];
+	if (!startHeadless(context, targets))
+		return 1;
+
+	FrameTimings timings;
+	for (int mode = 0; mode < benchmarkModeCount(); mode++)
+		timings.addGroup(benchmarkModeName(mode));
+	setPhaseTimings(&timings);
+
+	// one frame that isn't timed, so first-use costs don't land in the
+	// results. A replay's first frame is this one, and is written as frame 0
+	// with the rest after it; the scripted session's isn't written at all.
+	bool written = renderHeadlessFrame(targets, replayPath ? 0 : -1);
+
+	int frames = replaying ? headlessFrames - 1 : headlessFrames;
+	for (int frame = 0; frame < frames && !quit && written; frame++) {
+		if (!replaying) {
+			std::string keys = benchmarkKeys(frame, headlessFrames);
+			for (size_t i = 0; i < keys.size(); i++)
+				keyboard_callback(keys[i], 0, 0);
+		}
+
+		timings.beginFrame();
+		written = renderHeadlessFrame(targets, replayPath ? frame + 1 : frame);
+		if (replayPath)
+			timings.endFrame(inGeosyncMode ? 2 : inRelativeMode ? 1 : 0);
+		else
+			timings.endFrame(benchmarkMode(frame, headlessFrames));
+	}
+	setPhaseTimings(NULL);
+
+	timings.print(stdout);
+	if (benchmarkJson) {
+		FILE *out = fopen(benchmarkJson, "w");
+		if (!out) {
+			std::cerr << "benchmark: could not write " << benchmarkJson << std::endl;
+		}
+		else {
+			// only numbers go through the buffer, which they can't fill; the
+			// driver's name is escaped and appended whatever its length
+			char fields[256];
+			snprintf(fields, sizeof(fields), "\"frames\": %d, \"width\": %d, \"height\": %d, \"viewports\": %d, \"core\": %s, ",
+				headlessFrames, disp_width, disp_height, viewportCount, coreProfile ? "true" : "false");
+			timings.writeJson(out, fields + std::string("\"renderer\": ") + jsonString(context.renderer()));
+			fclose(out);
+		}
+	}
+
+	stopSimThread();
+	reportJobs();
+	if (nbodyMode)
+		reportGravity();
+	inputRecorder.close();
+	snapshotWriter.wait();
+	reportSnapshots();
+	writeProfile();
+	stopHeadless(context, targets);
+	return written ? 0 : 1;
+}
+
+// Options from the command line that decide how the session plays out, for
+// an input log to carry: everything but where the output goes, how many
+// frames to run and which log to use. A replay's own options come first.
+std::vector<std::string> sessionOptions( int argc, char **argv ){
+	std::vector<std::string> options = inputReplay.getOptions();
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--headless") || !strcmp(argv[i], "--benchmark") || !strcmp(argv[i], "--realtime"))
+			continue;
+		if (!strcmp(argv[i], "--frames") || !strcmp(argv[i], "--output") || !strcmp(argv[i], "--json")
+			|| !strcmp(argv[i], "--record") || !strcmp(argv[i], "--replay") || !strcmp(argv[i], "--compile-scene")
+			|| !strcmp(argv[i], "--profile") || !strcmp(argv[i], "--jobs")) {
+			i++;
+			continue;
+		}
+		options.push_back(argv[i]);
+	}
+	return options;
+}
+
+// Reads the program's own command line options. GLUT options are left for glutInit.
+void parseOptions( int argc, char **argv ){
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			headlessFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+			frameDirectory = argv[++i];
+		else if (!strcmp(argv[i], "--benchmark"))
+			benchmark = true;
+		else if (!strcmp(argv[i], "--bench-matrix"))
+			matrixBenchmark = true;
+		else if (!strcmp(argv[i], "--bench-bodies") && i + 1 < argc)
+			bodyBenchmarkCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bench-nbody") && i + 1 < argc)
+			nbodyBenchmarkCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--bench-kepler") && i + 1 < argc)
+			keplerBenchmarkCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--kepler"))
+			keplerMode = true;
+		else if (!strcmp(argv[i], "--seek") && i + 1 < argc)
+			ephemerisTime = atof(argv[++i]) * EARTH_YEAR;
+		else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+			nbodySteps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--theta") && i + 1 < argc) {
+			float theta = (float)atof(argv[++i]);
+			if (theta > 0 && theta <= NBodySystem::MAX_THETA)
+				nbodyTheta = theta;
+			else
+				std::cerr << "--theta " << argv[i] << " is out of range, use more than 0 and up to "
+					<< NBodySystem::MAX_THETA << std::endl;
+		}
+		else if (!strcmp(argv[i], "--dt") && i + 1 < argc)
+			nbodyDt = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			nbodyThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--nbody"))
+			nbodyMode = true;
+		else if (!strcmp(argv[i], "--viewports") && i + 1 < argc)
+			viewportCount = std::max(2, std::min(MAX_VIEWS, atoi(argv[++i])));
+		else if (!strcmp(argv[i], "--belt") && i + 1 < argc)
+			beltCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+			scenePath = argv[++i];
+		else if (!strcmp(argv[i], "--compile-scene") && i + 1 < argc)
+			compiledScenePath = argv[++i];
+		else if (!strcmp(argv[i], "--bench-scene") && i + 1 < argc)
+			sceneBenchmarkCount = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--json") && i + 1 < argc)
+			benchmarkJson = argv[++i];
+		else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+			recordPath = argv[++i];
+		else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (!strcmp(argv[i], "--realtime"))
+			replayRealtime = true;
+		else if (!strcmp(argv[i], "--snapshot") && i + 1 < argc)
+			snapshotPath = argv[++i];
+		else if (!strcmp(argv[i], "--restore") && i + 1 < argc)
+			restorePath = argv[++i];
+		else if (!strcmp(argv[i], "--core"))
+			coreProfile = true;
+		else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+			profilePath = argv[++i];
+		else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+			jobThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--sim-thread"))
+			simThreadOption = 1;
+		else if (!strcmp(argv[i], "--no-sim-thread"))
+			simThreadOption = 0;
+		else if (!strcmp(argv[i], "--fps") && i + 1 < argc)
+			scheduler.setPeriodMs(1000.0 / std::max(1.0, atof(argv[++i])));
+		else if (!strcmp(argv[i], "--schedule") && i + 1 < argc) {
+			const char *mode = argv[++i];
+			if (!strcmp(mode, "deadline"))
+				scheduler.setMode(SCHEDULE_DEADLINE);
+			else if (!strcmp(mode, "vsync"))
+				scheduler.setMode(SCHEDULE_VSYNC);
+			else if (!strcmp(mode, "uncapped"))
+				scheduler.setMode(SCHEDULE_UNCAPPED);
+			else
+				std::cerr << "unknown --schedule " << mode << ", use deadline, vsync or uncapped" << std::endl;
+		}
+	}
+}
+
+// Vsync frames wait on the mothership's swap alone, since a second window
+// waiting too would halve the rate; uncapped frames don't wait on any. Deadline
+// frames leave the swap as the driver has it.
+void setSwapIntervals(){
+	if (scheduler.getMode() == SCHEDULE_DEADLINE)
+		return;
+	glutSetWindow( mother_window );
+	bool ok = setSwapInterval(scheduler.getMode() == SCHEDULE_VSYNC ? 1 : 0);
+	if (viewportCount == 0) {
+		glutSetWindow( scout_window );
+		ok = setSwapInterval(0) && ok;
+	}
+	if (!ok)
+		std::cerr << "scheduler: can't set the swap interval, frames are paced by the driver's" << std::endl;
+}
 
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
@@ -1176,11 +2527,88 @@ bool invert_pose( float *m ){
 //////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////
 int main( int argc, char **argv ){
+	parseOptions( argc, argv );
+	if (replayPath) {
+		if (!inputReplay.open(replayPath))
+			return 1;
+		// the logged options first, so any given now take over from them
+		std::vector<char *> logged(1, argv[0]);
+		for (size_t i = 0; i < inputReplay.getOptions().size(); i++)
+			logged.push_back(const_cast<char *>(inputReplay.getOptions()[i].c_str()));
+		parseOptions((int)logged.size(), &logged[0]);
+		parseOptions(argc, argv);
+		replaying = true;
+		headlessFrames = inputReplay.getFrameCount();
+		std::cout << "replay: " << headlessFrames << " frames from " << replayPath << std::endl;
+	}
+	if (matrixBenchmark)
+		return runMatrixBenchmark(benchmarkJson);
+	if (bodyBenchmarkCount > 0)
+		return runBodyBenchmark(bodyBenchmarkCount, benchmarkJson);
+	if (nbodyBenchmarkCount > 0)
+		return runNBodyBenchmark(nbodyBenchmarkCount, nbodySteps, nbodyTheta, nbodyDt, nbodyThreads, benchmarkJson);
+	if (keplerBenchmarkCount > 0)
+		return runKeplerBenchmark(keplerBenchmarkCount, benchmarkJson);
+	if (sceneBenchmarkCount > 0)
+		return runSceneBenchmark(sceneBenchmarkCount, benchmarkJson);
+	if (!sceneFile.load(scenePath))
+		return 1;
+	if (compiledScenePath) {
+		if (!sceneFile.save(compiledScenePath))
+			return 1;
+		std::cout << "scene: " << sceneFile.count() << " bodies written to " << compiledScenePath << std::endl;
+		return 0;
+	}
+	// no view has picked a detail level for either ship yet
+	for (int view = 0; view < MAX_VIEWS; view++)
+		shipLevels[view][0] = shipLevels[view][1] = -1;
+	jobs.start(jobThreads);
+	std::cout << "jobs: " << jobs.getThreads() << " threads" << std::endl;
+	initBodies();
+	if (restorePath && !loadSnapshot(restorePath))
+		return 1;
+	if (recordPath && !inputRecorder.open(recordPath, sessionOptions(argc, argv)))
+		return 1;
+	if (profilePath || (!benchmark && !headless))
+		setProfiler(&profiler);
+	startSimThread();
+	if (benchmark)
+		return runBenchmark();
+	if (headless)
+		return runHeadless();
+
 	// initialize glut
 	glutInit( &argc, argv );
 
 	// use double-buffered RGB+Alpha framebuffers with a depth buffer.
 	glutInitDisplayMode( GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE );
+#if defined(GLUT_CORE_PROFILE)
+	if (coreProfile) {
+		glutInitContextVersion( 3, 3 );
+		glutInitContextProfile( GLUT_CORE_PROFILE );
+	}
+#else
+	if (coreProfile)
+		std::cerr << "--core needs freeglut to ask for a core profile context" << std::endl;
+#endif
+
+	// with --viewports every view goes in one window, a grid of window sized cells
+	if (viewportCount > 0) {
+		int columns, rows;
+		viewportGrid(viewportCount, columns, rows);
+		glutInitWindowSize( columns * disp_width, rows * disp_height );
+		glutInitWindowPosition( 0, 100 );
+		mother_window = glutCreateWindow( "Falco + Peppy" );
+		scout_window = -1;
+		glutKeyboardFunc( keyboard_callback );
+		glutDisplayFunc( display_callback );
+		glutReshapeFunc( resize_callback );
+		init();
+		setSwapIntervals();
+		idle( 0 );
+		glutMainLoop();
+		return 0;
+	}
 
 	// initialize the mothership window
 	glutInitWindowSize( disp_width, disp_height );
@@ -1202,6 +2630,7 @@ int main( int argc, char **argv ){
 	init();
 	glutSetWindow( scout_window );
 	init();
+	setSwapIntervals();
 
 	// start the idle on a fixed timer callback
 	idle( 0 );
@@ -0,0 +1,336 @@
+#include "matrix.h"
+
+#include<math.h>
+
+static const float PI = 3.14159265358979f;
+
+void mat4Identity(float *m) {
+	for (int i = 0; i < 16; i++)
+		m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+}
+
+void mat4Copy(const float *src, float *dst) {
+	for (int i = 0; i < 16; i++)
+		dst[i] = src[i];
+}
+
+void mat4Multiply(const float *a, const float *b, float *out) {
+	float r[16];
+	for (int col = 0; col < 4; col++) {
+		for (int row = 0; row < 4; row++) {
+			r[col*4 + row] = a[row] * b[col*4]
+				+ a[4 + row] * b[col*4 + 1]
+				+ a[8 + row] * b[col*4 + 2]
+				+ a[12 + row] * b[col*4 + 3];
+		}
+	}
+	mat4Copy(r, out);
+}
+
+void mat4TransformPoint(const float *m, const float *p, float *out) {
+	float x = p[0], y = p[1], z = p[2];
+	out[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+	out[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+	out[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+}
+
+void mat4NormalMatrix(const float *m, float *out) {
+	// each column is the cross product of the other two columns of m
+	out[0] = m[5] * m[10] - m[6] * m[9];
+	out[1] = m[6] * m[8] - m[4] * m[10];
+	out[2] = m[4] * m[9] - m[5] * m[8];
+	out[3] = m[2] * m[9] - m[1] * m[10];
+	out[4] = m[0] * m[10] - m[2] * m[8];
+	out[5] = m[1] * m[8] - m[0] * m[9];
+	out[6] = m[1] * m[6] - m[2] * m[5];
+	out[7] = m[2] * m[4] - m[0] * m[6];
+	out[8] = m[0] * m[5] - m[1] * m[4];
+}
+
+void mat4Rotation(float angle, float x, float y, float z, float *out) {
+	mat4Identity(out);
+	float len = sqrtf(x*x + y*y + z*z);
+	if (len == 0)
+		return;
+	x /= len; y /= len; z /= len;
+	float c = cosf(angle * PI / 180), s = sinf(angle * PI / 180), t = 1 - c;
+	out[0] = t*x*x + c;   out[4] = t*x*y - s*z; out[8] = t*x*z + s*y;
+	out[1] = t*x*y + s*z; out[5] = t*y*y + c;   out[9] = t*y*z - s*x;
+	out[2] = t*x*z - s*y; out[6] = t*y*z + s*x; out[10] = t*z*z + c;
+}
+
+void mat4Translation(float x, float y, float z, float *out) {
+	mat4Identity(out);
+	out[12] = x;
+	out[13] = y;
+	out[14] = z;
+}
+
+void mat4Scaling(float x, float y, float z, float *out) {
+	mat4Identity(out);
+	out[0] = x;
+	out[5] = y;
+	out[10] = z;
+}
+
+void mat4LookAt(float eyeX, float eyeY, float eyeZ,
+	float centerX, float centerY, float centerZ,
+	float upX, float upY, float upZ, float *out) {
+	float f[3] = {centerX - eyeX, centerY - eyeY, centerZ - eyeZ};
+	float flen = sqrtf(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+	if (flen > 0) {
+		f[0] /= flen; f[1] /= flen; f[2] /= flen;
+	}
+
+	// side = forward x up, then up is recomputed as side x forward
+	float s[3] = {f[1]*upZ - f[2]*upY, f[2]*upX - f[0]*upZ, f[0]*upY - f[1]*upX};
+	float slen = sqrtf(s[0]*s[0] + s[1]*s[1] + s[2]*s[2]);
+	if (slen > 0) {
+		s[0] /= slen; s[1] /= slen; s[2] /= slen;
+	}
+	float u[3] = {s[1]*f[2] - s[2]*f[1], s[2]*f[0] - s[0]*f[2], s[0]*f[1] - s[1]*f[0]};
+
+	mat4Identity(out);
+	out[0] = s[0]; out[4] = s[1]; out[8] = s[2];
+	out[1] = u[0]; out[5] = u[1]; out[9] = u[2];
+	out[2] = -f[0]; out[6] = -f[1]; out[10] = -f[2];
+	out[12] = -(s[0]*eyeX + s[1]*eyeY + s[2]*eyeZ);
+	out[13] = -(u[0]*eyeX + u[1]*eyeY + u[2]*eyeZ);
+	out[14] = f[0]*eyeX + f[1]*eyeY + f[2]*eyeZ;
+}
+
+void mat4Perspective(float fovy, float aspect, float zNear, float zFar, float *out) {
+	float f = 1.0f / tanf(fovy * PI / 360);
+	for (int i = 0; i < 16; i++)
+		out[i] = 0;
+	out[0] = f / aspect;
+	out[5] = f;
+	out[10] = (zFar + zNear) / (zNear - zFar);
+	out[11] = -1;
+	out[14] = 2 * zFar * zNear / (zNear - zFar);
+}
+
+void mat4Ortho(float left, float right, float bottom, float top, float zNear, float zFar, float *out) {
+	mat4Identity(out);
+	out[0] = 2 / (right - left);
+	out[5] = 2 / (top - bottom);
+	out[10] = -2 / (zFar - zNear);
+	out[12] = -(right + left) / (right - left);
+	out[13] = -(top + bottom) / (top - bottom);
+	out[14] = -(zFar + zNear) / (zFar - zNear);
+}
+
+// inversion routine originally from MESA
+bool mat4Invert(const float *m, float *out) {
+	float inv[16], det;
+	int i;
+
+	inv[0] = m[5] * m[10] * m[15] -
+		m[5] * m[11] * m[14] -
+		m[9] * m[6] * m[15] +
+		m[9] * m[7] * m[14] +
+		m[13] * m[6] * m[11] -
+		m[13] * m[7] * m[10];
+
+	inv[4] = -m[4] * m[10] * m[15] +
+		m[4] * m[11] * m[14] +
+		m[8] * m[6] * m[15] -
+		m[8] * m[7] * m[14] -
+		m[12] * m[6] * m[11] +
+		m[12] * m[7] * m[10];
+
+	inv[8] = m[4] * m[9] * m[15] -
+		m[4] * m[11] * m[13] -
+		m[8] * m[5] * m[15] +
+		m[8] * m[7] * m[13] +
+		m[12] * m[5] * m[11] -
+		m[12] * m[7] * m[9];
+
+	inv[12] = -m[4] * m[9] * m[14] +
+		m[4] * m[10] * m[13] +
+		m[8] * m[5] * m[14] -
+		m[8] * m[6] * m[13] -
+		m[12] * m[5] * m[10] +
+		m[12] * m[6] * m[9];
+
+	inv[1] = -m[1] * m[10] * m[15] +
+		m[1] * m[11] * m[14] +
+		m[9] * m[2] * m[15] -
+		m[9] * m[3] * m[14] -
+		m[13] * m[2] * m[11] +
+		m[13] * m[3] * m[10];
+
+	inv[5] = m[0] * m[10] * m[15] -
+		m[0] * m[11] * m[14] -
+		m[8] * m[2] * m[15] +
+		m[8] * m[3] * m[14] +
+		m[12] * m[2] * m[11] -
+		m[12] * m[3] * m[10];
+
+	inv[9] = -m[0] * m[9] * m[15] +
+		m[0] * m[11] * m[13] +
+		m[8] * m[1] * m[15] -
+		m[8] * m[3] * m[13] -
+		m[12] * m[1] * m[11] +
+		m[12] * m[3] * m[9];
+
+	inv[13] = m[0] * m[9] * m[14] -
+		m[0] * m[10] * m[13] -
+		m[8] * m[1] * m[14] +
+		m[8] * m[2] * m[13] +
+		m[12] * m[1] * m[10] -
+		m[12] * m[2] * m[9];
+
+	inv[2] = m[1] * m[6] * m[15] -
+		m[1] * m[7] * m[14] -
+		m[5] * m[2] * m[15] +
+		m[5] * m[3] * m[14] +
+		m[13] * m[2] * m[7] -
+		m[13] * m[3] * m[6];
+
+	inv[6] = -m[0] * m[6] * m[15] +
+		m[0] * m[7] * m[14] +
+		m[4] * m[2] * m[15] -
+		m[4] * m[3] * m[14] -
+		m[12] * m[2] * m[7] +
+		m[12] * m[3] * m[6];
+
+	inv[10] = m[0] * m[5] * m[15] -
+		m[0] * m[7] * m[13] -
+		m[4] * m[1] * m[15] +
+		m[4] * m[3] * m[13] +
+		m[12] * m[1] * m[7] -
+		m[12] * m[3] * m[5];
+
+	inv[14] = -m[0] * m[5] * m[14] +
+		m[0] * m[6] * m[13] +
+		m[4] * m[1] * m[14] -
+		m[4] * m[2] * m[13] -
+		m[12] * m[1] * m[6] +
+		m[12] * m[2] * m[5];
+
+	inv[3] = -m[1] * m[6] * m[11] +
+		m[1] * m[7] * m[10] +
+		m[5] * m[2] * m[11] -
+		m[5] * m[3] * m[10] -
+		m[9] * m[2] * m[7] +
+		m[9] * m[3] * m[6];
+
+	inv[7] = m[0] * m[6] * m[11] -
+		m[0] * m[7] * m[10] -
+		m[4] * m[2] * m[11] +
+		m[4] * m[3] * m[10] +
+		m[8] * m[2] * m[7] -
+		m[8] * m[3] * m[6];
+
+	inv[11] = -m[0] * m[5] * m[11] +
+		m[0] * m[7] * m[9] +
+		m[4] * m[1] * m[11] -
+		m[4] * m[3] * m[9] -
+		m[8] * m[1] * m[7] +
+		m[8] * m[3] * m[5];
+
+	inv[15] = m[0] * m[5] * m[10] -
+		m[0] * m[6] * m[9] -
+		m[4] * m[1] * m[10] +
+		m[4] * m[2] * m[9] +
+		m[8] * m[1] * m[6] -
+		m[8] * m[2] * m[5];
+
+	det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+
+	if (det == 0)
+		return false;
+
+	det = 1.0 / det;
+
+	for (i = 0; i < 16; i++)
+		out[i] = inv[i] * det;
+
+	return true;
+}
+
+bool mat4IsRigid(const float *m, float tolerance) {
+	if (fabsf(m[3]) > tolerance || fabsf(m[7]) > tolerance || fabsf(m[11]) > tolerance || fabsf(m[15] - 1) > tolerance)
+		return false;
+	// the columns of the upper 3x3 must be orthonormal
+	for (int i = 0; i < 3; i++) {
+		for (int j = i; j < 3; j++) {
+			float dot = m[i*4] * m[j*4] + m[i*4 + 1] * m[j*4 + 1] + m[i*4 + 2] * m[j*4 + 2];
+			if (fabsf(dot - (i == j ? 1 : 0)) > tolerance)
+				return false;
+		}
+	}
+	return true;
+}
+
+void mat4InvertRigid(const float *m, float *out) {
+	// [R t]^-1 = [R^T  -R^T t]
+	float r[16];
+	r[0] = m[0]; r[4] = m[1]; r[8] = m[2];
+	r[1] = m[4]; r[5] = m[5]; r[9] = m[6];
+	r[2] = m[8]; r[6] = m[9]; r[10] = m[10];
+	r[3] = 0; r[7] = 0; r[11] = 0; r[15] = 1;
+	r[12] = -(m[0] * m[12] + m[1] * m[13] + m[2] * m[14]);
+	r[13] = -(m[4] * m[12] + m[5] * m[13] + m[6] * m[14]);
+	r[14] = -(m[8] * m[12] + m[9] * m[13] + m[10] * m[14]);
+	mat4Copy(r, out);
+}
+
+MatrixStack::MatrixStack() : depth(0) {
+	mat4Identity(stack[0]);
+}
+
+void MatrixStack::push() {
+	if (depth + 1 >= MAX_DEPTH)
+		return;
+	mat4Copy(stack[depth], stack[depth + 1]);
+	depth++;
+}
+
+void MatrixStack::pop() {
+	if (depth > 0)
+		depth--;
+}
+
+void MatrixStack::loadIdentity() {
+	mat4Identity(stack[depth]);
+}
+
+void MatrixStack::load(const float *m) {
+	mat4Copy(m, stack[depth]);
+}
+
+void MatrixStack::mult(const float *m) {
+	mat4Multiply(stack[depth], m, stack[depth]);
+}
+
+void MatrixStack::rotate(float angle, float x, float y, float z) {
+	float m[16];
+	mat4Rotation(angle, x, y, z, m);
+	mult(m);
+}
+
+void MatrixStack::translate(float x, float y, float z) {
+	// only the last column changes, so skip the full multiply
+	float *m = stack[depth];
+	for (int row = 0; row < 4; row++)
+		m[12 + row] += m[row] * x + m[4 + row] * y + m[8 + row] * z;
+}
+
+void MatrixStack::scale(float x, float y, float z) {
+	float *m = stack[depth];
+	for (int row = 0; row < 4; row++) {
+		m[row] *= x;
+		m[4 + row] *= y;
+		m[8 + row] *= z;
+	}
+}
+
+void MatrixStack::lookAt(float eyeX, float eyeY, float eyeZ,
+	float centerX, float centerY, float centerZ,
+	float upX, float upY, float upZ) {
+	float m[16];
+	mat4LookAt(eyeX, eyeY, eyeZ, centerX, centerY, centerZ, upX, upY, upZ, m);
+	mult(m);
+}
@@ -0,0 +1,97 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+// 4x4 matrices stored the way OpenGL stores them: 16 floats, column-major,
+// so element (row, col) is m[col*4 + row] and the translation is m[12..14].
+// Every function builds the same matrix the fixed-function GL call of the
+// same name would, so code can move between the two without changing results.
+
+void mat4Identity(float *m);
+void mat4Copy(const float *src, float *dst);
+
+// out = a * b. out may be the same array as a or b.
+void mat4Multiply(const float *a, const float *b, float *out);
+
+// General inverse (the cofactor routine from MESA). Returns false, leaving
+// out untouched, if m is singular. out may be the same array as m.
+bool mat4Invert(const float *m, float *out);
+
+// True if m is a rotation plus a translation, to within tolerance
+bool mat4IsRigid(const float *m, float tolerance = 1e-4f);
+
+// Inverse of a rotation plus translation: the rotation is transposed and the
+// translation rotated back and negated. Only valid if mat4IsRigid(m).
+// out may be the same array as m.
+void mat4InvertRigid(const float *m, float *out);
+
+// Batched kernels over arrays of count matrices stored back to back, 16 floats
+// each: out[i] = a[i] * b[i], and out[i] = rigid inverse of m[i]. out may be
+// the same array as an input. MAT4_BEST picks the fastest kernel the CPU
+// supports; the others are there to benchmark and check against each other.
+enum Mat4Kernel {
+	MAT4_BEST,
+	MAT4_SCALAR,
+	MAT4_SSE,
+	MAT4_AVX
+};
+
+void mat4MultiplyBatch(const float *a, const float *b, float *out, int count, Mat4Kernel kernel = MAT4_BEST);
+void mat4InvertRigidBatch(const float *m, float *out, int count, Mat4Kernel kernel = MAT4_BEST);
+bool mat4KernelSupported(Mat4Kernel kernel);
+// name of the kernel that would actually run ("avx", "sse" or "scalar")
+const char *mat4KernelName(Mat4Kernel kernel);
+
+// Transform the point p (w = 1) by m
+void mat4TransformPoint(const float *m, const float *p, float *out);
+
+// Column-major 3x3 matrix for transforming normals by m, like gl_NormalMatrix
+// but not divided by the determinant: the cofactors of m's upper 3x3. Only
+// right once the normals are normalized again.
+void mat4NormalMatrix(const float *m, float *out);
+
+// Matrices built the same way as glRotatef, glTranslatef, glScalef,
+// gluLookAt, gluPerspective and glOrtho
+void mat4Rotation(float angle, float x, float y, float z, float *out);
+void mat4Translation(float x, float y, float z, float *out);
+void mat4Scaling(float x, float y, float z, float *out);
+void mat4LookAt(float eyeX, float eyeY, float eyeZ,
+	float centerX, float centerY, float centerZ,
+	float upX, float upY, float upZ, float *out);
+void mat4Perspective(float fovy, float aspect, float zNear, float zFar, float *out);
+void mat4Ortho(float left, float right, float bottom, float top, float zNear, float zFar, float *out);
+
+// Host-side replacement for the GL modelview stack. Transforms are composed
+// here and only the final matrix is handed to GL, so nothing ever has to be
+// read back from the driver.
+class MatrixStack {
+public:
+	MatrixStack();
+
+	// Like the GL stack, pushing past the maximum depth or popping the last
+	// matrix does nothing.
+	void push();
+	void pop();
+
+	const float *top() const { return stack[depth]; }
+	void get(float *out) const { mat4Copy(stack[depth], out); }
+	int size() const { return depth + 1; }
+
+	void loadIdentity();
+	void load(const float *m);
+	void mult(const float *m);
+	void rotate(float angle, float x, float y, float z);
+	void translate(float x, float y, float z);
+	void scale(float x, float y, float z);
+	void lookAt(float eyeX, float eyeY, float eyeZ,
+		float centerX, float centerY, float centerZ,
+		float upX, float upY, float upZ);
+
+	// Same minimum depth OpenGL guarantees for its modelview stack
+	static const int MAX_DEPTH = 32;
+
+private:
+	float stack[MAX_DEPTH][16];
+	int depth;
+};
+
+#endif
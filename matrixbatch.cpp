@@ -0,0 +1,232 @@
+#include "matrix.h"
+
+// SIMD versions of the batched matrix kernels. SSE is always there on x86-64.
+// The AVX versions are compiled with a target attribute and picked at run time
+// if the CPU has AVX, so the program itself doesn't need to be built with -mavx.
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE__))
+#define MATRIX_SSE 1
+#include<immintrin.h>
+#endif
+
+#if defined(MATRIX_SSE) && defined(__GNUC__)
+#define MATRIX_AVX 1
+#define AVX_FUNCTION __attribute__((target("avx")))
+#endif
+
+//////////////////////////////////////////////////////////////////
+/// Scalar ///////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+static void multiplyBatchScalar(const float *a, const float *b, float *out, int count) {
+	for (int i = 0; i < count; i++)
+		mat4Multiply(a + 16*i, b + 16*i, out + 16*i);
+}
+
+static void invertRigidBatchScalar(const float *m, float *out, int count) {
+	for (int i = 0; i < count; i++)
+		mat4InvertRigid(m + 16*i, out + 16*i);
+}
+
+//////////////////////////////////////////////////////////////////
+/// SSE //////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+#if defined(MATRIX_SSE)
+
+// out = a * b for one matrix. Everything is loaded before anything is
+// stored, so out may be a or b.
+static inline void multiplySSE(const float *a, const float *b, float *out) {
+	__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+	__m128 bc[4] = { _mm_loadu_ps(b), _mm_loadu_ps(b + 4), _mm_loadu_ps(b + 8), _mm_loadu_ps(b + 12) };
+	for (int j = 0; j < 4; j++) {
+		// column j of the result is a's columns weighted by column j of b
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bc[j], bc[j], 0x00));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bc[j], bc[j], 0x55)));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bc[j], bc[j], 0xAA)));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bc[j], bc[j], 0xFF)));
+		_mm_storeu_ps(out + 4*j, r);
+	}
+}
+
+static inline void invertRigidSSE(const float *m, float *out) {
+	__m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+	__m128 zero = _mm_setzero_ps();
+
+	// transpose the 3x3 rotation; the w of each new column ends up 0
+	__m128 t0 = _mm_unpacklo_ps(c0, c1), t1 = _mm_unpacklo_ps(c2, zero);
+	__m128 t2 = _mm_unpackhi_ps(c0, c1), t3 = _mm_unpackhi_ps(c2, zero);
+	__m128 r0 = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+	__m128 r1 = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+	__m128 r2 = _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+	// translation = (0,0,0,1) - R^T t
+	__m128 rt = _mm_mul_ps(r0, _mm_shuffle_ps(c3, c3, 0x00));
+	rt = _mm_add_ps(rt, _mm_mul_ps(r1, _mm_shuffle_ps(c3, c3, 0x55)));
+	rt = _mm_add_ps(rt, _mm_mul_ps(r2, _mm_shuffle_ps(c3, c3, 0xAA)));
+	__m128 t = _mm_sub_ps(_mm_set_ps(1, 0, 0, 0), rt);
+
+	_mm_storeu_ps(out, r0);
+	_mm_storeu_ps(out + 4, r1);
+	_mm_storeu_ps(out + 8, r2);
+	_mm_storeu_ps(out + 12, t);
+}
+
+static void multiplyBatchSSE(const float *a, const float *b, float *out, int count) {
+	for (int i = 0; i < count; i++)
+		multiplySSE(a + 16*i, b + 16*i, out + 16*i);
+}
+
+static void invertRigidBatchSSE(const float *m, float *out, int count) {
+	for (int i = 0; i < count; i++)
+		invertRigidSSE(m + 16*i, out + 16*i);
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////
+/// AVX //////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+#if defined(MATRIX_AVX)
+
+// The AVX kernels work on two matrices at once, one in each 128-bit lane.
+// Every shuffle used stays within its lane, so each lane does exactly what
+// the SSE kernel does for one matrix.
+
+// column k of matrix p in the low lane and of matrix p + 16 in the high lane
+AVX_FUNCTION static inline __m256 loadColumnPair(const float *p, int k) {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4*k)), _mm_loadu_ps(p + 16 + 4*k), 1);
+}
+
+AVX_FUNCTION static inline void storeColumnPair(float *p, int k, __m256 v) {
+	_mm_storeu_ps(p + 4*k, _mm256_castps256_ps128(v));
+	_mm_storeu_ps(p + 16 + 4*k, _mm256_extractf128_ps(v, 1));
+}
+
+AVX_FUNCTION static void multiplyBatchAVX(const float *a, const float *b, float *out, int count) {
+	int i = 0;
+	for (; i + 1 < count; i += 2) {
+		const float *pa = a + 16*i, *pb = b + 16*i;
+		__m256 a0 = loadColumnPair(pa, 0), a1 = loadColumnPair(pa, 1), a2 = loadColumnPair(pa, 2), a3 = loadColumnPair(pa, 3);
+		__m256 bc[4] = { loadColumnPair(pb, 0), loadColumnPair(pb, 1), loadColumnPair(pb, 2), loadColumnPair(pb, 3) };
+		for (int j = 0; j < 4; j++) {
+			__m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(bc[j], 0x00));
+			r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(bc[j], 0x55)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(bc[j], 0xAA)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(bc[j], 0xFF)));
+			storeColumnPair(out + 16*i, j, r);
+		}
+	}
+	if (i < count)
+		multiplySSE(a + 16*i, b + 16*i, out + 16*i);
+}
+
+AVX_FUNCTION static void invertRigidBatchAVX(const float *m, float *out, int count) {
+	int i = 0;
+	for (; i + 1 < count; i += 2) {
+		const float *p = m + 16*i;
+		__m256 c0 = loadColumnPair(p, 0), c1 = loadColumnPair(p, 1), c2 = loadColumnPair(p, 2), c3 = loadColumnPair(p, 3);
+		__m256 zero = _mm256_setzero_ps();
+
+		__m256 t0 = _mm256_unpacklo_ps(c0, c1), t1 = _mm256_unpacklo_ps(c2, zero);
+		__m256 t2 = _mm256_unpackhi_ps(c0, c1), t3 = _mm256_unpackhi_ps(c2, zero);
+		__m256 r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+		__m256 rt = _mm256_mul_ps(r0, _mm256_permute_ps(c3, 0x00));
+		rt = _mm256_add_ps(rt, _mm256_mul_ps(r1, _mm256_permute_ps(c3, 0x55)));
+		rt = _mm256_add_ps(rt, _mm256_mul_ps(r2, _mm256_permute_ps(c3, 0xAA)));
+		__m256 t = _mm256_sub_ps(_mm256_set_ps(1, 0, 0, 0, 1, 0, 0, 0), rt);
+
+		storeColumnPair(out + 16*i, 0, r0);
+		storeColumnPair(out + 16*i, 1, r1);
+		storeColumnPair(out + 16*i, 2, r2);
+		storeColumnPair(out + 16*i, 3, t);
+	}
+	if (i < count)
+		invertRigidSSE(m + 16*i, out + 16*i);
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////
+/// Dispatch /////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+bool mat4KernelSupported(Mat4Kernel kernel) {
+	switch (kernel) {
+	case MAT4_SCALAR:
+		return true;
+	case MAT4_SSE:
+#if defined(MATRIX_SSE)
+		return true;
+#else
+		return false;
+#endif
+	case MAT4_AVX:
+#if defined(MATRIX_AVX)
+		return __builtin_cpu_supports("avx");
+#else
+		return false;
+#endif
+	default:
+		return true;
+	}
+}
+
+// Resolves MAT4_BEST, and anything the CPU can't do, to a real kernel
+static Mat4Kernel resolve(Mat4Kernel kernel) {
+	if (kernel == MAT4_BEST || !mat4KernelSupported(kernel)) {
+		if (mat4KernelSupported(MAT4_AVX))
+			return MAT4_AVX;
+		if (mat4KernelSupported(MAT4_SSE))
+			return MAT4_SSE;
+		return MAT4_SCALAR;
+	}
+	return kernel;
+}
+
+const char *mat4KernelName(Mat4Kernel kernel) {
+	switch (resolve(kernel)) {
+	case MAT4_AVX: return "avx";
+	case MAT4_SSE: return "sse";
+	default: return "scalar";
+	}
+}
+
+void mat4MultiplyBatch(const float *a, const float *b, float *out, int count, Mat4Kernel kernel) {
+	switch (resolve(kernel)) {
+#if defined(MATRIX_AVX)
+	case MAT4_AVX:
+		multiplyBatchAVX(a, b, out, count);
+		break;
+#endif
+#if defined(MATRIX_SSE)
+	case MAT4_SSE:
+		multiplyBatchSSE(a, b, out, count);
+		break;
+#endif
+	default:
+		multiplyBatchScalar(a, b, out, count);
+		break;
+	}
+}
+
+void mat4InvertRigidBatch(const float *m, float *out, int count, Mat4Kernel kernel) {
+	switch (resolve(kernel)) {
+#if defined(MATRIX_AVX)
+	case MAT4_AVX:
+		invertRigidBatchAVX(m, out, count);
+		break;
+#endif
+#if defined(MATRIX_SSE)
+	case MAT4_SSE:
+		invertRigidBatchSSE(m, out, count);
+		break;
+#endif
+	default:
+		invertRigidBatchScalar(m, out, count);
+		break;
+	}
+}
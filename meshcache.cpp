@@ -0,0 +1,255 @@
+#include "meshcache.h"
+
+#include<math.h>
+#include<vector>
+
+static const float PI = 3.14159265358979f;
+
+bool MeshKey::operator<(const MeshKey &o) const {
+	if (shape != o.shape) return shape < o.shape;
+	if (slices != o.slices) return slices < o.slices;
+	if (stacks != o.stacks) return stacks < o.stacks;
+	if (a != o.a) return a < o.a;
+	if (b != o.b) return b < o.b;
+	return c < o.c;
+}
+
+// Appends one interleaved position/normal vertex
+static void pushVertex(std::vector<float> &v, float x, float y, float z, float nx, float ny, float nz) {
+	v.push_back(x); v.push_back(y); v.push_back(z);
+	v.push_back(nx); v.push_back(ny); v.push_back(nz);
+}
+
+// Appends the quad a-b-c-d (counter clockwise) as two triangles. Each vertex is
+// 6 floats taken from the grid array.
+static void pushQuad(std::vector<float> &v, const float *a, const float *b, const float *c, const float *d) {
+	v.insert(v.end(), a, a + 6); v.insert(v.end(), b, b + 6); v.insert(v.end(), c, c + 6);
+	v.insert(v.end(), a, a + 6); v.insert(v.end(), c, c + 6); v.insert(v.end(), d, d + 6);
+}
+
+// Turns a (rows+1) x (cols+1) grid of vertices into triangles
+static void gridToTriangles(const std::vector<float> &grid, int rows, int cols, std::vector<float> &out) {
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < cols; j++) {
+			const float *a = &grid[6*(i*(cols+1) + j)];
+			const float *b = &grid[6*(i*(cols+1) + j+1)];
+			const float *c = &grid[6*((i+1)*(cols+1) + j+1)];
+			const float *d = &grid[6*((i+1)*(cols+1) + j)];
+			pushQuad(out, a, d, c, b);
+		}
+	}
+}
+
+static void tessellateSphere(int slices, int stacks, std::vector<float> &out) {
+	std::vector<float> grid;
+	for (int i = 0; i <= stacks; i++) {
+		float phi = PI * i / stacks;
+		for (int j = 0; j <= slices; j++) {
+			float theta = 2 * PI * j / slices;
+			float x = sinf(phi) * cosf(theta);
+			float y = sinf(phi) * sinf(theta);
+			float z = cosf(phi);
+			pushVertex(grid, x, y, z, x, y, z);
+		}
+	}
+	gridToTriangles(grid, stacks, slices, out);
+}
+
+static void tessellateDisk(float inner, float outer, int slices, int loops, std::vector<float> &out) {
+	std::vector<float> grid;
+	for (int i = 0; i <= loops; i++) {
+		float r = inner + (outer - inner) * i / loops;
+		for (int j = 0; j <= slices; j++) {
+			float theta = 2 * PI * j / slices;
+			pushVertex(grid, r * sinf(theta), r * cosf(theta), 0, 0, 0, 1);
+		}
+	}
+	// winding is flipped relative to the sphere since rows grow outwards
+	for (int i = 0; i < loops; i++) {
+		for (int j = 0; j < slices; j++) {
+			const float *a = &grid[6*(i*(slices+1) + j)];
+			const float *b = &grid[6*(i*(slices+1) + j+1)];
+			const float *c = &grid[6*((i+1)*(slices+1) + j+1)];
+			const float *d = &grid[6*((i+1)*(slices+1) + j)];
+			pushQuad(out, a, b, c, d);
+		}
+	}
+}
+
+static void tessellateCylinder(float base, float top, float height, int slices, int stacks, std::vector<float> &out) {
+	std::vector<float> grid;
+	float slope = (base - top) / height;
+	float nlen = sqrtf(1 + slope * slope);
+	for (int i = 0; i <= stacks; i++) {
+		float z = height * i / stacks;
+		float r = base + (top - base) * i / stacks;
+		for (int j = 0; j <= slices; j++) {
+			float theta = 2 * PI * j / slices;
+			float s = sinf(theta), c = cosf(theta);
+			pushVertex(grid, r * s, r * c, z, s / nlen, c / nlen, slope / nlen);
+		}
+	}
+	for (int i = 0; i < stacks; i++) {
+		for (int j = 0; j < slices; j++) {
+			const float *a = &grid[6*(i*(slices+1) + j)];
+			const float *b = &grid[6*(i*(slices+1) + j+1)];
+			const float *c = &grid[6*((i+1)*(slices+1) + j+1)];
+			const float *d = &grid[6*((i+1)*(slices+1) + j)];
+			pushQuad(out, a, b, c, d);
+		}
+	}
+}
+
+static void tessellateCube(std::vector<float> &out) {
+	// normal, then the two in-plane axes of each face
+	static const float faces[6][9] = {
+		{ 1,0,0,  0,1,0,  0,0,1 },
+		{-1,0,0,  0,0,1,  0,1,0 },
+		{ 0,1,0,  0,0,1,  1,0,0 },
+		{ 0,-1,0, 1,0,0,  0,0,1 },
+		{ 0,0,1,  1,0,0,  0,1,0 },
+		{ 0,0,-1, 0,1,0,  1,0,0 }
+	};
+	for (int f = 0; f < 6; f++) {
+		const float *n = faces[f], *u = faces[f] + 3, *w = faces[f] + 6;
+		float corner[4][6];
+		static const float su[4] = {-1, 1, 1, -1};
+		static const float sw[4] = {-1, -1, 1, 1};
+		for (int k = 0; k < 4; k++) {
+			for (int i = 0; i < 3; i++) {
+				corner[k][i] = 0.5f * (n[i] + su[k] * u[i] + sw[k] * w[i]);
+				corner[k][i+3] = n[i];
+			}
+		}
+		pushQuad(out, corner[0], corner[1], corner[2], corner[3]);
+	}
+}
+
+static void tessellateOctahedron(std::vector<float> &out) {
+	static const float axis[6][3] = {
+		{1,0,0}, {0,1,0}, {-1,0,0}, {0,-1,0}, {0,0,1}, {0,0,-1}
+	};
+	for (int pole = 4; pole < 6; pole++) {
+		for (int k = 0; k < 4; k++) {
+			// counter clockwise seen from outside, whichever pole it is
+			const float *a = axis[pole];
+			const float *b = axis[pole == 4 ? k : (k + 1) % 4];
+			const float *c = axis[pole == 4 ? (k + 1) % 4 : k];
+			float n[3];
+			for (int i = 0; i < 3; i++)
+				n[i] = (a[i] + b[i] + c[i]) / sqrtf(3.0f);
+			pushVertex(out, a[0], a[1], a[2], n[0], n[1], n[2]);
+			pushVertex(out, b[0], b[1], b[2], n[0], n[1], n[2]);
+			pushVertex(out, c[0], c[1], c[2], n[0], n[1], n[2]);
+		}
+	}
+}
+
+MeshCache::MeshCache() : vertexArrays(false) {
+}
+
+const Mesh &MeshCache::lookup(const MeshKey &key) {
+	std::map<MeshKey, Mesh>::iterator it = meshes.find(key);
+	if (it != meshes.end())
+		return it->second;
+
+	std::vector<float> verts;
+	switch (key.shape) {
+	case MESH_SPHERE:
+		tessellateSphere(key.slices, key.stacks, verts);
+		break;
+	case MESH_DISK:
+		tessellateDisk(key.a, key.b, key.slices, key.stacks, verts);
+		break;
+	case MESH_CYLINDER:
+		tessellateCylinder(key.a, key.b, key.c, key.slices, key.stacks, verts);
+		break;
+	case MESH_CUBE:
+		tessellateCube(verts);
+		break;
+	case MESH_OCTAHEDRON:
+		tessellateOctahedron(verts);
+		break;
+	}
+
+	Mesh mesh;
+	mesh.mode = GL_TRIANGLES;
+	mesh.count = (GLsizei)(verts.size() / 6);
+	glGenBuffers(1, &mesh.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), &verts[0], GL_STATIC_DRAW);
+	mesh.vao = 0;
+	if (vertexArrays) {
+		glGenVertexArrays(1, &mesh.vao);
+		glBindVertexArray(mesh.vao);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)0);
+		glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)(3 * sizeof(float)));
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return meshes.insert(std::make_pair(key, mesh)).first->second;
+}
+
+const Mesh &MeshCache::sphere(int slices, int stacks) {
+	MeshKey key = {MESH_SPHERE, slices, stacks, 0, 0, 0};
+	return lookup(key);
+}
+
+const Mesh &MeshCache::disk(float inner, float outer, int slices, int loops) {
+	MeshKey key = {MESH_DISK, slices, loops, inner, outer, 0};
+	return lookup(key);
+}
+
+const Mesh &MeshCache::cylinder(float base, float top, float height, int slices, int stacks) {
+	MeshKey key = {MESH_CYLINDER, slices, stacks, base, top, height};
+	return lookup(key);
+}
+
+const Mesh &MeshCache::cube() {
+	MeshKey key = {MESH_CUBE, 1, 1, 0, 0, 0};
+	return lookup(key);
+}
+
+const Mesh &MeshCache::octahedron() {
+	MeshKey key = {MESH_OCTAHEDRON, 1, 1, 0, 0, 0};
+	return lookup(key);
+}
+
+void MeshCache::draw(const Mesh &mesh) {
+	bind(mesh);
+	glDrawArrays(mesh.mode, 0, mesh.count);
+	unbind(mesh);
+}
+
+void MeshCache::bind(const Mesh &mesh) {
+	if (mesh.vao) {
+		// the attribute setup is all in the vertex array object
+		glBindVertexArray(mesh.vao);
+		return;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), (const GLvoid *)0);
+	glNormalPointer(GL_FLOAT, 6 * sizeof(float), (const GLvoid *)(3 * sizeof(float)));
+}
+
+void MeshCache::unbind(const Mesh &mesh) {
+	if (mesh.vao)
+		return;
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshCache::release() {
+	for (std::map<MeshKey, Mesh>::iterator it = meshes.begin(); it != meshes.end(); ++it) {
+		glDeleteBuffers(1, &it->second.vbo);
+		if (it->second.vao)
+			glDeleteVertexArrays(1, &it->second.vao);
+	}
+	meshes.clear();
+}
@@ -0,0 +1,86 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "glplatform.h"
+
+#include<map>
+
+// Shapes that the mesh cache knows how to tessellate
+enum MeshShape {
+	MESH_SPHERE,
+	MESH_DISK,
+	MESH_CYLINDER,
+	MESH_CUBE,
+	MESH_OCTAHEDRON
+};
+
+// Generic attribute slots of a mesh's position and normal in its vertex
+// array object, for the shaders that draw from one
+static const GLuint POSITION_ATTRIBUTE = 0;
+static const GLuint NORMAL_ATTRIBUTE = 1;
+
+// A tessellated shape living in a vertex buffer object. Vertices are
+// interleaved as position (xyz) followed by normal (xyz). With vertex arrays
+// on, vao holds the buffer bound to the attributes above; otherwise it is 0
+// and the mesh is drawn from the fixed function arrays.
+struct Mesh {
+	GLuint vbo, vao;
+	GLenum mode;
+	GLsizei count;
+};
+
+// Key used to look up a mesh. The shape parameters are part of the key since
+// disks and cylinders can't be built from a unit shape with a uniform scale.
+struct MeshKey {
+	MeshShape shape;
+	int slices, stacks;
+	float a, b, c;
+
+	bool operator<(const MeshKey &o) const;
+};
+
+// Cache of tessellated geometry for ONE OpenGL context. Each GLUT window has
+// its own context, so each window needs its own cache. Meshes are built the
+// first time they are asked for and live until release() is called.
+class MeshCache {
+public:
+	MeshCache();
+
+	// Give meshes built from now on a vertex array object, which the core
+	// profile can't draw without
+	void setVertexArrays(bool on) { vertexArrays = on; }
+
+	// unit radius sphere, poles along z (same layout as glutSolidSphere)
+	const Mesh &sphere(int slices, int stacks);
+	// annulus in the xy plane, normal along +z (same layout as gluDisk)
+	const Mesh &disk(float inner, float outer, int slices, int loops);
+	// open cylinder from z=0 to z=height (same layout as gluCylinder)
+	const Mesh &cylinder(float base, float top, float height, int slices, int stacks);
+	// unit cube centered at the origin (same layout as glutSolidCube(1))
+	const Mesh &cube();
+	// unit octahedron with flat faces, the cheapest thing that still looks
+	// like a rock when it's only a few pixels big
+	const Mesh &octahedron();
+
+	// draw a mesh with the current modelview matrix and color, or with
+	// whatever program is in use if it has a vertex array object
+	static void draw(const Mesh &mesh);
+	// The same in steps, so a run of draws of one mesh sets up its arrays
+	// once: bind, glDrawArrays(mesh.mode, 0, mesh.count) for each, unbind
+	static void bind(const Mesh &mesh);
+	static void unbind(const Mesh &mesh);
+
+	// number of meshes currently held
+	int size() const { return (int)meshes.size(); }
+
+	// delete every buffer object. Must be called with the owning context current.
+	void release();
+
+private:
+	const Mesh &lookup(const MeshKey &key);
+
+	std::map<MeshKey, Mesh> meshes;
+	bool vertexArrays;
+};
+
+#endif
@@ -0,0 +1,491 @@
+#include "nbody.h"
+#include "benchmark.h"
+#include "jobsystem.h"
+
+#include<math.h>
+#include<algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE__))
+#define NBODY_SSE 1
+#include<xmmintrin.h>
+#endif
+
+// Leaves hold at most this many particles; below that, summing them directly
+// is cheaper than going further down the tree
+static const int LEAF_SIZE = 32;
+// Bits of each coordinate in a Morton key, so keys fit in 63 bits and the
+// tree is at most this deep
+static const int MORTON_BITS = 21;
+// Leaves walked as one block during the force walk, the smallest job it is
+// split into
+static const int WALK_BLOCK = 16;
+// Deep enough for every node a walk can have waiting: at most seven siblings
+// left over per level, plus one node's children
+static const int WALK_STACK = 8 * (MORTON_BITS + 1);
+
+// Spread the low 21 bits of v out so there are two zero bits after each one
+static unsigned long long spreadBits(unsigned int v) {
+	unsigned long long x = v & 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffULL;
+	x = (x | x << 16) & 0x1f0000ff0000ffULL;
+	x = (x | x << 8) & 0x100f00f00f00f00fULL;
+	x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+	x = (x | x << 2) & 0x1249249249249249ULL;
+	return x;
+}
+
+NBodySystem::NBodySystem() : theta(0.5f), softening2(1e-6f),
+	originX(0), originY(0), originZ(0), rootSize(1) {
+	stats.buildMs = stats.forceMs = stats.integrateMs = 0;
+	stats.nodes = 0;
+	stats.kinetic = stats.potential = 0;
+}
+
+int NBodySystem::add(float px, float py, float pz, float pvx, float pvy, float pvz, float m) {
+	x.push_back(px); y.push_back(py); z.push_back(pz);
+	vx.push_back(pvx); vy.push_back(pvy); vz.push_back(pvz);
+	ax.push_back(0); ay.push_back(0); az.push_back(0);
+	previousX.push_back(px); previousY.push_back(py); previousZ.push_back(pz);
+	renderX.push_back(px); renderY.push_back(py); renderZ.push_back(pz);
+	mass.push_back(m);
+	return count() - 1;
+}
+
+void NBodySystem::reserve(int n) {
+	x.reserve(n); y.reserve(n); z.reserve(n);
+	vx.reserve(n); vy.reserve(n); vz.reserve(n);
+	ax.reserve(n); ay.reserve(n); az.reserve(n);
+	previousX.reserve(n); previousY.reserve(n); previousZ.reserve(n);
+	renderX.reserve(n); renderY.reserve(n); renderZ.reserve(n);
+	mass.reserve(n);
+}
+
+void NBodySystem::removeNetMomentum() {
+	double px = 0, py = 0, pz = 0, total = 0;
+	for (int i = 0; i < count(); i++) {
+		px += mass[i] * vx[i];
+		py += mass[i] * vy[i];
+		pz += mass[i] * vz[i];
+		total += mass[i];
+	}
+	if (total <= 0)
+		return;
+	float cx = (float)(px / total), cy = (float)(py / total), cz = (float)(pz / total);
+	for (int i = 0; i < count(); i++) {
+		vx[i] -= cx;
+		vy[i] -= cy;
+		vz[i] -= cz;
+	}
+}
+
+void NBodySystem::start(JobSystem *jobs) {
+	int n = count();
+	previousX = renderX = x;
+	previousY = renderY = y;
+	previousZ = renderZ = z;
+	if (n == 0) {
+		stats.kinetic = stats.potential = 0;
+		return;
+	}
+	buildTree();
+	computeForces(jobs);
+	double kinetic = 0;
+	for (int i = 0; i < n; i++)
+		kinetic += 0.5 * mass[i] * ((double)vx[i]*vx[i] + (double)vy[i]*vy[i] + (double)vz[i]*vz[i]);
+	stats.kinetic = kinetic;
+}
+
+void NBodySystem::step(float dt, JobSystem *jobs) {
+	int n = count();
+	if (n == 0)
+		return;
+	float half = 0.5f * dt;
+
+	double start = currentTimeMs();
+	previousX = x;
+	previousY = y;
+	previousZ = z;
+	// kick by half a step with the old forces, then drift the whole step
+	for (int i = 0; i < n; i++) {
+		vx[i] += ax[i] * half;
+		vy[i] += ay[i] * half;
+		vz[i] += az[i] * half;
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+		z[i] += vz[i] * dt;
+	}
+	double drifted = currentTimeMs();
+
+	buildTree();
+	double built = currentTimeMs();
+	computeForces(jobs);
+	double forced = currentTimeMs();
+
+	// and the other half kick with the new forces, after which the
+	// velocities line up with the positions again
+	double kinetic = 0;
+	for (int i = 0; i < n; i++) {
+		vx[i] += ax[i] * half;
+		vy[i] += ay[i] * half;
+		vz[i] += az[i] * half;
+		kinetic += 0.5 * mass[i] * ((double)vx[i]*vx[i] + (double)vy[i]*vy[i] + (double)vz[i]*vz[i]);
+	}
+	stats.kinetic = kinetic;
+	double done = currentTimeMs();
+
+	stats.buildMs = built - drifted;
+	stats.forceMs = forced - built;
+	stats.integrateMs = (drifted - start) + (done - forced);
+}
+
+void NBodySystem::interpolate(float alpha) {
+	int n = count();
+	for (int i = 0; i < n; i++) {
+		renderX[i] = previousX[i] + (x[i] - previousX[i]) * alpha;
+		renderY[i] = previousY[i] + (y[i] - previousY[i]) * alpha;
+		renderZ[i] = previousZ[i] + (z[i] - previousZ[i]) * alpha;
+	}
+}
+
+void NBodySystem::directAcceleration(int i, float out[3]) const {
+	double sx = 0, sy = 0, sz = 0;
+	for (int j = 0; j < count(); j++) {
+		if (j == i)
+			continue;
+		double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+		double r2 = dx*dx + dy*dy + dz*dz + softening2;
+		double scale = mass[j] / (r2 * sqrt(r2));
+		sx += dx * scale;
+		sy += dy * scale;
+		sz += dz * scale;
+	}
+	out[0] = (float)sx;
+	out[1] = (float)sy;
+	out[2] = (float)sz;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Octree ///////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Past 1/sqrt(3) a node can pass the opening test from a point inside its own
+// cube, and the force error grows quickly well before that
+const float NBodySystem::MAX_THETA = 0.577f;
+
+void NBodySystem::buildTree() {
+	int n = count();
+	if (n == 0) {
+		// no bounds to take, and nothing to walk
+		nodes.clear();
+		leaves.clear();
+		stats.nodes = 0;
+		return;
+	}
+	float lowX = x[0], lowY = y[0], lowZ = z[0];
+	float highX = lowX, highY = lowY, highZ = lowZ;
+	for (int i = 1; i < n; i++) {
+		lowX = std::min(lowX, x[i]); highX = std::max(highX, x[i]);
+		lowY = std::min(lowY, y[i]); highY = std::max(highY, y[i]);
+		lowZ = std::min(lowZ, z[i]); highZ = std::max(highZ, z[i]);
+	}
+	originX = lowX;
+	originY = lowY;
+	originZ = lowZ;
+	// a little over the largest extent, so the far edge still quantizes
+	// inside the cube
+	rootSize = std::max(highX - lowX, std::max(highY - lowY, highZ - lowZ)) * 1.0001f + 1e-20f;
+
+	keys.resize(n);
+	order.resize(n);
+	float cells = (float)(1 << MORTON_BITS);
+	float toCell = cells / rootSize;
+	unsigned int maxCell = (1u << MORTON_BITS) - 1;
+	for (int i = 0; i < n; i++) {
+		unsigned int cx = std::min((unsigned int)((x[i] - originX) * toCell), maxCell);
+		unsigned int cy = std::min((unsigned int)((y[i] - originY) * toCell), maxCell);
+		unsigned int cz = std::min((unsigned int)((z[i] - originZ) * toCell), maxCell);
+		keys[i] = spreadBits(cx) << 2 | spreadBits(cy) << 1 | spreadBits(cz);
+		order[i] = i;
+	}
+
+	if (n < 4096) {
+		// small systems are cheaper to sort outright than to clear the
+		// radix histograms four times
+		std::vector<unsigned long long> &k = keys;
+		std::sort(order.begin(), order.end(), [&k](int a, int b) { return k[a] < k[b]; });
+		std::vector<unsigned long long> sorted(n);
+		for (int i = 0; i < n; i++)
+			sorted[i] = keys[order[i]];
+		keys.swap(sorted);
+	}
+	else {
+		// least significant digit first radix sort, 16 bits a pass
+		keyScratch.resize(n);
+		orderScratch.resize(n);
+		std::vector<int> histogram(1 << 16);
+		for (int shift = 0; shift < 64; shift += 16) {
+			std::fill(histogram.begin(), histogram.end(), 0);
+			for (int i = 0; i < n; i++)
+				histogram[(keys[i] >> shift) & 0xffff]++;
+			int total = 0;
+			for (int d = 0; d < (1 << 16); d++) {
+				int c = histogram[d];
+				histogram[d] = total;
+				total += c;
+			}
+			for (int i = 0; i < n; i++) {
+				int slot = histogram[(keys[i] >> shift) & 0xffff]++;
+				keyScratch[slot] = keys[i];
+				orderScratch[slot] = order[i];
+			}
+			keys.swap(keyScratch);
+			order.swap(orderScratch);
+		}
+	}
+
+	sortedX.resize(n);
+	sortedY.resize(n);
+	sortedZ.resize(n);
+	sortedMass.resize(n);
+	for (int k = 0; k < n; k++) {
+		int i = order[k];
+		sortedX[k] = x[i];
+		sortedY[k] = y[i];
+		sortedZ[k] = z[i];
+		sortedMass[k] = mass[i];
+	}
+
+	nodes.clear();
+	leaves.clear();
+	nodes.push_back(Node());
+	buildNode(0, 0, n, 0);
+	stats.nodes = (int)nodes.size();
+}
+
+// Fills in node slot for particles begin..end, which all share the key bits
+// above this level. Children go in consecutive slots at the end of the array.
+// Returns the slot.
+int NBodySystem::buildNode(int slot, int begin, int end, int level) {
+	float size = rootSize / (float)(1 << level);
+	Node node;
+	node.size2 = size * size;
+	node.begin = begin;
+	node.end = end;
+	node.firstChild = 0;
+	node.childCount = 0;
+
+	double m = 0, mx = 0, my = 0, mz = 0;
+	if (end - begin <= LEAF_SIZE || level == MORTON_BITS) {
+		for (int k = begin; k < end; k++) {
+			m += sortedMass[k];
+			mx += (double)sortedMass[k] * sortedX[k];
+			my += (double)sortedMass[k] * sortedY[k];
+			mz += (double)sortedMass[k] * sortedZ[k];
+		}
+		if (m <= 0) {
+			// massless particles still need somewhere to be
+			for (int k = begin; k < end; k++) {
+				mx += sortedX[k];
+				my += sortedY[k];
+				mz += sortedZ[k];
+			}
+			double c = end - begin;
+			node.comX = (float)(mx / c);
+			node.comY = (float)(my / c);
+			node.comZ = (float)(mz / c);
+			node.mass = 0;
+			nodes[slot] = node;
+			leaves.push_back(slot);
+			return slot;
+		}
+		leaves.push_back(slot);
+	}
+	else {
+		// the three key bits for this level pick the octant; the keys are
+		// sorted, so each octant is one run
+		int shift = 3 * (MORTON_BITS - 1 - level);
+		int runStart[9], runs = 0;
+		int k = begin;
+		while (k < end) {
+			unsigned long long octant = (keys[k] >> shift) & 7;
+			runStart[runs++] = k;
+			while (k < end && ((keys[k] >> shift) & 7) == octant)
+				k++;
+		}
+		runStart[runs] = end;
+
+		node.firstChild = (int)nodes.size();
+		node.childCount = runs;
+		nodes.resize(nodes.size() + runs);
+		for (int c = 0; c < runs; c++) {
+			int child = buildNode(node.firstChild + c, runStart[c], runStart[c + 1], level + 1);
+			const Node &built = nodes[child];
+			double cm = built.mass;
+			m += cm;
+			mx += cm * built.comX;
+			my += cm * built.comY;
+			mz += cm * built.comZ;
+		}
+		if (m <= 0) {
+			const Node &only = nodes[node.firstChild];
+			node.comX = only.comX;
+			node.comY = only.comY;
+			node.comZ = only.comZ;
+			node.mass = 0;
+			nodes[slot] = node;
+			return slot;
+		}
+	}
+
+	node.mass = (float)m;
+	node.comX = (float)(mx / m);
+	node.comY = (float)(my / m);
+	node.comZ = (float)(mz / m);
+	nodes[slot] = node;
+	return slot;
+}
+
+// Sum the pull of count interaction entries on one particle. Entries are
+// point masses, whether they are single particles or far away nodes.
+static void sumInteractions(const float *ix, const float *iy, const float *iz, const float *im, int count,
+	float px, float py, float pz, float softening2, float *force, double &phi) {
+	float fx = 0, fy = 0, fz = 0, potential = 0;
+	int j = 0;
+
+#if defined(NBODY_SSE)
+	// the list is padded with massless entries to a multiple of four
+	const __m128 one = _mm_set1_ps(1), eps = _mm_set1_ps(softening2);
+	const __m128 x4 = _mm_set1_ps(px), y4 = _mm_set1_ps(py), z4 = _mm_set1_ps(pz);
+	__m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps(), sz = _mm_setzero_ps(), sp = _mm_setzero_ps();
+	for (; j + 4 <= count; j += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(ix + j), x4);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(iy + j), y4);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(iz + j), z4);
+		__m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), eps));
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(r2));
+		__m128 mInv = _mm_mul_ps(_mm_loadu_ps(im + j), inv);
+		__m128 scale = _mm_mul_ps(mInv, _mm_mul_ps(inv, inv));
+		sx = _mm_add_ps(sx, _mm_mul_ps(dx, scale));
+		sy = _mm_add_ps(sy, _mm_mul_ps(dy, scale));
+		sz = _mm_add_ps(sz, _mm_mul_ps(dz, scale));
+		sp = _mm_add_ps(sp, mInv);
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, sx); fx = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps(lanes, sy); fy = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps(lanes, sz); fz = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps(lanes, sp); potential = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+	for (; j < count; j++) {
+		float dx = ix[j] - px, dy = iy[j] - py, dz = iz[j] - pz;
+		float r2 = dx*dx + dy*dy + dz*dz + softening2;
+		float inv = 1.0f / sqrtf(r2);
+		float mInv = im[j] * inv;
+		float scale = mInv * inv * inv;
+		fx += dx * scale;
+		fy += dy * scale;
+		fz += dz * scale;
+		potential += mInv;
+	}
+	force[0] += fx;
+	force[1] += fy;
+	force[2] += fz;
+	phi -= potential;
+}
+
+// Forces on the particles of one leaf. The leaf walks the tree once for all
+// of them, opening any node that is too big for its distance from the nearest
+// point of the leaf's bounding box, and collects everything it doesn't open
+// into one list. The leaf's own ancestors are always opened, and pairs inside
+// the leaf itself are summed separately, so that no particle pulls on itself.
+void NBodySystem::walkLeaf(int leaf, InteractionList &list, double &potential) {
+	const float theta2 = theta * theta;
+	const Node &group = nodes[leaf];
+	float lowX = sortedX[group.begin], lowY = sortedY[group.begin], lowZ = sortedZ[group.begin];
+	float highX = lowX, highY = lowY, highZ = lowZ;
+	for (int k = group.begin + 1; k < group.end; k++) {
+		lowX = std::min(lowX, sortedX[k]); highX = std::max(highX, sortedX[k]);
+		lowY = std::min(lowY, sortedY[k]); highY = std::max(highY, sortedY[k]);
+		lowZ = std::min(lowZ, sortedZ[k]); highZ = std::max(highZ, sortedZ[k]);
+	}
+
+	list.x.clear(); list.y.clear(); list.z.clear(); list.m.clear();
+	int stack[WALK_STACK];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		if (index == leaf)
+			continue;
+		const Node &node = nodes[index];
+		bool ancestor = node.begin <= group.begin && group.end <= node.end;
+		float dx = std::max(std::max(lowX - node.comX, node.comX - highX), 0.0f);
+		float dy = std::max(std::max(lowY - node.comY, node.comY - highY), 0.0f);
+		float dz = std::max(std::max(lowZ - node.comZ, node.comZ - highZ), 0.0f);
+		float d2 = dx*dx + dy*dy + dz*dz;
+		if (!ancestor && node.size2 < theta2 * d2) {
+			list.add(node.comX, node.comY, node.comZ, node.mass);
+		}
+		else if (node.childCount == 0) {
+			for (int j = node.begin; j < node.end; j++)
+				list.add(sortedX[j], sortedY[j], sortedZ[j], sortedMass[j]);
+		}
+		else {
+			for (int c = 0; c < node.childCount; c++)
+				stack[top++] = node.firstChild + c;
+		}
+	}
+	while (list.x.size() % 4)
+		list.add(0, 0, 0, 0);
+
+	int count = (int)list.x.size();
+	for (int k = group.begin; k < group.end; k++) {
+		float px = sortedX[k], py = sortedY[k], pz = sortedZ[k];
+		float force[3] = {0, 0, 0};
+		double phi = 0;
+		if (count > 0)
+			sumInteractions(&list.x[0], &list.y[0], &list.z[0], &list.m[0], count, px, py, pz, softening2, force, phi);
+		for (int j = group.begin; j < group.end; j++) {
+			if (j == k)
+				continue;
+			float dx = sortedX[j] - px, dy = sortedY[j] - py, dz = sortedZ[j] - pz;
+			float r2 = dx*dx + dy*dy + dz*dz + softening2;
+			float inv = 1.0f / sqrtf(r2);
+			float mInv = sortedMass[j] * inv;
+			float scale = mInv * inv * inv;
+			force[0] += dx * scale;
+			force[1] += dy * scale;
+			force[2] += dz * scale;
+			phi -= mInv;
+		}
+		int i = order[k];
+		ax[i] = force[0];
+		ay[i] = force[1];
+		az[i] = force[2];
+		potential += 0.5 * sortedMass[k] * phi;
+	}
+}
+
+// Splits the walk into blocks of neighbouring leaves, handed out as jobs in
+// runs of whole blocks. Each block's potential is kept apart and they are
+// added up in order, so the energy is the same however many threads there are.
+void NBodySystem::computeForces(JobSystem *jobs) {
+	int leafCount = (int)leaves.size();
+	int blocks = (leafCount + WALK_BLOCK - 1) / WALK_BLOCK;
+	std::vector<double> potentials(blocks, 0.0);
+	parallelFor(jobs, "NBodySystem::computeForces", leafCount, WALK_BLOCK, [this, leafCount, &potentials](int begin, int end) {
+		InteractionList list;
+		for (int b = begin; b < end; b += WALK_BLOCK) {
+			double potential = 0;
+			for (int l = b; l < std::min(b + WALK_BLOCK, leafCount); l++)
+				walkLeaf(leaves[l], list, potential);
+			potentials[b / WALK_BLOCK] = potential;
+		}
+	});
+
+	double potential = 0;
+	for (int b = 0; b < blocks; b++)
+		potential += potentials[b];
+	stats.potential = potential;
+}
@@ -0,0 +1,116 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include<stddef.h>
+#include<vector>
+
+class JobSystem;
+
+// Timings and energy from the most recent step
+struct NBodyStats {
+	double buildMs;       // bounds, Morton sort and octree build
+	double forceMs;       // tree walk for every particle
+	double integrateMs;   // kicks and drift
+	int nodes;            // octree nodes built
+	double kinetic;       // energy at the end of the step
+	double potential;
+};
+
+// Point masses moved by their mutual gravity, with G = 1. Each step is a
+// kick-drift-kick leapfrog, which is symplectic, so the energy error stays
+// bounded instead of growing without limit the way it would with Euler.
+//
+// Forces come from a Barnes-Hut octree rebuilt every step: particles are
+// sorted along a Morton curve, the tree is built over the sorted order, and
+// any node small enough compared to its distance (size / distance < theta) is
+// treated as a single mass at its center of mass. Each leaf walks the tree
+// once on behalf of all its particles, and the walks are handed to the job
+// system in blocks of neighbouring leaves.
+//
+// Particles are stored one array per property, like the body store, and keep
+// the index add() returned for as long as they exist.
+class NBodySystem {
+public:
+	NBodySystem();
+
+	// Adds a particle and returns its index
+	int add(float x, float y, float z, float vx, float vy, float vz, float mass);
+	void reserve(int count);
+	int count() const { return (int)x.size(); }
+
+	// Opening angle: smaller is more accurate and slower. 0.5 by default, and
+	// no more than MAX_THETA.
+	static const float MAX_THETA;
+	void setTheta(float t) { theta = t; }
+	float getTheta() const { return theta; }
+	// Plummer softening length, which keeps close pairs from blowing up
+	void setSoftening(float epsilon) { softening2 = epsilon * epsilon; }
+	// Work out the starting accelerations and energy. Call after adding
+	// particles and before the first step. The force walk runs on jobs if
+	// given, here and in step().
+	void start(JobSystem *jobs = NULL);
+
+	// Advance every particle by dt. Positions before the step are kept for
+	// interpolation.
+	void step(float dt, JobSystem *jobs = NULL);
+
+	// Fill renderX/Y/Z with the previous and current positions blended by alpha
+	void interpolate(float alpha);
+
+	// Move every particle by the same velocity so the total momentum is zero,
+	// keeping the system from drifting off as a whole
+	void removeNetMomentum();
+
+	// total energy after the last start() or step()
+	double energy() const { return stats.kinetic + stats.potential; }
+	const NBodyStats &getStats() const { return stats; }
+
+	// Acceleration on particle i by summing over every other particle, with
+	// no tree. O(n) per particle; only for checking the tree's accuracy.
+	void directAcceleration(int i, float out[3]) const;
+
+	// Per-particle state
+	std::vector<float> x, y, z;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> ax, ay, az;
+	std::vector<float> previousX, previousY, previousZ;
+	std::vector<float> renderX, renderY, renderZ;
+	std::vector<float> mass;
+
+private:
+	struct Node {
+		float comX, comY, comZ, mass;
+		float size2;           // edge length squared
+		int firstChild;        // children are stored next to each other
+		int childCount;        // 0 for a leaf
+		int begin, end;        // range of sorted particles under the node
+	};
+
+	void buildTree();
+	int buildNode(int slot, int begin, int end, int level);
+	// point masses one leaf is pulled by, padded to a multiple of four
+	struct InteractionList {
+		std::vector<float> x, y, z, m;
+		void add(float px, float py, float pz, float pm) {
+			x.push_back(px); y.push_back(py); z.push_back(pz); m.push_back(pm);
+		}
+	};
+
+	void computeForces(JobSystem *jobs);
+	void walkLeaf(int leaf, InteractionList &list, double &potential);
+
+	float theta, softening2;
+	NBodyStats stats;
+
+	// bounds of the particles at the last build, the root's cube
+	float originX, originY, originZ, rootSize;
+	// particles in Morton order: keys and the index of each, plus their
+	// positions and masses copied next to each other for the walk
+	std::vector<unsigned long long> keys, keyScratch;
+	std::vector<int> order, orderScratch;
+	std::vector<float> sortedX, sortedY, sortedZ, sortedMass;
+	std::vector<Node> nodes;
+	std::vector<int> leaves;   // in Morton order
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "orbitrings.h"
+#include "meshcache.h"
+
+#include<math.h>
+
+static const float PI = 3.14159265358979f;
+
+// Ring levels of detail are RING_MIN_SEGMENTS, doubling up to RING_MAX_SEGMENTS
+static const int LEVELS = 7;
+static const int BASE_SEGMENTS = RING_MIN_SEGMENTS;
+
+// Largest gap allowed between a ring and the true circle, in pixels
+static const float TOLERANCE_PIXELS = 0.5f;
+
+int ringSegments(float radius, float distance, float pixelScale) {
+	if (distance < 0.01f)
+		distance = 0.01f;
+
+	// A circle of screen radius R drawn with n segments strays from the true
+	// circle by about R * pi^2 / (2 n^2) pixels
+	float screenRadius = radius * pixelScale / distance;
+	float needed = PI * sqrtf(screenRadius / (2 * TOLERANCE_PIXELS));
+
+	int segments = RING_MIN_SEGMENTS;
+	while (segments < RING_MAX_SEGMENTS && segments < needed)
+		segments <<= 1;
+	return segments;
+}
+
+OrbitRings::OrbitRings() : segmentsDrawn(0), vbo(0), vao(0) {
+}
+
+int OrbitRings::add(float radius, const float basis[9], float eccentricity) {
+	Ring ring;
+	ring.radius = radius;
+	ring.eccentricity = eccentricity;
+	for (int i = 0; i < 9; i++)
+		ring.basis[i] = basis[i];
+	rings.push_back(ring);
+	return (int)rings.size() - 1;
+}
+
+void OrbitRings::build(bool vertexArray) {
+	std::vector<float> verts;
+	firsts.clear();
+	for (size_t r = 0; r < rings.size(); r++) {
+		const Ring &ring = rings[r];
+		// theta is the eccentric anomaly, which for a circle is just the angle
+		float e = ring.eccentricity;
+		float minor = ring.radius * sqrtf(1 - e * e);
+		for (int level = 0; level < LEVELS; level++) {
+			int segments = BASE_SEGMENTS << level;
+			firsts.push_back((GLint)(verts.size() / 3));
+			for (int j = 0; j < segments; j++) {
+				float theta = 2 * PI * j / segments;
+				float x = minor * sinf(theta);
+				float y = ring.radius * (cosf(theta) - e);
+				verts.push_back(ring.basis[0] * x + ring.basis[3] * y);
+				verts.push_back(ring.basis[1] * x + ring.basis[4] * y);
+				verts.push_back(ring.basis[2] * x + ring.basis[5] * y);
+			}
+		}
+	}
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), &verts[0], GL_STATIC_DRAW);
+	if (vertexArray) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int OrbitRings::segmentsFor(int ring, const float eye[3], float pixelScale) const {
+	const Ring &r = rings[ring];
+
+	// move the eye into the ring's plane, then find the distance to the
+	// closest point on the circle
+	const float *b = r.basis;
+	float lx = b[0] * eye[0] + b[1] * eye[1] + b[2] * eye[2];
+	float ly = b[3] * eye[0] + b[4] * eye[1] + b[5] * eye[2];
+	float lz = b[6] * eye[0] + b[7] * eye[1] + b[8] * eye[2];
+	float radial = sqrtf(lx * lx + ly * ly) - r.radius;
+	return ringSegments(r.radius, sqrtf(radial * radial + lz * lz), pixelScale);
+}
+
+void OrbitRings::draw(int first, int last, const float eye[3], float pixelScale, const unsigned char *visible) {
+	drawFirsts.clear();
+	drawCounts.clear();
+	for (int r = first; r <= last; r++) {
+		if (visible && !visible[r])
+			continue;
+		int segments = segmentsFor(r, eye, pixelScale);
+		int level = 0;
+		while ((BASE_SEGMENTS << level) < segments)
+			level++;
+		drawFirsts.push_back(firsts[r * LEVELS + level]);
+		drawCounts.push_back(segments);
+		segmentsDrawn += segments;
+	}
+
+	if (drawCounts.empty())
+		return;
+	if (vao) {
+		glBindVertexArray(vao);
+		glMultiDrawArrays(GL_LINE_LOOP, &drawFirsts[0], &drawCounts[0], (GLsizei)drawCounts.size());
+		return;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, (const GLvoid *)0);
+	glMultiDrawArrays(GL_LINE_LOOP, &drawFirsts[0], &drawCounts[0], (GLsizei)drawCounts.size());
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void OrbitRings::release() {
+	if (vbo)
+		glDeleteBuffers(1, &vbo);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	vbo = vao = 0;
+}
@@ -0,0 +1,76 @@
+#ifndef ORBITRINGS_H
+#define ORBITRINGS_H
+
+#include "glplatform.h"
+
+#include<vector>
+
+// Segment counts used for rings go from RING_MIN_SEGMENTS up to
+// RING_MAX_SEGMENTS, doubling at each level of detail
+static const int RING_MIN_SEGMENTS = 16;
+static const int RING_MAX_SEGMENTS = 1024;
+
+// Number of segments (one of the level of detail counts) needed for a circle of
+// the given radius to look round when its closest point is distance away from
+// the eye. pixelScale is the number of pixels per unit at a distance of 1.
+int ringSegments(float radius, float distance, float pixelScale);
+
+// Orbit rings drawn as line loops. Every ring is stored at several levels of
+// detail in one vertex buffer, built once, and the level used for a ring is
+// picked each frame from how big the ring is on screen.
+class OrbitRings {
+public:
+	OrbitRings();
+
+	// Adds a ring of the given radius to the set. The ring lies in the local xy
+	// plane (like gluDisk), and basis is a column-major 3x3 rotation taking it
+	// into the space it is drawn in. With an eccentricity the ring is an
+	// ellipse instead, radius being its semi-major axis, with one focus at the
+	// origin and the near end along local y. Returns the ring's index. Rings
+	// must all be added before build() is called.
+	int add(float radius, const float basis[9], float eccentricity = 0);
+
+	// Tessellate every ring at every level of detail and upload the result.
+	// vertexArray also sets up a vertex array object feeding the positions to
+	// POSITION_ATTRIBUTE, for the core profile. Must be called with the owning
+	// context current.
+	void build(bool vertexArray = false);
+
+	// Number of line segments needed for a ring to look round, given the eye
+	// position in the ring's space and the number of pixels per unit at
+	// a distance of 1 from the eye.
+	int segmentsFor(int ring, const float eye[3], float pixelScale) const;
+
+	// Draw rings first..last (inclusive) in a single call: through the fixed
+	// function modelview matrix, or with --core through the program in use and
+	// the rings' vertex array object. eye is in the rings' space. If visible
+	// is set, rings whose entry in it is 0 are left out.
+	void draw(int first, int last, const float eye[3], float pixelScale, const unsigned char *visible = NULL);
+
+	// Radius of a sphere about the ring's origin that holds all of it: out to
+	// the far end of an ellipse, which is further than its semi-major axis
+	float boundingRadius(int ring) const { return rings[ring].radius * (1 + rings[ring].eccentricity); }
+	int count() const { return (int)rings.size(); }
+
+	// delete the vertex buffer and array
+	void release();
+
+	// running total of segments drawn by every draw() call, never reset;
+	// callers compare it before and after a draw to see what it did
+	int segmentsDrawn;
+
+private:
+	struct Ring {
+		float radius;
+		float eccentricity;
+		float basis[9];
+	};
+
+	std::vector<Ring> rings;
+	GLuint vbo, vao;
+	std::vector<GLint> firsts;   // firsts[ring * LEVELS + level]
+	std::vector<GLint> drawFirsts;
+	std::vector<GLsizei> drawCounts;
+};
+
+#endif
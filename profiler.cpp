@@ -0,0 +1,386 @@
+#include "profiler.h"
+#include "benchmark.h"
+#include "meshcache.h"
+#include "matrix.h"
+
+#include<algorithm>
+#include<stdio.h>
+#include<string.h>
+#include<string>
+
+// Most queries a context keeps, two per section in flight
+static const int MAX_QUERIES = 1024;
+
+// The GPU's clock is lined up with the CPU's again this often, in ms
+static const double CALIBRATE_INTERVAL = 1000;
+
+GpuTimer::GpuTimer() : available(false), firstPending(0), queryCount(0), offsetMs(0), calibratedMs(0) {
+}
+
+void GpuTimer::init() {
+	release();
+	int major = 0, minor = 0;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	if (version)
+		sscanf(version, "%d.%d", &major, &minor);
+	available = major * 10 + minor >= 33;
+	if (!available) {
+		// a core profile is 3.3 or later, so the list is always there to look at
+		const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+		available = extensions && strstr(extensions, "GL_ARB_timer_query");
+	}
+	if (!available) {
+		fprintf(stderr, "profiler: no timer queries, timing the CPU only\n");
+		return;
+	}
+	calibrate();
+}
+
+void GpuTimer::calibrate() {
+	GLint64 gpu = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpu);
+	calibratedMs = currentTimeMs();
+	offsetMs = calibratedMs - gpu / 1e6;
+}
+
+GLuint GpuTimer::takeQuery() {
+	if (!spare.empty()) {
+		GLuint query = spare.back();
+		spare.pop_back();
+		return query;
+	}
+	if (queryCount >= MAX_QUERIES)
+		return 0;
+	GLuint query = 0;
+	glGenQueries(1, &query);
+	queryCount++;
+	return query;
+}
+
+GLuint GpuTimer::begin() {
+	if (!available)
+		return 0;
+	GLuint query = takeQuery();
+	if (query)
+		glQueryCounter(query, GL_TIMESTAMP);
+	return query;
+}
+
+void GpuTimer::end(GLuint start, const char *name, int frame, int depth) {
+	GLuint query = takeQuery();
+	if (!query) {
+		spare.push_back(start);
+		return;
+	}
+	glQueryCounter(query, GL_TIMESTAMP);
+	Pending section = {start, query, name, frame, depth};
+	pending.push_back(section);
+}
+
+void GpuTimer::collect(Profiler &profiler) {
+	if (!available)
+		return;
+	// sections finish in the order they were issued, so stop at the first
+	// that hasn't
+	for (; firstPending < pending.size(); firstPending++) {
+		const Pending &section = pending[firstPending];
+		GLint ready = 0;
+		glGetQueryObjectiv(section.end, GL_QUERY_RESULT_AVAILABLE, &ready);
+		if (ready)
+			glGetQueryObjectiv(section.start, GL_QUERY_RESULT_AVAILABLE, &ready);
+		if (!ready)
+			break;
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(section.start, GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(section.end, GL_QUERY_RESULT, &end);
+		ProfileEvent event = {section.name, start / 1e6 + offsetMs, (end - start) / 1e6, section.frame, section.depth, true, 0};
+		profiler.record(event);
+		spare.push_back(section.start);
+		spare.push_back(section.end);
+	}
+	if (firstPending == pending.size()) {
+		pending.clear();
+		firstPending = 0;
+	}
+	else if (firstPending > pending.size() / 2) {
+		pending.erase(pending.begin(), pending.begin() + firstPending);
+		firstPending = 0;
+	}
+
+	if (currentTimeMs() - calibratedMs > CALIBRATE_INTERVAL)
+		calibrate();
+}
+
+void GpuTimer::release() {
+	for (size_t i = firstPending; i < pending.size(); i++) {
+		spare.push_back(pending[i].start);
+		spare.push_back(pending[i].end);
+	}
+	if (!spare.empty())
+		glDeleteQueries((GLsizei)spare.size(), &spare[0]);
+	spare.clear();
+	pending.clear();
+	firstPending = 0;
+	queryCount = 0;
+	available = false;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Profiler /////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// The calling thread's track, 0 until it calls profileThread(), and how many
+// sections it is in
+static thread_local int threadTrack = 0;
+static thread_local int threadDepth = 0;
+
+// the names of tracks 1 on, in the order the threads asked for them
+static std::mutex trackMutex;
+static std::vector<std::string> trackNames;
+
+void profileThread(const char *name) {
+	std::lock_guard<std::mutex> lock(trackMutex);
+	trackNames.push_back(name);
+	threadTrack = (int)trackNames.size();
+}
+
+Profiler::Profiler(size_t capacity)
+	: events(capacity), next(0), wrapped(false), gpuTimer(NULL), frame(0), startMs(currentTimeMs()) {
+	for (int i = 0; i < FRAME_HISTORY; i++) {
+		totals[i].frame = -1;
+		totals[i].cpuMs = totals[i].gpuMs = 0;
+	}
+}
+
+void Profiler::setGpuTimer(GpuTimer *timer) {
+	gpuTimer = timer;
+	if (gpuTimer)
+		gpuTimer->collect(*this);
+}
+
+void Profiler::beginFrame() {
+	frame++;
+}
+
+int Profiler::enter() {
+	return threadDepth++;
+}
+
+void Profiler::leave() {
+	threadDepth--;
+}
+
+void Profiler::record(const ProfileEvent &event) {
+	std::lock_guard<std::mutex> lock(mutex);
+	events[next] = event;
+	if (++next == events.size()) {
+		next = 0;
+		wrapped = true;
+	}
+
+	// a frame's outermost sections on the drawing thread add up to its total,
+	// as long as the frame is still in the history
+	if (event.depth > 0 || event.track != 0 || event.frame <= frame - FRAME_HISTORY)
+		return;
+	FrameTotal &total = totals[event.frame % FRAME_HISTORY];
+	if (total.frame != event.frame) {
+		total.frame = event.frame;
+		total.cpuMs = total.gpuMs = 0;
+	}
+	(event.gpu ? total.gpuMs : total.cpuMs) += (float)event.durationMs;
+}
+
+void Profiler::frameHistory(float cpuMs[FRAME_HISTORY], float gpuMs[FRAME_HISTORY]) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	// the frame being drawn isn't finished, so the newest is the one before
+	for (int i = 0; i < FRAME_HISTORY; i++) {
+		int f = frame - FRAME_HISTORY + i;
+		const FrameTotal &total = totals[(f + FRAME_HISTORY) % FRAME_HISTORY];
+		bool have = f >= 0 && total.frame == f;
+		cpuMs[i] = have ? total.cpuMs : 0;
+		gpuMs[i] = have ? total.gpuMs : 0;
+	}
+}
+
+bool Profiler::writeTrace(const char *path) const {
+	FILE *out = fopen(path, "w");
+	if (!out) {
+		fprintf(stderr, "profiler: could not write %s\n", path);
+		return false;
+	}
+	// one process, the drawing thread and the GPU as its first two threads
+	// and every other thread's track after them
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+	fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}");
+	{
+		std::lock_guard<std::mutex> tracks(trackMutex);
+		for (size_t i = 0; i < trackNames.size(); i++)
+			fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				(int)i + 3, trackNames[i].c_str());
+	}
+	size_t count = wrapped ? events.size() : next;
+	size_t first = wrapped ? next : 0;
+	for (size_t i = 0; i < count; i++) {
+		const ProfileEvent &event = events[(first + i) % events.size()];
+		// trace times are in microseconds
+		fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d}}",
+			event.name, event.gpu ? 2 : event.track > 0 ? event.track + 2 : 1, (event.startMs - startMs) * 1000, event.durationMs * 1000, event.frame);
+	}
+	fprintf(out, "\n]}\n");
+	if (fclose(out) != 0) {
+		fprintf(stderr, "profiler: could not write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+static Profiler *currentProfiler = NULL;
+
+void setProfiler(Profiler *profiler) {
+	currentProfiler = profiler;
+}
+
+Profiler *activeProfiler() {
+	return currentProfiler;
+}
+
+ProfileScope::ProfileScope(const char *name, bool gpu)
+	: profiler(currentProfiler), gpuTimer(NULL), name(name), startMs(0), query(0), frame(0), depth(0) {
+	if (!profiler)
+		return;
+	frame = profiler->getFrame();
+	depth = profiler->enter();
+	// the timer of the context current now, even if another is by the end.
+	// Only the drawing thread has a context.
+	if (gpu && threadTrack == 0 && profiler->getGpuTimer()) {
+		gpuTimer = profiler->getGpuTimer();
+		query = gpuTimer->begin();
+	}
+	startMs = currentTimeMs();
+}
+
+ProfileScope::~ProfileScope() {
+	if (!profiler)
+		return;
+	ProfileEvent event = {name, startMs, currentTimeMs() - startMs, frame, depth, false, threadTrack};
+	if (query)
+		gpuTimer->end(query, name, frame, depth);
+	profiler->leave();
+	profiler->record(event);
+}
+
+//////////////////////////////////////////////////////////////////
+/// On-screen graph //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// Layout of the graph in pixels, and the longest frame that fits
+static const float GRAPH_MARGIN = 8;
+static const float PIXELS_PER_MS = 4;
+static const float GRAPH_MAX_MS = 50;
+
+ProfileGraph::ProfileGraph() : core(NULL), vbo(0), vao(0) {
+}
+
+void ProfileGraph::init(CoreRenderer *coreRenderer) {
+	core = coreRenderer;
+	glGenBuffers(1, &vbo);
+	if (core) {
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glVertexAttribPointer(POSITION_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+// Adds a line from (x0, y0) to (x1, y1)
+static void addLine(std::vector<float> &vertices, float x0, float y0, float x1, float y1) {
+	vertices.push_back(x0);
+	vertices.push_back(y0);
+	vertices.push_back(x1);
+	vertices.push_back(y1);
+}
+
+void ProfileGraph::draw(const Profiler &profiler, int width, int height) {
+	if (!vbo)
+		return;
+	float cpuMs[Profiler::FRAME_HISTORY], gpuMs[Profiler::FRAME_HISTORY];
+	profiler.frameHistory(cpuMs, gpuMs);
+
+	// the 60 and 30 frames a second lines, then a bar per frame for the CPU,
+	// then for the GPU, each bar a pixel wide and side by side
+	vertices.clear();
+	float right = GRAPH_MARGIN + 2 * Profiler::FRAME_HISTORY;
+	addLine(vertices, GRAPH_MARGIN, GRAPH_MARGIN + PIXELS_PER_MS * 1000 / 60.0f, right, GRAPH_MARGIN + PIXELS_PER_MS * 1000 / 60.0f);
+	addLine(vertices, GRAPH_MARGIN, GRAPH_MARGIN + PIXELS_PER_MS * 1000 / 30.0f, right, GRAPH_MARGIN + PIXELS_PER_MS * 1000 / 30.0f);
+	const float *bars[2] = {cpuMs, gpuMs};
+	int barStart[2], barCount[2];
+	for (int b = 0; b < 2; b++) {
+		barStart[b] = (int)vertices.size() / 2;
+		for (int i = 0; i < Profiler::FRAME_HISTORY; i++) {
+			if (bars[b][i] <= 0)
+				continue;
+			float x = GRAPH_MARGIN + 2 * i + b + 0.5f;
+			addLine(vertices, x, GRAPH_MARGIN, x, GRAPH_MARGIN + PIXELS_PER_MS * std::min(bars[b][i], GRAPH_MAX_MS));
+		}
+		barCount[b] = (int)vertices.size() / 2 - barStart[b];
+	}
+	// orphaned each time, so the upload never waits on the last frame's draw
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), &vertices[0]);
+
+	float projection[16], identity[16];
+	mat4Ortho(0, (float)width, 0, (float)height, -1, 1, projection);
+	mat4Identity(identity);
+	static const float colors[3][4] = {
+		{0.5f, 0.5f, 0.5f, 1},    // frame rate lines
+		{0.2f, 0.9f, 0.2f, 1},    // CPU
+		{1.0f, 0.6f, 0.1f, 1}     // GPU
+	};
+	int firsts[3] = {0, barStart[0], barStart[1]};
+	int counts[3] = {4, barCount[0], barCount[1]};
+
+	glDisable(GL_DEPTH_TEST);
+	if (core) {
+		core->setProjection(projection);
+		core->setModelview(identity);
+		core->setLighting(false);
+		glBindVertexArray(vao);
+		for (int part = 0; part < 3; part++) {
+			core->setColor(colors[part][0], colors[part][1], colors[part][2], colors[part][3]);
+			core->apply();
+			glDrawArrays(GL_LINES, firsts[part], counts[part]);
+		}
+		glBindVertexArray(0);
+	}
+	else {
+		glMatrixMode(GL_PROJECTION);
+		glLoadMatrixf(projection);
+		glMatrixMode(GL_MODELVIEW);
+		glLoadMatrixf(identity);
+		glDisable(GL_LIGHTING);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(2, GL_FLOAT, 0, (const GLvoid *)0);
+		for (int part = 0; part < 3; part++) {
+			glColor4fv(colors[part]);
+			glDrawArrays(GL_LINES, firsts[part], counts[part]);
+		}
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glEnable(GL_LIGHTING);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void ProfileGraph::release() {
+	if (vbo)
+		glDeleteBuffers(1, &vbo);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	vbo = vao = 0;
+}
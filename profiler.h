@@ -0,0 +1,178 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "glplatform.h"
+#include "corerenderer.h"
+
+#include<atomic>
+#include<mutex>
+#include<stdio.h>
+#include<vector>
+
+// One timed section of a frame. name is a string literal and is never copied.
+// Times are on currentTimeMs()'s clock; GPU times are moved onto it.
+struct ProfileEvent {
+	const char *name;
+	double startMs;
+	double durationMs;
+	int frame;
+	int depth;     // how many sections it is nested in, on its thread
+	bool gpu;      // when the GPU ran the section's commands, not the CPU
+	int track;     // the thread that ran it, see profileThread()
+};
+
+class Profiler;
+
+// GL timestamp queries for ONE context. A section gets a query at each end,
+// and the results are only read once GL says they are there, frames later,
+// so timing the GPU never waits on it. Timestamps rather than GL_TIME_ELAPSED,
+// since elapsed time queries can't nest. If too many are still in flight new
+// sections go untimed instead.
+class GpuTimer {
+public:
+	GpuTimer();
+
+	// Check the context has timer queries (GL 3.3 or ARB_timer_query) and
+	// line its clock up with the CPU's. Must be called with the context current.
+	void init();
+	bool isAvailable() const { return available; }
+
+	// Query the time the GPU gets to this point. Returns the query, or 0 if
+	// there are none to spare or no timer queries.
+	GLuint begin();
+	// Close a section begun with begin(); its time goes to the profiler once
+	// the GPU has run it
+	void end(GLuint start, const char *name, int frame, int depth);
+
+	// Hand the profiler every section the GPU has finished, oldest first,
+	// without waiting for any
+	void collect(Profiler &profiler);
+
+	// delete the queries, dropping any results not collected
+	void release();
+
+private:
+	struct Pending {
+		GLuint start, end;
+		const char *name;
+		int frame, depth;
+	};
+
+	GLuint takeQuery();
+	void calibrate();
+
+	bool available;
+	std::vector<GLuint> spare;
+	std::vector<Pending> pending;   // oldest first, from firstPending on
+	size_t firstPending;
+	int queryCount;
+	double offsetMs;                // currentTimeMs() less the GPU clock
+	double calibratedMs;
+};
+
+// Rolling record of the sections timed over the last frames, on the CPU and,
+// with a GpuTimer, the GPU. Sections are timed by ProfileScope, on any thread.
+// Once full the oldest events are overwritten. The buffer can be written out
+// as Chrome trace events (chrome://tracing, Perfetto), and each frame's total
+// is kept for the on-screen graph. The totals are the drawing thread's alone;
+// other threads' sections are only in the trace.
+class Profiler {
+public:
+	// frames the graph shows
+	static const int FRAME_HISTORY = 120;
+
+	explicit Profiler(size_t capacity = 1 << 17);
+
+	// The GPU timer of the context being drawn, or NULL. Collects whatever
+	// the timer has finished.
+	void setGpuTimer(GpuTimer *timer);
+	GpuTimer *getGpuTimer() const { return gpuTimer; }
+
+	// Starts the next frame; sections are counted towards it from here
+	void beginFrame();
+	int getFrame() const { return frame; }
+
+	// ProfileScope's side: enter() returns the depth of a new section on the
+	// calling thread
+	int enter();
+	void leave();
+	void record(const ProfileEvent &event);
+
+	// CPU and GPU time of the last FRAME_HISTORY frames, oldest first: the
+	// sum of their outermost sections. GPU times lag a few frames behind and
+	// are 0 where there are none.
+	void frameHistory(float cpuMs[FRAME_HISTORY], float gpuMs[FRAME_HISTORY]) const;
+
+	// Writes the buffered events as Chrome trace event JSON. Returns false
+	// (and prints why) if the file can't be written.
+	bool writeTrace(const char *path) const;
+
+private:
+	struct FrameTotal {
+		int frame;
+		float cpuMs, gpuMs;
+	};
+
+	mutable std::mutex mutex;   // for the events and totals
+	std::vector<ProfileEvent> events;
+	size_t next;       // where the next event goes
+	bool wrapped;      // every slot has been written
+	FrameTotal totals[FRAME_HISTORY];
+	GpuTimer *gpuTimer;
+	std::atomic<int> frame;
+	double startMs;    // trace times count from here
+};
+
+// Points ProfileScope at a profiler, or turns profiling off with NULL
+void setProfiler(Profiler *profiler);
+Profiler *activeProfiler();
+
+// Gives the calling thread a track of its own in traces, under name. Threads
+// that don't are on the drawing thread's track, so any thread but that one
+// that times sections should call this first.
+void profileThread(const char *name);
+
+// Times the rest of the C++ scope it is declared in. With gpu set, the GPU's
+// time for the GL commands issued in it is taken too, if there is a GPU timer
+// and this is the drawing thread.
+// Does nothing unless a profiler has been set, so it can stay in the render
+// path.
+class ProfileScope {
+public:
+	explicit ProfileScope(const char *name, bool gpu = false);
+	~ProfileScope();
+
+private:
+	Profiler *profiler;
+	GpuTimer *gpuTimer;
+	const char *name;
+	double startMs;
+	GLuint query;
+	int frame, depth;
+};
+
+// The last FRAME_HISTORY frames as a bar graph in the bottom left corner of
+// the current viewport, for ONE context: a green bar per frame for the CPU
+// and an orange one for the GPU, 4 pixels to the millisecond, with grey lines
+// at 60 and 30 frames a second.
+class ProfileGraph {
+public:
+	ProfileGraph();
+
+	// core is the context's CoreRenderer in the core profile, or NULL
+	void init(CoreRenderer *core);
+
+	// Draws over whatever is there. Leaves the projection changed, so views
+	// drawn afterwards have to load theirs again.
+	void draw(const Profiler &profiler, int width, int height);
+
+	// delete the vertex buffer and array
+	void release();
+
+private:
+	CoreRenderer *core;
+	GLuint vbo, vao;
+	std::vector<float> vertices;
+};
+
+#endif
@@ -0,0 +1,478 @@
+#include "renderqueue.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "jobsystem.h"
+
+#include<stdio.h>
+#include<string.h>
+#include<algorithm>
+
+// Attribute slots of the per-instance matrix (four columns, so four slots)
+// and color. Clear of the fixed function arrays' aliases, as in the belt.
+static const GLuint INSTANCE_MATRIX_ATTRIBUTE = 8;
+static const GLuint INSTANCE_COLOR_ATTRIBUTE = 12;
+
+// Runs shorter than this are drawn one command at a time
+static const int MIN_INSTANCES = 2;
+
+// Commands per job when the sort keys and instances are filled in on threads
+static const int COMMAND_GRAIN = 1024;
+
+// Pipelines in the order they are drawn, the top bits of the sort key
+enum Pipeline {
+	PIPELINE_LIT,
+	PIPELINE_UNLIT,
+	PIPELINE_RINGS,
+	PIPELINE_BELT
+};
+
+// Values of boundProgram
+static const int PROGRAM_NONE = -1;
+static const int PROGRAM_FIXED = 0;      // fixed function, or the CoreRenderer's
+static const int PROGRAM_INSTANCED = 1;
+static const int PROGRAM_BELT = 2;
+
+// Lit like the fixed function pipeline lights the planets, as the belt's
+// shader is, but with the modelview matrix and color of each instance. The
+// normal matrix is the cofactor matrix of the instance's, which is right once
+// normalized even with the ship's uneven scales.
+static const char *vertexSource =
+	"#version 120\n"
+	"attribute mat4 instanceModelview;\n"
+	"attribute vec4 instanceColor;\n"
+	"void main() {\n"
+	"	gl_Position = gl_ProjectionMatrix * (instanceModelview * gl_Vertex);\n"
+	"	mat3 m = mat3(instanceModelview);\n"
+	"	mat3 normalMatrix = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));\n"
+	"	vec3 normal = normalize(normalMatrix * gl_Normal);\n"
+	"	vec3 light = gl_LightModel.ambient.rgb;\n"
+	"	for (int i = 0; i < 2; i++)\n"
+	"		light += gl_LightSource[i].diffuse.rgb * max(dot(normal, normalize(gl_LightSource[i].position.xyz)), 0.0);\n"
+	"	gl_FrontColor = vec4(instanceColor.rgb * light, instanceColor.a);\n"
+	"}\n";
+
+static const char *fragmentSource =
+	"#version 120\n"
+	"void main() {\n"
+	"	gl_FragColor = gl_Color;\n"
+	"}\n";
+
+// The same for the core profile. Follows frameBlockSource.
+static const char *coreVertexSource =
+	"in vec3 position;\n"
+	"in vec3 normal;\n"
+	"in mat4 instanceModelview;\n"
+	"in vec4 instanceColor;\n"
+	"out vec4 shade;\n"
+	"void main() {\n"
+	"	gl_Position = projection * (instanceModelview * vec4(position, 1.0));\n"
+	"	mat3 m = mat3(instanceModelview);\n"
+	"	mat3 normalMatrix = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));\n"
+	"	vec3 light = lightColor(normalize(normalMatrix * normal));\n"
+	"	shade = vec4(clamp(instanceColor.rgb * light, 0.0, 1.0), instanceColor.a);\n"
+	"}\n";
+
+static const char *coreFragmentSource =
+	"#version 330\n"
+	"in vec4 shade;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	fragColor = shade;\n"
+	"}\n";
+
+// Compiles one shader stage from its parts, printing the log if it fails
+static GLuint compileShader(GLenum type, const char *const *parts, int count) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, count, parts, NULL);
+	glCompileShader(shader);
+	GLint ok = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "render queue shader failed to compile: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// Sort key of a command: the pipeline, then the mesh's buffer, then the depth
+// of its origin in front of the eye. Depths are positive floats in front, and
+// those sort the same as their bits do.
+static unsigned long long sortKey(Pipeline pipeline, GLuint vbo, const float *modelview) {
+	float depth = -modelview[14];
+	if (!(depth > 0))
+		depth = 0;
+	unsigned int bits;
+	memcpy(&bits, &depth, 4);
+	return (unsigned long long)pipeline << 62 | (unsigned long long)(vbo & 0x3fffff) << 40 | bits;
+}
+
+RenderQueue::RenderQueue()
+	: core(NULL), program(0), instanceBuffer(0), vao(0), vaoMesh(NULL), lit(true), boundMesh(NULL),
+	boundProgram(PROGRAM_NONE), boundLit(-1), drawCalls(0), stateChanges(0) {
+	// a fresh context draws in white
+	color[0] = color[1] = color[2] = color[3] = 1;
+	for (int k = 0; k < 4; k++)
+		boundColor[k] = -1;
+}
+
+void RenderQueue::init(CoreRenderer *coreRenderer) {
+	core = coreRenderer;
+	vaoMesh = NULL;
+	// glDrawArraysInstanced is GL 3.1 and glVertexAttribDivisor is GL 3.3
+	int major = 0, minor = 0;
+	const char *version = (const char *)glGetString(GL_VERSION);
+	if (!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33) {
+		fprintf(stderr, "render queue: no instancing without OpenGL 3.3, drawing one at a time\n");
+		return;
+	}
+
+	const char *coreVertexParts[] = {"#version 330\n", frameBlockSource, coreVertexSource};
+	GLuint vertex = core ? compileShader(GL_VERTEX_SHADER, coreVertexParts, 3)
+		: compileShader(GL_VERTEX_SHADER, &vertexSource, 1);
+	GLuint fragment = compileShader(GL_FRAGMENT_SHADER, core ? &coreFragmentSource : &fragmentSource, 1);
+	if (!vertex || !fragment)
+		return;
+	program = glCreateProgram();
+	glAttachShader(program, vertex);
+	glAttachShader(program, fragment);
+	if (core) {
+		glBindAttribLocation(program, POSITION_ATTRIBUTE, "position");
+		glBindAttribLocation(program, NORMAL_ATTRIBUTE, "normal");
+	}
+	glBindAttribLocation(program, INSTANCE_MATRIX_ATTRIBUTE, "instanceModelview");
+	glBindAttribLocation(program, INSTANCE_COLOR_ATTRIBUTE, "instanceColor");
+	glLinkProgram(program);
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+	GLint ok = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "render queue shader failed to link: %s\n", log);
+		release();
+		return;
+	}
+	glGenBuffers(1, &instanceBuffer);
+
+	if (core) {
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Frame"), FRAME_BINDING);
+		// the attributes move with each run, so only which are on and their
+		// divisors live in the vertex array object
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+		glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+		for (GLuint column = 0; column < 4; column++) {
+			glEnableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE + column);
+			glVertexAttribDivisor(INSTANCE_MATRIX_ATTRIBUTE + column, 1);
+		}
+		glEnableVertexAttribArray(INSTANCE_COLOR_ATTRIBUTE);
+		glVertexAttribDivisor(INSTANCE_COLOR_ATTRIBUTE, 1);
+		glBindVertexArray(0);
+	}
+}
+
+void RenderQueue::setColor(float r, float g, float b, float a) {
+	color[0] = r; color[1] = g; color[2] = b; color[3] = a;
+}
+
+void RenderQueue::setLighting(bool on) {
+	lit = on;
+}
+
+RenderQueue::Command &RenderQueue::add(Kind kind, const Mesh *mesh, const float modelview[16]) {
+	commands.push_back(Command());
+	Command &command = commands.back();
+	command.kind = kind;
+	command.mesh = mesh;
+	memcpy(command.modelview, modelview, sizeof(command.modelview));
+	memcpy(command.color, color, sizeof(command.color));
+	command.lit = lit;
+	command.extra = -1;
+	return command;
+}
+
+void RenderQueue::submit(const Mesh &mesh, const float modelview[16]) {
+	add(COMMAND_MESH, &mesh, modelview);
+}
+
+void RenderQueue::submitRings(OrbitRings &set, int first, int last, const float eye[3], float pixelScale,
+	const unsigned char *visible, const float modelview[16]) {
+	Command &command = add(COMMAND_RINGS, NULL, modelview);
+	command.extra = (int)rings.size();
+	RingsCommand ring;
+	ring.rings = &set;
+	ring.first = first;
+	ring.last = last;
+	ring.eye[0] = eye[0]; ring.eye[1] = eye[1]; ring.eye[2] = eye[2];
+	ring.pixelScale = pixelScale;
+	// the flags are indexed by ring, so keep them from 0 up to last
+	ring.visible = (int)ringFlags.size();
+	ringFlags.insert(ringFlags.end(), visible, visible + last + 1);
+	rings.push_back(ring);
+}
+
+void RenderQueue::submitBelt(BeltRenderer &renderer, const AsteroidBelt &belt, const Mesh &mesh, const bool *visible,
+	const float modelview[16]) {
+	Command &command = add(COMMAND_BELT, &mesh, modelview);
+	command.extra = (int)belts.size();
+	BeltCommand entry;
+	entry.renderer = &renderer;
+	entry.belt = &belt;
+	for (int s = 0; s < BELT_SECTORS; s++)
+		entry.visible[s] = visible ? visible[s] : true;
+	belts.push_back(entry);
+}
+
+void RenderQueue::flush(JobSystem *jobs) {
+	ProfileScope scope("RenderQueue::flush", true);
+	drawCalls = stateChanges = 0;
+	boundMesh = NULL;
+	boundProgram = PROGRAM_NONE;
+	boundLit = -1;
+	// another queue may have drawn in this context since
+	for (int k = 0; k < 4; k++)
+		boundColor[k] = -1;
+
+	order.resize(commands.size());
+	parallelFor(jobs, "RenderQueue::sortKeys", (int)commands.size(), COMMAND_GRAIN, [this](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const Command &command = commands[i];
+			Pipeline pipeline = command.kind == COMMAND_RINGS ? PIPELINE_RINGS
+				: command.kind == COMMAND_BELT ? PIPELINE_BELT
+				: command.lit ? PIPELINE_LIT : PIPELINE_UNLIT;
+			order[i] = std::make_pair(sortKey(pipeline, command.mesh ? command.mesh->vbo : 0, command.modelview), i);
+		}
+	});
+	std::sort(order.begin(), order.end());
+
+	// find the runs to merge and lay their instances out back to back, so
+	// they go up in one upload
+	runs.clear();
+	instanceOrder.clear();
+	for (size_t i = 0; i < order.size(); ) {
+		const Command &start = commands[order[i].second];
+		size_t end = i + 1;
+		if (start.kind == COMMAND_MESH && start.lit) {
+			while (end < order.size() && commands[order[end].second].kind == COMMAND_MESH
+				&& commands[order[end].second].lit && commands[order[end].second].mesh == start.mesh)
+				end++;
+		}
+		if (program && start.kind == COMMAND_MESH && start.lit && (int)(end - i) >= MIN_INSTANCES) {
+			Run run = {(int)i, (int)end, (int)instanceOrder.size()};
+			runs.push_back(run);
+			for (size_t k = i; k < end; k++)
+				instanceOrder.push_back(order[k].second);
+		}
+		i = end;
+	}
+	instances.resize(instanceOrder.size());
+	parallelFor(jobs, "RenderQueue::instances", (int)instances.size(), COMMAND_GRAIN, [this](int begin, int end) {
+		for (int k = begin; k < end; k++) {
+			const Command &command = commands[instanceOrder[k]];
+			memcpy(instances[k].modelview, command.modelview, sizeof(instances[k].modelview));
+			memcpy(instances[k].color, command.color, sizeof(instances[k].color));
+		}
+	});
+	if (!instances.empty()) {
+		// orphan the old storage so the upload doesn't wait on the last draw
+		GLsizeiptr bytes = instances.size() * sizeof(Instance);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &instances[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	size_t nextRun = 0;
+	for (size_t i = 0; i < order.size(); ) {
+		if (nextRun < runs.size() && runs[nextRun].begin == (int)i) {
+			const Run &run = runs[nextRun++];
+			drawInstanced(*commands[order[i].second].mesh, run.firstInstance, run.end - run.begin);
+			i = run.end;
+		}
+		else {
+			drawCommand(commands[order[i].second]);
+			i++;
+		}
+	}
+
+	// leave GL as the rest of the program expects it
+	if (boundMesh)
+		MeshCache::unbind(*boundMesh);
+	if (!core && boundProgram != PROGRAM_FIXED && boundProgram != PROGRAM_NONE)
+		glUseProgram(0);
+	if (core)
+		glBindVertexArray(0);
+
+	countFrame(COUNTER_COMMANDS, (int)commands.size());
+	countFrame(COUNTER_DRAW_CALLS, drawCalls);
+	countFrame(COUNTER_STATE_CHANGES, stateChanges);
+	commands.clear();
+	rings.clear();
+	ringFlags.clear();
+	belts.clear();
+}
+
+void RenderQueue::drawInstanced(const Mesh &mesh, int first, int count) {
+	if (boundProgram != PROGRAM_INSTANCED) {
+		glUseProgram(program);
+		if (core)
+			core->programChanged();
+		boundProgram = PROGRAM_INSTANCED;
+		stateChanges++;
+	}
+
+	size_t offset = first * sizeof(Instance);
+	if (core) {
+		// the queue's own vertex array object, pointed at this mesh
+		glBindVertexArray(vao);
+		if (vaoMesh != &mesh) {
+			glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+			glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)0);
+			glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (const GLvoid *)(3 * sizeof(float)));
+			vaoMesh = &mesh;
+		}
+		boundMesh = NULL;
+	}
+	else if (boundMesh != &mesh) {
+		if (boundMesh)
+			MeshCache::unbind(*boundMesh);
+		MeshCache::bind(mesh);
+		boundMesh = &mesh;
+	}
+	stateChanges++;
+
+	// GL 3.3 has no base instance, so the attributes start at the run instead
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	for (GLuint column = 0; column < 4; column++) {
+		if (!core) {
+			glEnableVertexAttribArray(INSTANCE_MATRIX_ATTRIBUTE + column);
+			glVertexAttribDivisor(INSTANCE_MATRIX_ATTRIBUTE + column, 1);
+		}
+		glVertexAttribPointer(INSTANCE_MATRIX_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+			(const GLvoid *)(offset + column * 4 * sizeof(float)));
+	}
+	if (!core) {
+		glEnableVertexAttribArray(INSTANCE_COLOR_ATTRIBUTE);
+		glVertexAttribDivisor(INSTANCE_COLOR_ATTRIBUTE, 1);
+	}
+	glVertexAttribPointer(INSTANCE_COLOR_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+		(const GLvoid *)(offset + 16 * sizeof(float)));
+	glDrawArraysInstanced(mesh.mode, 0, mesh.count, count);
+	drawCalls++;
+
+	if (!core) {
+		for (GLuint attribute = INSTANCE_MATRIX_ATTRIBUTE; attribute <= INSTANCE_COLOR_ATTRIBUTE; attribute++) {
+			glVertexAttribDivisor(attribute, 0);
+			glDisableVertexAttribArray(attribute);
+		}
+		// the mesh's arrays were set up from its own buffer
+		glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+void RenderQueue::useFixedState(const Command &command) {
+	if (boundProgram != PROGRAM_FIXED) {
+		if (core)
+			core->programChanged();
+		else if (boundProgram != PROGRAM_NONE)
+			glUseProgram(0);
+		boundProgram = PROGRAM_FIXED;
+		stateChanges++;
+	}
+	if (boundLit != (int)command.lit) {
+		if (core)
+			core->setLighting(command.lit);
+		else if (command.lit)
+			glEnable(GL_LIGHTING);
+		else
+			glDisable(GL_LIGHTING);
+		boundLit = command.lit;
+		stateChanges++;
+	}
+	if (memcmp(boundColor, command.color, sizeof(boundColor)) != 0) {
+		if (core)
+			core->setColor(command.color[0], command.color[1], command.color[2], command.color[3]);
+		else
+			glColor4fv(command.color);
+		memcpy(boundColor, command.color, sizeof(boundColor));
+		stateChanges++;
+	}
+	if (core) {
+		core->setModelview(command.modelview);
+		core->apply();
+	}
+	else {
+		glLoadMatrixf(command.modelview);
+	}
+}
+
+void RenderQueue::drawCommand(const Command &command) {
+	if (command.kind == COMMAND_MESH) {
+		useFixedState(command);
+		if (boundMesh != command.mesh) {
+			if (boundMesh)
+				MeshCache::unbind(*boundMesh);
+			MeshCache::bind(*command.mesh);
+			boundMesh = command.mesh;
+			stateChanges++;
+		}
+		glDrawArrays(command.mesh->mode, 0, command.mesh->count);
+		drawCalls++;
+		return;
+	}
+
+	// rings and the belt set up their own arrays
+	if (boundMesh)
+		MeshCache::unbind(*boundMesh);
+	boundMesh = NULL;
+	stateChanges++;
+
+	if (command.kind == COMMAND_RINGS) {
+		const RingsCommand &ring = rings[command.extra];
+		useFixedState(command);
+		int before = ring.rings->segmentsDrawn;
+		ring.rings->draw(ring.first, ring.last, ring.eye, ring.pixelScale, &ringFlags[ring.visible]);
+		if (ring.rings->segmentsDrawn != before)
+			drawCalls++;
+		return;
+	}
+
+	const BeltCommand &entry = belts[command.extra];
+	if (core) {
+		drawCalls += entry.renderer->draw(*entry.belt, *command.mesh, entry.visible, command.modelview);
+		core->programChanged();
+		boundProgram = PROGRAM_BELT;
+	}
+	else {
+		if (boundProgram != PROGRAM_FIXED && boundProgram != PROGRAM_NONE)
+			glUseProgram(0);
+		glLoadMatrixf(command.modelview);
+		drawCalls += entry.renderer->draw(*entry.belt, *command.mesh, entry.visible);
+		// the belt puts the fixed function pipeline back when it's done
+		boundProgram = PROGRAM_FIXED;
+	}
+	stateChanges++;
+}
+
+void RenderQueue::release() {
+	if (program)
+		glDeleteProgram(program);
+	if (instanceBuffer)
+		glDeleteBuffers(1, &instanceBuffer);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	program = instanceBuffer = vao = 0;
+	vaoMesh = NULL;
+	commands.clear();
+	rings.clear();
+	ringFlags.clear();
+	belts.clear();
+}
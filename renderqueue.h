@@ -0,0 +1,140 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "glplatform.h"
+#include "meshcache.h"
+#include "orbitrings.h"
+#include "belt.h"
+#include "corerenderer.h"
+
+#include<vector>
+
+class JobSystem;
+
+// Draw commands gathered over a view and sent to GL in one go at its end, for
+// ONE context. Each command keeps the modelview matrix, color and lighting
+// that were current when it was submitted, so what it draws doesn't depend on
+// where it ends up in the order.
+//
+// Commands are sorted on a key made of, most significant first: the pipeline
+// they need (lit meshes, unlit meshes, orbit rings, the belt's instancing),
+// the mesh, and the depth of the object's origin, near to far so the front
+// fills the depth buffer first. That puts everything sharing state together.
+// A run of lit commands drawing the same mesh then goes out as one instanced
+// draw, with the matrices and colors as per-instance attributes, and the
+// rest are drawn one at a time, setting only the state that differs from the
+// command before.
+class RenderQueue {
+public:
+	RenderQueue();
+
+	// Compile the instancing shader and create its buffer. core is the
+	// context's CoreRenderer in the core profile, or NULL for the fixed
+	// function pipeline. If the context can't do instancing the runs are
+	// drawn one command at a time instead. Must be called with the owning
+	// context current.
+	void init(CoreRenderer *core);
+
+	// State for the commands submitted from here on, like glColor4f and
+	// GL_LIGHTING
+	void setColor(float r, float g, float b, float a);
+	void setLighting(bool on);
+
+	// A mesh at the given modelview matrix
+	void submit(const Mesh &mesh, const float modelview[16]);
+	// Rings first..last of a set, as OrbitRings::draw would draw them. The
+	// flags in visible are copied.
+	void submitRings(OrbitRings &rings, int first, int last, const float eye[3], float pixelScale,
+		const unsigned char *visible, const float modelview[16]);
+	// The belt's sectors that are visible, as BeltRenderer::draw would draw
+	// them. The flags in visible are copied.
+	void submitBelt(BeltRenderer &renderer, const AsteroidBelt &belt, const Mesh &mesh, const bool *visible,
+		const float modelview[16]);
+
+	// Sort, merge and draw everything submitted, then empty the queue. Adds
+	// the commands, draw calls and state changes to the frame's counters.
+	// With jobs, the sort keys and the instance data are filled in on its
+	// threads; the GL calls are all made on the calling one.
+	void flush(JobSystem *jobs = NULL);
+
+	// what the last flush did
+	int getDrawCalls() const { return drawCalls; }
+	int getStateChanges() const { return stateChanges; }
+
+	// delete the program and buffers
+	void release();
+
+private:
+	enum Kind {
+		COMMAND_MESH,
+		COMMAND_RINGS,
+		COMMAND_BELT
+	};
+
+	struct Command {
+		Kind kind;
+		const Mesh *mesh;
+		float modelview[16];
+		float color[4];
+		bool lit;
+		int extra;   // index into rings or belts
+	};
+
+	struct RingsCommand {
+		OrbitRings *rings;
+		int first, last;
+		float eye[3];
+		float pixelScale;
+		int visible;   // offset of the flags in ringFlags
+	};
+
+	struct BeltCommand {
+		BeltRenderer *renderer;
+		const AsteroidBelt *belt;
+		bool visible[BELT_SECTORS];
+	};
+
+	// per-instance attributes of a merged draw
+	struct Instance {
+		float modelview[16];
+		float color[4];
+	};
+
+	// sorted commands begin..end drawn as one, from instances firstInstance on
+	struct Run {
+		int begin, end, firstInstance;
+	};
+
+	Command &add(Kind kind, const Mesh *mesh, const float modelview[16]);
+	void drawInstanced(const Mesh &mesh, int first, int count);
+	// State changes on the way to drawing a command on its own
+	void useFixedState(const Command &command);
+	void drawCommand(const Command &command);
+
+	CoreRenderer *core;
+	GLuint program, instanceBuffer, vao;
+	const Mesh *vaoMesh;   // the mesh vao's arrays point at
+
+	float color[4];
+	bool lit;
+
+	std::vector<Command> commands;
+	std::vector<RingsCommand> rings;
+	std::vector<unsigned char> ringFlags;
+	std::vector<BeltCommand> belts;
+	// (key, submission index), sorted for the flush
+	std::vector<std::pair<unsigned long long, int> > order;
+	std::vector<Run> runs;
+	std::vector<int> instanceOrder;   // the command each instance is from
+	std::vector<Instance> instances;
+
+	// what GL was last left with during a flush, so only changes are made
+	// and counted. Reset at the start of each flush.
+	const Mesh *boundMesh;
+	int boundProgram;   // -1 none, 0 fixed function or CoreRenderer, 1 instancing, 2 belt
+	float boundColor[4];
+	int boundLit;
+	int drawCalls, stateChanges;
+};
+
+#endif
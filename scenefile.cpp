@@ -0,0 +1,488 @@
+#include "scenefile.h"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<map>
+
+#include<algorithm>
+
+#if !defined(_WIN32)
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#endif
+
+static const char MAGIC[8] = {'S', 'S', 'S', 'C', 'E', 'N', 'E', 0};
+static const unsigned int VERSION = 1;
+// written as is, so a file from a machine with the other byte order reads
+// back as 0x04030201 and is refused
+static const unsigned int BYTE_ORDER_MARK = 0x01020304;
+// every array starts on a cache line
+static const size_t ALIGNMENT = 64;
+
+// Start of a compiled scene. Offsets are from the start of the file.
+struct SceneHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned int bodies;
+	unsigned int firstRock;
+	int reference;
+	int beltParent;
+	float beltInner, beltOuter;
+	unsigned int nameBytes;
+	unsigned int padding;
+	unsigned long long namesOffset;
+	unsigned long long arrayOffsets[SCENE_ARRAY_COUNT];
+};
+
+static bool isIntArray(int array) {
+	return array == SCENE_PARENT || array == SCENE_FLAGS || array == SCENE_NAME;
+}
+
+static size_t alignUp(size_t offset) {
+	return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+SceneFile::SceneFile() : mapping(NULL), mappingBytes(0) {
+	close();
+}
+
+SceneFile::~SceneFile() {
+	close();
+}
+
+void SceneFile::close() {
+	unmap();
+	compiled = false;
+	for (int a = 0; a < SCENE_ARRAY_COUNT; a++) {
+		floatStorage[a].clear();
+		intStorage[a].clear();
+		arrays[a] = NULL;
+	}
+	nameStorage.clear();
+	names = "";
+	bodyCount = firstRock = 0;
+	reference = beltParent = -1;
+	beltInner = 4.3f;
+	beltOuter = 4.7f;
+}
+
+int SceneFile::find(const char *bodyName) const {
+	for (int i = 0; i < firstRock; i++)
+		if (!strcmp(name(i), bodyName))
+			return i;
+	return -1;
+}
+
+bool SceneFile::load(const char *path) {
+	close();
+	const char *data = NULL;
+	size_t size = 0;
+#if defined(_WIN32)
+	// no mmap here, so the file is read in and used from memory all the same
+	FILE *in = fopen(path, "rb");
+	if (!in) {
+		fprintf(stderr, "scene: could not read %s\n", path);
+		return false;
+	}
+	char chunk[65536];
+	size_t got;
+	while ((got = fread(chunk, 1, sizeof(chunk), in)) > 0)
+		fileCopy.insert(fileCopy.end(), chunk, chunk + got);
+	fclose(in);
+	data = fileCopy.empty() ? "" : &fileCopy[0];
+	size = fileCopy.size();
+#else
+	int descriptor = open(path, O_RDONLY);
+	struct stat info;
+	if (descriptor < 0 || fstat(descriptor, &info) != 0) {
+		fprintf(stderr, "scene: could not read %s\n", path);
+		if (descriptor >= 0)
+			::close(descriptor);
+		return false;
+	}
+	size = (size_t)info.st_size;
+	if (size > 0) {
+		void *memory = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (memory != MAP_FAILED) {
+			mapping = memory;
+			mappingBytes = size;
+		}
+	}
+	::close(descriptor);
+	if (size > 0 && !mapping) {
+		fprintf(stderr, "scene: could not map %s\n", path);
+		return false;
+	}
+	data = mapping ? (const char *)mapping : "";
+#endif
+
+	if (size >= sizeof(MAGIC) && memcmp(data, MAGIC, sizeof(MAGIC)) == 0)
+		return useCompiled(path, data, size);
+	// a text scene is copied into arrays, so its file can go
+	bool ok = parse(path, data, size);
+	unmap();
+	return ok;
+}
+
+void SceneFile::unmap() {
+#if !defined(_WIN32)
+	if (mapping)
+		munmap(mapping, mappingBytes);
+#endif
+	mapping = NULL;
+	mappingBytes = 0;
+	fileCopy.clear();
+}
+
+//////////////////////////////////////////////////////////////////
+/// Compiled scenes //////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+bool SceneFile::useCompiled(const char *path, const char *base, size_t size) {
+	if (size < sizeof(SceneHeader)) {
+		fprintf(stderr, "scene: %s is cut off\n", path);
+		close();
+		return false;
+	}
+	const SceneHeader &header = *(const SceneHeader *)base;
+	if (header.version != VERSION || header.byteOrder != BYTE_ORDER_MARK) {
+		fprintf(stderr, "scene: %s was compiled by another version or for another machine\n", path);
+		close();
+		return false;
+	}
+	compiled = true;
+	bodyCount = (int)header.bodies;
+	firstRock = (int)header.firstRock;
+	reference = header.reference;
+	beltParent = header.beltParent;
+	beltInner = header.beltInner;
+	beltOuter = header.beltOuter;
+
+	// everything the header points at has to be inside the file
+	bool fits = header.bodies > 0 && header.bodies < 0x40000000 && header.firstRock <= header.bodies
+		&& header.namesOffset <= size && header.nameBytes > 0 && header.nameBytes <= size - header.namesOffset
+		&& base[header.namesOffset + header.nameBytes - 1] == 0
+		&& reference >= -1 && reference < bodyCount && beltParent >= 0 && beltParent < firstRock;
+	for (int a = 0; a < SCENE_ARRAY_COUNT && fits; a++) {
+		unsigned long long offset = header.arrayOffsets[a];
+		fits = offset % ALIGNMENT == 0 && offset <= size && (size - offset) / 4 >= header.bodies;
+		arrays[a] = base + offset;
+	}
+	names = base + header.namesOffset;
+	// parents before children is what lets the scene be used without
+	// sorting, and the belt needs every rock on one parent
+	const int *parents = ints(SCENE_PARENT), *nameOffsets = ints(SCENE_NAME);
+	for (int i = 0; i < bodyCount && fits; i++)
+		fits = parents[i] >= -1 && parents[i] < i && (i < firstRock || parents[i] == beltParent);
+	for (int i = 0; i < firstRock && fits; i++)
+		fits = nameOffsets[i] >= 0 && (unsigned int)nameOffsets[i] < header.nameBytes;
+	if (!fits) {
+		fprintf(stderr, "scene: %s is damaged\n", path);
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool SceneFile::save(const char *path) const {
+	FILE *out = fopen(path, "wb");
+	if (!out) {
+		fprintf(stderr, "scene: could not write %s\n", path);
+		return false;
+	}
+	SceneHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, 8);
+	header.version = VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.bodies = bodyCount;
+	header.firstRock = firstRock;
+	header.reference = reference;
+	header.beltParent = beltParent;
+	header.beltInner = beltInner;
+	header.beltOuter = beltOuter;
+
+	size_t offset = alignUp(sizeof(SceneHeader));
+	for (int a = 0; a < SCENE_ARRAY_COUNT; a++) {
+		header.arrayOffsets[a] = offset;
+		offset = alignUp(offset + 4 * (size_t)bodyCount);
+	}
+	// the name table runs to the last name's terminator
+	size_t nameBytes = 1;
+	for (int i = 0; i < firstRock; i++)
+		nameBytes = std::max(nameBytes, ints(SCENE_NAME)[i] + strlen(name(i)) + 1);
+	header.namesOffset = offset;
+	header.nameBytes = (unsigned int)nameBytes;
+
+	static const char zeros[ALIGNMENT] = {0};
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	size_t written = sizeof(header);
+	for (int a = 0; a < SCENE_ARRAY_COUNT && ok; a++) {
+		ok = fwrite(zeros, 1, header.arrayOffsets[a] - written, out) == header.arrayOffsets[a] - written
+			&& fwrite(arrays[a], 4, bodyCount, out) == (size_t)bodyCount;
+		written = header.arrayOffsets[a] + 4 * (size_t)bodyCount;
+	}
+	ok = ok && fwrite(zeros, 1, header.namesOffset - written, out) == header.namesOffset - written
+		&& fwrite(names, 1, nameBytes, out) == nameBytes;
+	if (fclose(out) != 0 || !ok) {
+		fprintf(stderr, "scene: could not write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Text scenes //////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+// One body while a text scene is read, before rocks are moved to the end
+struct ParsedBody {
+	float values[SCENE_ARRAY_COUNT];
+	int parent, flags, name;
+};
+
+// Splits a line into words at spaces and tabs, stopping at a '#'
+static int splitWords(char *line, char **words, int most) {
+	int count = 0;
+	char *p = line;
+	while (*p && count < most) {
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if (!*p || *p == '#')
+			break;
+		words[count++] = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#')
+			p++;
+		if (*p == '#') {
+			*p = 0;
+			break;
+		}
+		if (*p)
+			*p++ = 0;
+	}
+	return count;
+}
+
+static bool readFloat(const char *word, float &out) {
+	char *end;
+	out = strtof(word, &end);
+	return end != word && *end == 0;
+}
+
+// The key=value words after a body or rock's columns. Returns false with the
+// word at fault in bad.
+static bool readAttributes(char **words, int count, ParsedBody &body, const char *&bad) {
+	for (int w = 0; w < count; w++) {
+		bad = words[w];
+		char *equals = strchr(words[w], '=');
+		if (!equals)
+			return false;
+		*equals = 0;
+		const char *key = words[w], *value = equals + 1;
+		float *v = body.values;
+		if (!strcmp(key, "angle")) {
+			if (!readFloat(value, v[SCENE_ANGLE])) return false;
+		}
+		else if (!strcmp(key, "mass")) {
+			if (!readFloat(value, v[SCENE_MASS])) return false;
+		}
+		else if (!strcmp(key, "e")) {
+			if (!readFloat(value, v[SCENE_ECCENTRICITY]) || v[SCENE_ECCENTRICITY] < 0 || v[SCENE_ECCENTRICITY] >= 1)
+				return false;
+		}
+		else if (!strcmp(key, "i")) {
+			if (!readFloat(value, v[SCENE_INCLINATION])) return false;
+		}
+		else if (!strcmp(key, "node")) {
+			if (!readFloat(value, v[SCENE_NODE])) return false;
+		}
+		else if (!strcmp(key, "peri")) {
+			if (!readFloat(value, v[SCENE_PERIAPSIS])) return false;
+		}
+		else if (!strcmp(key, "ring")) {
+			if (!readFloat(value, v[SCENE_RING_INSET])) return false;
+			body.flags |= SCENE_HAS_RING;
+		}
+		else if (!strcmp(key, "disk")) {
+			char *inner = (char *)value, *outer = strchr(inner, ','), *tilt = outer ? strchr(outer + 1, ',') : NULL;
+			if (!tilt)
+				return false;
+			*outer++ = 0;
+			*tilt++ = 0;
+			if (!readFloat(inner, v[SCENE_DISK_INNER]) || !readFloat(outer, v[SCENE_DISK_OUTER]) || !readFloat(tilt, v[SCENE_DISK_TILT]))
+				return false;
+			body.flags |= SCENE_HAS_DISK;
+		}
+		else if (!strcmp(key, "spin")) {
+			if (!strcmp(value, "0"))
+				body.flags |= SCENE_NO_SPIN;
+			else if (strcmp(value, "1"))
+				return false;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+bool SceneFile::parse(const char *path, const char *text, size_t size) {
+	std::vector<ParsedBody> bodies, rocks;
+	std::map<std::string, int> indices;
+	std::string referenceName;
+	bool haveBelt = false;
+	nameStorage.assign(1, '\0');   // offset 0 is the empty name rocks share
+
+	std::string line;
+	int lineNumber = 0;
+	size_t pos = 0;
+	while (pos < size) {
+		size_t end = pos;
+		while (end < size && text[end] != '\n')
+			end++;
+		line.assign(text + pos, end - pos);
+		pos = end + 1;
+		lineNumber++;
+
+		char *words[32];
+		int count = splitWords(&line[0], words, 32);
+		if (count == 0)
+			continue;
+		const char *bad = words[0];
+		bool ok = true;
+
+		if (!strcmp(words[0], "body") || !strcmp(words[0], "rock")) {
+			bool rock = words[0][0] == 'r';
+			// body NAME PARENT RATE RADIUS ORBIT TILT R G B A, or
+			// rock PARENT RATE RADIUS ORBIT TILT R G B ANGLE
+			int first = rock ? 2 : 3;
+			if (count < first + 8) {
+				fprintf(stderr, "scene: %s:%d: %s needs %d values\n", path, lineNumber, words[0], first + 7);
+				close();
+				return false;
+			}
+			ParsedBody body;
+			memset(&body, 0, sizeof(body));
+			body.flags = rock ? SCENE_ROCK : 0;
+			const char *parentName = words[first - 1];
+			if (!strcmp(parentName, "-"))
+				body.parent = -1;
+			else if (indices.count(parentName))
+				body.parent = indices[parentName];
+			else {
+				fprintf(stderr, "scene: %s:%d: no body called %s before here\n", path, lineNumber, parentName);
+				close();
+				return false;
+			}
+			static const SceneArray columns[] = {SCENE_RATE, SCENE_RADIUS, SCENE_ORBIT, SCENE_TILT,
+				SCENE_RED, SCENE_GREEN, SCENE_BLUE, SCENE_ALPHA};
+			for (int c = 0; c < 8 && ok; c++) {
+				bad = words[first + c];
+				// a rock's last column is its angle, and it is always opaque
+				SceneArray column = rock && c == 7 ? SCENE_ANGLE : columns[c];
+				ok = readFloat(words[first + c], body.values[column]);
+			}
+			// steps are blended the short way round, which only works under half a turn
+			if (ok && !(body.values[SCENE_RATE] > -180 && body.values[SCENE_RATE] < 180)) {
+				bad = words[first];
+				ok = false;
+			}
+			if (rock)
+				body.values[SCENE_ALPHA] = 1;
+			ok = ok && readAttributes(words + first + 8, count - first - 8, body, bad);
+
+			if (ok && rock) {
+				rocks.push_back(body);
+			}
+			else if (ok) {
+				if (indices.count(words[1])) {
+					fprintf(stderr, "scene: %s:%d: there is already a body called %s\n", path, lineNumber, words[1]);
+					close();
+					return false;
+				}
+				body.name = (int)nameStorage.size();
+				nameStorage.append(words[1]);
+				nameStorage.push_back('\0');
+				indices[words[1]] = (int)bodies.size();
+				bodies.push_back(body);
+			}
+		}
+		else if (!strcmp(words[0], "belt") && count == 4) {
+			// belt PARENT INNER OUTER
+			bad = words[1];
+			ok = indices.count(words[1]) > 0;
+			if (ok)
+				beltParent = indices[words[1]];
+			ok = ok && readFloat(words[2], beltInner) && readFloat(words[3], beltOuter);
+			haveBelt = true;
+		}
+		else if (!strcmp(words[0], "reference") && count == 2) {
+			referenceName = words[1];
+		}
+		else
+			ok = false;
+
+		if (!ok) {
+			fprintf(stderr, "scene: %s:%d: can't make sense of '%s'\n", path, lineNumber, bad);
+			close();
+			return false;
+		}
+	}
+
+	if (bodies.empty()) {
+		fprintf(stderr, "scene: %s has no bodies\n", path);
+		close();
+		return false;
+	}
+	// every rock is drawn as one belt, so they all have to go round one body
+	for (size_t r = 0; r < rocks.size(); r++) {
+		if (rocks[r].parent != rocks[0].parent || rocks[r].parent < 0 || (haveBelt && rocks[r].parent != beltParent)) {
+			fprintf(stderr, "scene: %s: every rock has to orbit the belt's body\n", path);
+			close();
+			return false;
+		}
+	}
+	if (!haveBelt)
+		beltParent = rocks.empty() ? 0 : rocks[0].parent;
+	if (!referenceName.empty()) {
+		if (!indices.count(referenceName)) {
+			fprintf(stderr, "scene: %s: no body called %s to be the reference\n", path, referenceName.c_str());
+			close();
+			return false;
+		}
+		reference = indices[referenceName];
+	}
+
+	bodyCount = (int)(bodies.size() + rocks.size());
+	firstRock = (int)bodies.size();
+	for (int a = 0; a < SCENE_ARRAY_COUNT; a++) {
+		if (isIntArray(a))
+			intStorage[a].resize(bodyCount);
+		else
+			floatStorage[a].resize(bodyCount);
+	}
+	for (int i = 0; i < bodyCount; i++) {
+		const ParsedBody &body = i < firstRock ? bodies[i] : rocks[i - firstRock];
+		for (int a = 0; a < SCENE_ARRAY_COUNT; a++)
+			if (!isIntArray(a))
+				floatStorage[a][i] = body.values[a];
+		intStorage[SCENE_PARENT][i] = body.parent;
+		intStorage[SCENE_FLAGS][i] = body.flags;
+		intStorage[SCENE_NAME][i] = body.name;
+	}
+	pointAtStorage();
+	return true;
+}
+
+void SceneFile::pointAtStorage() {
+	for (int a = 0; a < SCENE_ARRAY_COUNT; a++) {
+		if (isIntArray(a))
+			arrays[a] = intStorage[a].empty() ? NULL : &intStorage[a][0];
+		else
+			arrays[a] = floatStorage[a].empty() ? NULL : &floatStorage[a][0];
+	}
+	names = nameStorage.c_str();
+}
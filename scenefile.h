@@ -0,0 +1,100 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include<string>
+#include<vector>
+
+// Per-body arrays in a scene, in the order they are stored. Each is one
+// 4 byte value per body: floats, except for the parent, flags and name.
+enum SceneArray {
+	SCENE_RATE,           // degrees per step round its orbit
+	SCENE_RADIUS,         // size of the body
+	SCENE_ORBIT,          // distance from the parent
+	SCENE_TILT,           // degrees of tilt of the orbit about (1,1,1)
+	SCENE_PARENT,         // index of the parent body, or -1 (int)
+	SCENE_RED, SCENE_GREEN, SCENE_BLUE, SCENE_ALPHA,
+	SCENE_ANGLE,          // starting angle on the orbit
+	SCENE_MASS,           // relative to the root body's, for gravity
+	SCENE_ECCENTRICITY,   // orbital elements for the ephemeris, in degrees
+	SCENE_INCLINATION,
+	SCENE_NODE,
+	SCENE_PERIAPSIS,
+	SCENE_RING_INSET,     // how far inside the orbit its ring is drawn
+	SCENE_DISK_INNER,     // flat ring around the body, like Saturn's
+	SCENE_DISK_OUTER,
+	SCENE_DISK_TILT,
+	SCENE_FLAGS,          // SceneFlag bits (int)
+	SCENE_NAME,           // offset of the name in the name table (int)
+	SCENE_ARRAY_COUNT
+};
+
+enum SceneFlag {
+	SCENE_HAS_RING = 1,   // draw its orbit as a ring
+	SCENE_HAS_DISK = 2,
+	SCENE_NO_SPIN = 4,    // keeps the same face to its parent
+	SCENE_ROCK = 8        // drawn with the asteroid belt's instancing
+};
+
+// A scene: the bodies to simulate and draw, plus where --belt puts its rocks.
+// Scenes are written as text (see solarsystem.scene for the format) and can be
+// compiled to a binary file of aligned arrays, one per SceneArray. A compiled
+// scene is mapped into memory and its arrays are used where they are, so
+// loading one costs the same whatever its size: nothing is parsed or copied.
+//
+// Parents always come before their children, and rocks come after every
+// other body.
+class SceneFile {
+public:
+	SceneFile();
+	~SceneFile();
+
+	// Load a scene from a text or compiled file; which one it is comes from
+	// its first bytes. Returns false (and prints why) if it can't be used.
+	bool load(const char *path);
+	// Write the scene in compiled form
+	bool save(const char *path) const;
+	// Forget the scene, unmapping its file
+	void close();
+
+	int count() const { return bodyCount; }
+	// bodies from here on are rocks
+	int getFirstRock() const { return firstRock; }
+	// the body whose orbit sets the root's mass for gravity, or -1
+	int getReference() const { return reference; }
+	// where --belt puts its rocks
+	int getBeltParent() const { return beltParent; }
+	float getBeltInner() const { return beltInner; }
+	float getBeltOuter() const { return beltOuter; }
+	// true for a compiled scene, whose arrays are the file's own memory
+	bool isCompiled() const { return compiled; }
+
+	const float *floats(SceneArray array) const { return (const float *)arrays[array]; }
+	const int *ints(SceneArray array) const { return (const int *)arrays[array]; }
+	const char *name(int body) const { return names + ints(SCENE_NAME)[body]; }
+	// index of the body with that name, or -1
+	int find(const char *name) const;
+
+private:
+	bool parse(const char *path, const char *text, size_t size);
+	bool useCompiled(const char *path, const char *base, size_t size);
+	void pointAtStorage();
+	void unmap();
+
+	bool compiled;
+	int bodyCount, firstRock, reference, beltParent;
+	float beltInner, beltOuter;
+	const void *arrays[SCENE_ARRAY_COUNT];
+	const char *names;
+
+	// a parsed text scene keeps its arrays here
+	std::vector<float> floatStorage[SCENE_ARRAY_COUNT];
+	std::vector<int> intStorage[SCENE_ARRAY_COUNT];
+	std::string nameStorage;
+
+	// the file, mapped into memory, or read in where there is no mmap
+	void *mapping;
+	size_t mappingBytes;
+	std::vector<char> fileCopy;
+};
+
+#endif
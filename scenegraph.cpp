@@ -0,0 +1,93 @@
+#include "scenegraph.h"
+#include "matrix.h"
+#include "jobsystem.h"
+
+#include<atomic>
+#include<string.h>
+
+// Nodes per job when a level is split over threads
+static const int NODE_GRAIN = 512;
+
+int SceneGraph::add(int nodeParent) {
+	int node = count();
+	parent.push_back(nodeParent);
+	depth.push_back(nodeParent < 0 ? 0 : depth[nodeParent] + 1);
+	locals.resize(locals.size() + 16);
+	worlds.resize(worlds.size() + 16);
+	mat4Identity(&locals[node * 16]);
+	mat4Identity(&worlds[node * 16]);
+	dirty.push_back(1);
+	return node;
+}
+
+void SceneGraph::setLocal(int node, const float *m) {
+	float *current = &locals[node * 16];
+	if (memcmp(current, m, 16 * sizeof(float)) == 0)
+		return;
+	mat4Copy(m, current);
+	dirty[node] = 1;
+}
+
+// A node whose parent was recomputed in this pass is recomputed too. Parents
+// come before their children, so by the time a node is reached its parent's
+// flag already says whether that happened.
+int SceneGraph::update(JobSystem *jobs) {
+	int n = count();
+	int recomputed = 0;
+	if (!jobs || jobs->getThreads() == 1 || n <= NODE_GRAIN) {
+		for (int node = 0; node < n; node++)
+			recomputed += updateNode(node);
+	}
+	else {
+		// the nodes of a level only depend on the levels above, so each level
+		// can be split up once the one above it is done
+		buildLevels();
+		std::atomic<int> total(0);
+		for (size_t level = 0; level + 1 < levelStart.size(); level++) {
+			const int *nodes = &levels[levelStart[level]];
+			parallelFor(jobs, "SceneGraph::update", levelStart[level + 1] - levelStart[level], NODE_GRAIN,
+				[this, nodes, &total](int begin, int end) {
+					int done = 0;
+					for (int k = begin; k < end; k++)
+						done += updateNode(nodes[k]);
+					total += done;
+				});
+		}
+		recomputed = total;
+	}
+	// the flags were needed for the whole pass, so only clear them now
+	for (int node = 0; node < n; node++)
+		dirty[node] = 0;
+	return recomputed;
+}
+
+int SceneGraph::updateNode(int node) {
+	int p = parent[node];
+	if (p >= 0 && dirty[p])
+		dirty[node] = 1;
+	if (!dirty[node])
+		return 0;
+	if (p >= 0)
+		mat4Multiply(&worlds[p * 16], &locals[node * 16], &worlds[node * 16]);
+	else
+		mat4Copy(&locals[node * 16], &worlds[node * 16]);
+	return 1;
+}
+
+void SceneGraph::buildLevels() {
+	if ((int)levels.size() == count())
+		return;
+	// a counting sort of the nodes by depth, each level in the order added
+	int deepest = 0;
+	for (int node = 0; node < count(); node++)
+		deepest = depth[node] > deepest ? depth[node] : deepest;
+	levelStart.assign(deepest + 2, 0);
+	for (int node = 0; node < count(); node++)
+		levelStart[depth[node] + 1]++;
+	for (int level = 1; level <= deepest + 1; level++)
+		levelStart[level] += levelStart[level - 1];
+	std::vector<int> cursor(levelStart.begin(), levelStart.end() - 1);
+	levels.resize(count());
+	for (int node = 0; node < count(); node++)
+		levels[cursor[depth[node]]++] = node;
+}
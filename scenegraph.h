@@ -0,0 +1,56 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include<stddef.h>
+#include<vector>
+
+class JobSystem;
+
+// Transform hierarchy for everything placed relative to something else: each
+// node has a local matrix, relative to its parent, and a cached world matrix.
+// Setting a local matrix only marks the node dirty; update() then recomputes
+// the world matrices of the dirty nodes and everything below them, once, and
+// every reader after that gets the cached result.
+//
+// Nodes are stored in the order they were added, and a parent always has to
+// exist before its children, so a single pass from the front is enough to
+// bring the whole graph up to date. Split over threads, the pass goes a level
+// of the hierarchy at a time instead.
+class SceneGraph {
+public:
+	// Adds a node under parent (-1 for a root) with an identity local matrix
+	// and returns its index.
+	int add(int parent);
+
+	int count() const { return (int)parent.size(); }
+	int getParent(int node) const { return parent[node]; }
+
+	// Set a node's matrix relative to its parent. Setting the matrix it
+	// already has does not dirty it.
+	void setLocal(int node, const float *m);
+	const float *local(int node) const { return &locals[node * 16]; }
+
+	// Recompute the world matrix of every dirty node and its descendants,
+	// with big graphs split over the threads of jobs if given. Returns how
+	// many were recomputed.
+	int update(JobSystem *jobs = NULL);
+
+	// World matrix as of the last update()
+	const float *world(int node) const { return &worlds[node * 16]; }
+
+private:
+	// recompute one node if it or its parent is dirty; returns 1 if it was
+	int updateNode(int node);
+	// sort the nodes into levels, if any were added since the last time
+	void buildLevels();
+
+	std::vector<int> parent;
+	std::vector<int> depth;        // how many ancestors each node has
+	std::vector<int> levels;       // the nodes by depth, built on demand
+	std::vector<int> levelStart;   // where each depth starts in levels
+	std::vector<float> locals;
+	std::vector<float> worlds;
+	std::vector<unsigned char> dirty;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#include "simclock.h"
+
+#include<math.h>
+
+SimClock::SimClock(double stepSeconds, double maxFrameSeconds)
+	: stepSeconds(stepSeconds), maxSteps((int)(maxFrameSeconds / stepSeconds)), timeScale(1),
+	accumulator(0), droppedSteps(0), steps(0) {
+	if (maxSteps < 1)
+		maxSteps = 1;
+}
+
+int SimClock::advance(double realSeconds) {
+	if (realSeconds < 0)
+		realSeconds = 0;
+
+	accumulator += realSeconds * timeScale;
+	int count = 0;
+	while (accumulator >= stepSeconds && count < maxSteps) {
+		accumulator -= stepSeconds;
+		count++;
+	}
+	if (accumulator >= stepSeconds) {
+		// capped after scaling, so a fast time scale can't make one slow frame
+		// cost hundreds of steps; only the partial step is kept
+		double over = floor(accumulator / stepSeconds);
+		droppedSteps += (long long)over;
+		accumulator -= over * stepSeconds;
+		if (accumulator < 0 || accumulator >= stepSeconds)
+			accumulator = 0;
+	}
+	steps += count;
+	return count;
+}
+
+int SimClock::step() {
+	steps++;
+	return 1;
+}
+
+void SimClock::replay(int count, double fraction) {
+	steps += count;
+	accumulator = fraction * stepSeconds;
+}
+
+void SimClock::restore(long long stepCount, double fraction) {
+	steps = stepCount;
+	accumulator = fraction * stepSeconds;
+}
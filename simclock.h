@@ -0,0 +1,59 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+// Fixed timestep simulation clock. Real time is fed in as it passes, scaled by
+// the time scale, and collected until there is enough for whole steps; the
+// simulation then runs that many steps of exactly stepSeconds each. Whatever
+// is left over becomes the interpolation fraction used for rendering.
+//
+// To keep a slow frame from causing more and more catch-up work (the "spiral
+// of death"), a single advance never hands out more steps than
+// maxFrameSeconds covers at normal speed, whatever the time scale. Steps past
+// that are dropped instead of simulated.
+class SimClock {
+public:
+	SimClock(double stepSeconds, double maxFrameSeconds);
+
+	// Add realSeconds of wall clock time. Returns how many steps to run now.
+	int advance(double realSeconds);
+	// Hand out exactly one step, whatever the time scale, leaving the blend
+	// as it was. For runs that go a step per frame however fast they draw.
+	int step();
+
+	// Fraction of a step between the last step and now, in [0,1). Rendering
+	// blends the previous and current states by this much.
+	double alpha() const { return accumulator / stepSeconds; }
+
+	// simulated time per real time, 1 being normal speed
+	void setTimeScale(double scale) { timeScale = scale; }
+	double getTimeScale() const { return timeScale; }
+
+	// forget any partial step, e.g. after pausing
+	void resetAccumulator() { accumulator = 0; }
+
+	// Hand out count steps and leave fraction of a step over, whatever the
+	// real time is, for replaying a recorded frame
+	void replay(int count, double fraction);
+
+	// Put the clock back to a saved point: stepCount steps handed out and
+	// fraction of a step over
+	void restore(long long stepCount, double fraction);
+
+	double getStepSeconds() const { return stepSeconds; }
+	// total steps handed out so far, i.e. the index of the next step
+	long long getSteps() const { return steps; }
+	// simulated seconds covered by those steps
+	double getTime() const { return steps * stepSeconds; }
+	// steps thrown away because frames took too long
+	long long getDroppedSteps() const { return droppedSteps; }
+
+private:
+	double stepSeconds;
+	int maxSteps;
+	double timeScale;
+	double accumulator;
+	long long droppedSteps;
+	long long steps;
+};
+
+#endif
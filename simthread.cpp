@@ -0,0 +1,90 @@
+#include "simthread.h"
+#include "benchmark.h"
+#include "profiler.h"
+
+#include<chrono>
+
+SimFrames::SimFrames() : middle(1), writeSlot(0), readSlot(2), published(0) {
+	for (int i = 0; i < 3; i++) {
+		slots[i].steps = 0;
+		slots[i].alpha = 0;
+		slots[i].sequence = 0;
+	}
+}
+
+void SimFrames::init(const SceneGraph &scene, const AsteroidBelt &belt) {
+	for (int i = 0; i < 3; i++) {
+		slots[i].scene = scene;
+		slots[i].belt = belt;
+	}
+}
+
+void SimFrames::publish() {
+	slots[writeSlot].sequence = ++published;
+	// release the frame just written, and take whichever one was in the middle
+	int old = middle.exchange(writeSlot | FRESH, std::memory_order_acq_rel);
+	writeSlot = old & ~FRESH;
+}
+
+const SimFrame &SimFrames::latest() {
+	if (middle.load(std::memory_order_relaxed) & FRESH) {
+		// the writer may have published again since, which only makes it newer
+		int old = middle.exchange(readSlot, std::memory_order_acq_rel);
+		readSlot = old & ~FRESH;
+	}
+	return slots[readSlot];
+}
+
+SimThread::SimThread() : stopping(false), waiting(0), ticks(0), late(0), tick(NULL), periodMs(0) {
+}
+
+SimThread::~SimThread() {
+	stop();
+}
+
+void SimThread::start(void (*function)(), double period) {
+	stop();
+	tick = function;
+	periodMs = period;
+	stopping = false;
+	thread = std::thread([this]() { run(); });
+}
+
+void SimThread::stop() {
+	if (!thread.joinable())
+		return;
+	stopping = true;
+	thread.join();
+}
+
+void SimThread::lock() {
+	waiting++;
+	mutex.lock();
+	waiting--;
+}
+
+void SimThread::run() {
+	profileThread("simulation");
+	double deadline = currentTimeMs();
+	while (!stopping) {
+		// let a lock() in ahead of the next tick, or it could wait for many
+		while (waiting > 0)
+			std::this_thread::yield();
+		{
+			std::lock_guard<std::mutex> hold(mutex);
+			if (stopping)
+				break;
+			tick();
+		}
+		ticks++;
+
+		double now = currentTimeMs();
+		deadline += periodMs;
+		if (now > deadline) {
+			late++;
+			deadline = now;
+		}
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds((long long)((deadline - now) * 1000)));
+	}
+}
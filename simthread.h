@@ -0,0 +1,93 @@
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include "scenegraph.h"
+#include "belt.h"
+
+#include<atomic>
+#include<mutex>
+#include<thread>
+
+// Everything the renderer reads from the simulation for one moment of it:
+// the world matrices of every body and the belt's instances and sectors. The
+// body store's constants (sizes, colors) never change, so they aren't in here.
+struct SimFrame {
+	SceneGraph scene;
+	AsteroidBelt belt;
+	long long steps;   // the clock's step count it was made at
+	float alpha;       // and the blend into the next step
+	int sequence;      // counts the frames published, from 1
+};
+
+// Three frames passed from one thread that makes them to one that draws them,
+// without either waiting on the other. The writer fills back() and publishes
+// it, which swaps it with the frame in the middle; the reader swaps the middle
+// one for its own whenever a newer one has been published. Each side always
+// has a frame of its own, so a frame is never changed while it is read, and
+// the reader always gets the newest complete one. Frames the reader never got
+// round to are overwritten.
+//
+// A slot is written again two or three publishes after it was last written,
+// so whatever is filled in has to be filled in completely every time.
+class SimFrames {
+public:
+	SimFrames();
+
+	// Every slot starts as a copy of scene and belt, which should be the
+	// simulation's own laid out and up to date. Not thread safe.
+	void init(const SceneGraph &scene, const AsteroidBelt &belt);
+
+	// writer's side: the frame to fill in, then hand it over
+	SimFrame &back() { return slots[writeSlot]; }
+	void publish();
+
+	// reader's side: the newest published frame, or the first one init()
+	// copied until there is one. Stays the same until the next call.
+	const SimFrame &latest();
+
+private:
+	// set in middle while the frame there hasn't been taken by the reader
+	static const int FRESH = 4;
+
+	SimFrame slots[3];
+	std::atomic<int> middle;
+	int writeSlot, readSlot;
+	int published;
+};
+
+// Calls a function over and over on a thread of its own, on a grid of ticks
+// periodMs apart. A tick that runs late starts the grid again rather than
+// running the ones it missed back to back. Another thread can hold it
+// between ticks, to change what it works on, with lock() and unlock().
+class SimThread {
+public:
+	SimThread();
+	~SimThread();
+
+	void start(void (*tick)(), double periodMs);
+	// finishes the tick in progress, if any, and joins the thread
+	void stop();
+	bool isRunning() const { return thread.joinable(); }
+
+	// Waits for the tick in progress to finish and keeps the next one from
+	// starting until unlock(). Ticks give way to a waiting lock().
+	void lock();
+	void unlock() { mutex.unlock(); }
+
+	// ticks run, and ticks that ran past their period
+	int getTicks() const { return ticks; }
+	int getLate() const { return late; }
+
+private:
+	void run();
+
+	std::thread thread;
+	std::mutex mutex;
+	std::atomic<bool> stopping;
+	std::atomic<int> waiting;
+	std::atomic<int> ticks, late;
+	void (*tick)();
+	double periodMs;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "snapshot.h"
+#include "benchmark.h"
+
+#include<stdio.h>
+#include<string.h>
+
+static const char MAGIC[4] = {'S', 'S', 'N', 'P'};
+static const unsigned int VERSION = 1;
+
+void Snapshot::put(const char *tag, const void *data, size_t bytes) {
+	Section *section = NULL;
+	for (size_t i = 0; i < sections.size() && !section; i++)
+		if (memcmp(sections[i].tag, tag, 4) == 0)
+			section = &sections[i];
+	if (!section) {
+		sections.push_back(Section());
+		section = &sections.back();
+		memcpy(section->tag, tag, 4);
+	}
+	const unsigned char *begin = (const unsigned char *)data;
+	section->data.assign(begin, begin + (data ? bytes : 0));
+}
+
+const void *Snapshot::find(const char *tag, size_t &bytes) const {
+	for (size_t i = 0; i < sections.size(); i++) {
+		if (memcmp(sections[i].tag, tag, 4) == 0) {
+			bytes = sections[i].data.size();
+			return sections[i].data.empty() ? (const void *)"" : &sections[i].data[0];
+		}
+	}
+	bytes = 0;
+	return NULL;
+}
+
+bool Snapshot::get(const char *tag, void *out, size_t bytes) const {
+	size_t stored;
+	const void *data = find(tag, stored);
+	if (!data || stored != bytes)
+		return false;
+	if (bytes > 0)
+		memcpy(out, data, bytes);
+	return true;
+}
+
+size_t Snapshot::bytes() const {
+	size_t total = 0;
+	for (size_t i = 0; i < sections.size(); i++)
+		total += sections[i].data.size();
+	return total;
+}
+
+static void putLittle(unsigned char *out, unsigned long long value, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out[i] = (unsigned char)(value >> (8 * i));
+}
+
+static unsigned long long getLittle(const unsigned char *in, int bytes) {
+	unsigned long long value = 0;
+	for (int i = 0; i < bytes; i++)
+		value |= (unsigned long long)in[i] << (8 * i);
+	return value;
+}
+
+bool Snapshot::write(const char *path) const {
+	std::string temporary = std::string(path) + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "snapshot: could not write %s\n", temporary.c_str());
+		return false;
+	}
+	unsigned char header[12];
+	memcpy(header, MAGIC, 4);
+	putLittle(header + 4, VERSION, 4);
+	putLittle(header + 8, sections.size(), 4);
+	bool ok = fwrite(header, 1, 12, file) == 12;
+	for (size_t i = 0; i < sections.size() && ok; i++) {
+		const Section &section = sections[i];
+		unsigned char head[12];
+		memcpy(head, section.tag, 4);
+		putLittle(head + 4, section.data.size(), 8);
+		ok = fwrite(head, 1, 12, file) == 12
+			&& (section.data.empty() || fwrite(&section.data[0], 1, section.data.size(), file) == section.data.size());
+	}
+	if (fclose(file) != 0 || !ok || rename(temporary.c_str(), path) != 0) {
+		fprintf(stderr, "snapshot: could not write %s\n", path);
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Snapshot::read(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "snapshot: could not read %s\n", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	unsigned long long left = (unsigned long long)ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char header[12];
+	if (fread(header, 1, 12, file) != 12 || memcmp(header, MAGIC, 4) != 0 || getLittle(header + 4, 4) != VERSION) {
+		fprintf(stderr, "snapshot: %s is not a snapshot this version can read\n", path);
+		fclose(file);
+		return false;
+	}
+	left -= 12;
+	std::vector<Section> loaded;
+	unsigned long long count = getLittle(header + 8, 4);
+	bool ok = true;
+	for (unsigned long long i = 0; i < count && ok; i++) {
+		unsigned char head[12];
+		ok = left >= 12 && fread(head, 1, 12, file) == 12;
+		unsigned long long length = ok ? getLittle(head + 4, 8) : 0;
+		// checked before anything is allocated for it
+		ok = ok && length <= left - 12;
+		if (!ok)
+			break;
+		left -= 12 + length;
+		loaded.push_back(Section());
+		memcpy(loaded.back().tag, head, 4);
+		loaded.back().data.resize((size_t)length);
+		ok = length == 0 || fread(&loaded.back().data[0], 1, (size_t)length, file) == length;
+	}
+	fclose(file);
+	if (!ok) {
+		fprintf(stderr, "snapshot: %s is cut off\n", path);
+		return false;
+	}
+	sections.swap(loaded);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////
+/// Background writing ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////////
+
+SnapshotWriter::SnapshotWriter() : done(false), reported(true), writeOk(false), writeMs(0) {
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	wait();
+}
+
+void SnapshotWriter::write(const char *path, Snapshot &snapshot) {
+	wait();
+	pending.clear();
+	pending.swap(snapshot);
+	pendingPath = path;
+	done = false;
+	reported = false;
+	thread = std::thread([this]() {
+		double start = currentTimeMs();
+		writeOk = pending.write(pendingPath.c_str());
+		writeMs = currentTimeMs() - start;
+		done = true;
+	});
+}
+
+bool SnapshotWriter::finished(bool &ok, std::string &path, double &ms) {
+	if (reported || !done)
+		return false;
+	wait();
+	reported = true;
+	ok = writeOk;
+	path = pendingPath;
+	ms = writeMs;
+	return true;
+}
+
+void SnapshotWriter::wait() {
+	if (thread.joinable())
+		thread.join();
+}
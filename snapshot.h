@@ -0,0 +1,90 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include<string>
+#include<vector>
+#include<thread>
+#include<atomic>
+
+// A frozen copy of a session's state, as a list of sections each holding one
+// value or array under a four letter tag. What goes in the sections is up to
+// whoever fills them; the snapshot only stores them and finds them again.
+// Taking one is a copy per section and nothing else, so it can be done in
+// the middle of the frame loop and written out afterwards.
+//
+// File format, integers little endian:
+//   "SSNP", version (4 bytes), section count (4 bytes)
+//   per section: tag (4 bytes), length (8 bytes), the bytes
+class Snapshot {
+public:
+	void clear() { sections.clear(); }
+
+	// Store bytes under tag, replacing anything already there
+	void put(const char *tag, const void *data, size_t bytes);
+	template<class T> void put(const char *tag, const T &value) { put(tag, &value, sizeof(T)); }
+	template<class T> void putArray(const char *tag, const std::vector<T> &values) {
+		put(tag, values.empty() ? NULL : &values[0], values.size() * sizeof(T));
+	}
+
+	// The bytes stored under tag and how many there are, or NULL if there's
+	// no such section
+	const void *find(const char *tag, size_t &bytes) const;
+	// Copy a section out. Returns false, leaving out alone, unless the
+	// section is there and exactly bytes long.
+	bool get(const char *tag, void *out, size_t bytes) const;
+	template<class T> bool get(const char *tag, T &value) const { return get(tag, &value, sizeof(T)); }
+	// Copy a section into values, which has to be the same size already
+	template<class T> bool getArray(const char *tag, std::vector<T> &values) const {
+		return get(tag, values.empty() ? NULL : &values[0], values.size() * sizeof(T));
+	}
+
+	// Total size of the sections, for reporting
+	size_t bytes() const;
+
+	// Write to path, by way of a temporary file that is renamed over it, so
+	// a crash while writing never leaves half a snapshot. Returns false (and
+	// prints why) if it can't be written.
+	bool write(const char *path) const;
+	// Replace this snapshot with the one in path. Returns false (and prints
+	// why) if the file is missing, from another version or cut off.
+	bool read(const char *path);
+
+	void swap(Snapshot &other) { sections.swap(other.sections); }
+
+private:
+	struct Section {
+		char tag[4];
+		std::vector<unsigned char> data;
+	};
+	std::vector<Section> sections;
+};
+
+// Writes snapshots to disk on a thread of its own, so the frame that asked
+// for one only pays for the copy.
+class SnapshotWriter {
+public:
+	SnapshotWriter();
+	~SnapshotWriter();
+
+	// Take the snapshot over, leaving it empty, and start writing it to path.
+	// Waits for the write before it to finish first.
+	void write(const char *path, Snapshot &snapshot);
+
+	// True once, when a write has finished since the last call: whether it
+	// worked, where it went and how long the thread spent on it
+	bool finished(bool &ok, std::string &path, double &ms);
+
+	// Wait for the write in progress, if any
+	void wait();
+
+private:
+	std::thread thread;
+	Snapshot pending;
+	std::string pendingPath;
+	std::atomic<bool> done;
+	bool reported;
+	bool writeOk;
+	double writeMs;
+};
+
+#endif